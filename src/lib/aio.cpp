@@ -0,0 +1,864 @@
+#include "aio.hpp"
+#include "thread.hpp"
+#include "box.hpp"
+#include "raw.hpp"
+#include "text.hpp"
+#include "platform.hpp"
+#ifdef __unix__
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef __unix__
+int get_fd (opaque_t opaq);
+opaque_t create_opaque_fd (int fd);
+#endif
+void_t* get_ptr (opaque_t opaq);
+opaque_t create_opaque_ptr (void_t* ptr);
+
+#ifdef __linux__
+// The kernel's abi, as laid out in linux/io_uring.h, which older toolchains don't ship
+
+struct uring_sq_offs_t
+{
+	nat4_t head         {};
+	nat4_t tail         {};
+	nat4_t ring_mask    {};
+	nat4_t ring_entries {};
+	nat4_t flags        {};
+	nat4_t dropped      {};
+	nat4_t array        {};
+	nat4_t resv1        {};
+	nat8_t resv2        {};
+};
+
+struct uring_cq_offs_t
+{
+	nat4_t head         {};
+	nat4_t tail         {};
+	nat4_t ring_mask    {};
+	nat4_t ring_entries {};
+	nat4_t overflow     {};
+	nat4_t cqes         {};
+	nat4_t flags        {};
+	nat4_t resv1        {};
+	nat8_t resv2        {};
+};
+
+struct uring_params_t
+{
+	nat4_t          sq_entries     {};
+	nat4_t          cq_entries     {};
+	nat4_t          flags          {};
+	nat4_t          sq_thread_cpu  {};
+	nat4_t          sq_thread_idle {};
+	nat4_t          features       {};
+	nat4_t          wq_fd          {};
+	nat4_t          resv[3]        {};
+	uring_sq_offs_t sq_off         {};
+	uring_cq_offs_t cq_off         {};
+};
+static_assert(sizeof(uring_params_t) == 120);
+
+struct uring_sqe_t
+{
+	nat1_t opcode      {};
+	nat1_t flags       {};
+	nat2_t ioprio      {};
+	int    fd          {};
+	nat8_t off         {};
+	nat8_t addr        {};
+	nat4_t len         {};
+	nat4_t op_flags    {};
+	nat8_t user_data   {};
+	nat2_t buf_index   {};
+	nat2_t personality {};
+	nat4_t file_index  {};
+	nat8_t pad[2]      {};
+};
+static_assert(sizeof(uring_sqe_t) == 64);
+
+struct uring_cqe_t
+{
+	nat8_t user_data {};
+	int    res       {};
+	nat4_t flags     {};
+};
+static_assert(sizeof(uring_cqe_t) == 16);
+
+const long   uring_setup_nr    = 425;
+const long   uring_enter_nr    = 426;
+const long   uring_register_nr = 427;
+const off_t  uring_sq_ring_off = 0;
+const off_t  uring_cq_ring_off = 0x8000000;
+const off_t  uring_sqes_off    = 0x10000000;
+
+const nat4_t uring_feat_single_mmap = 1U << 0;
+const nat4_t uring_feat_nodrop      = 1U << 1;
+const nat4_t uring_feat_rw_cur_pos  = 1U << 3;
+const nat4_t uring_enter_getevents  = 1U << 0;
+const nat1_t uring_sqe_fixed_file   = 1U << 0;
+
+const nat1_t uring_op_fsync       = 3;
+const nat1_t uring_op_read_fixed  = 4;
+const nat1_t uring_op_write_fixed = 5;
+const nat1_t uring_op_openat      = 18;
+const nat1_t uring_op_read        = 22;
+const nat1_t uring_op_write       = 23;
+
+const nat4_t uring_register_bufs    = 0;
+const nat4_t uring_unregister_bufs  = 1;
+const nat4_t uring_register_files   = 2;
+const nat4_t uring_unregister_files = 3;
+const nat4_t uring_register_eventfd = 4;
+#endif
+
+enum class io_kind_t : nat1_t
+{
+	none  = 0,
+	read  = 1,
+	write = 2,
+	fsync = 3,
+	open  = 4,
+};
+
+struct io_req_t
+{
+	nat8_t    token   {};
+	file_t*   file    {};
+	nat8_t    at      {};
+	nat1_t*   ptr     {};
+	nat8_t    len     {};
+	path_t    path    {};
+	io_kind_t kind    {};
+	bool_t    writing {};
+	pad_t<6>  padding {};
+};
+
+// what the kernel ring needs to remember about an op until its completion turns up
+struct io_slot_t
+{
+	nat8_t    token   {};
+	io_kind_t kind    {};
+	pad_t<7>  padding {};
+};
+
+struct io_ring_state_t
+{
+	// kernel ring, when ring is set
+	opaque_t            ring        {};
+	opaque_t            done_fd     {};
+	nat1_t*             sq_map      {};
+	nat8_t              sq_map_len  {};
+	nat1_t*             cq_map      {};
+	nat8_t              cq_map_len  {};
+	void_t*             sqes_map    {};
+	nat8_t              sqes_len    {};
+	nat4_t*             sq_head     {};
+	nat4_t*             sq_tail     {};
+	nat4_t*             sq_array    {};
+	nat4_t*             cq_head     {};
+	nat4_t*             cq_tail     {};
+	void_t*             sqes        {};
+	void_t*             cqes        {};
+	seq_t<io_slot_t>    slots       {};
+	seq_t<nat4_t>       free_slots  {};
+	seq_t<seq_t<char>>  open_paths  {};
+	seq_t<int>          fixed_fds   {};
+	seq_t<view_t<nat1_t>> fixed_bufs {};
+	nat4_t              sq_mask     {};
+	nat4_t              cq_mask     {};
+	nat4_t              sq_entries  {};
+	nat4_t              sq_local    {}; // our tail, ahead of the kernel's by the ops not yet submitted
+
+	// thread pool otherwise
+	mutex_t             mutex       {};
+	sem_t               work_sem    {};
+	sem_t               done_sem    {};
+	sem_t               exit_sem    {};
+	seq_t<io_req_t>     queued      {};
+	seq_t<io_req_t>     reqs        {};
+	nat8_t              reqs_at     {};
+	seq_t<io_done_t>    dones       {};
+	nat8_t              dones_at    {};
+	nat4_t              workers_n   {};
+	bool_t              stopping    {};
+	pad_t<3>            padding     {};
+
+	nat8_t              in_flight   {};
+};
+
+io_ring_state_t& get_state (const io_ring_t& ring)
+{
+	assert_true(ring.opaq);
+	return *static_cast<io_ring_state_t*>(get_ptr(ring.opaq));
+}
+
+#ifdef __linux__
+template<typename val_t> val_t* at_offset (nat1_t* base, nat4_t off)
+{
+	return static_cast<val_t*>(static_cast<void_t*>(base + off));
+}
+
+void_t close_uring (io_ring_state_t& st)
+{
+	if (st.sqes_map) { munmap(st.sqes_map, st.sqes_len); }
+	if (st.cq_map && st.cq_map != st.sq_map) { munmap(st.cq_map, st.cq_map_len); }
+	if (st.sq_map) { munmap(st.sq_map, st.sq_map_len); }
+	if (st.ring) { close(get_fd(st.ring)); }
+	if (st.done_fd) { close(get_fd(st.done_fd)); }
+	st.sqes_map = nullptr;
+	st.cq_map   = nullptr;
+	st.sq_map   = nullptr;
+	st.ring     = {};
+	st.done_fd  = {};
+}
+
+// a missing or refused io_uring isn't an error, the pool takes over instead
+bool_t open_uring (io_ring_state_t& st, nat4_t depth)
+{
+	uring_params_t params;
+	const auto fd = static_cast<int>(syscall(uring_setup_nr, depth, &params));
+	if (fd < 0) { return false; }
+	st.ring = create_opaque_fd(fd);
+
+	// plain reads and writes at an offset came with 5.6
+	if (!(params.features & uring_feat_rw_cur_pos) || !(params.features & uring_feat_nodrop)) {
+		close_uring(st);
+		return false;
+	}
+
+	st.sq_map_len = params.sq_off.array + params.sq_entries * sizeof(nat4_t);
+	st.cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(uring_cqe_t);
+	const auto single = (params.features & uring_feat_single_mmap) != 0;
+	if (single) {
+		st.sq_map_len = st.sq_map_len > st.cq_map_len ? st.sq_map_len : st.cq_map_len;
+	}
+	const auto prot = PROT_READ | PROT_WRITE;
+	const auto flags = MAP_SHARED | MAP_POPULATE;
+	if (auto ptr = mmap(nullptr, st.sq_map_len, prot, flags, fd, uring_sq_ring_off); ptr != MAP_FAILED) {
+		st.sq_map = static_cast<nat1_t*>(ptr);
+	}
+	if (single) {
+		st.cq_map = st.sq_map;
+	} else if (auto ptr = mmap(nullptr, st.cq_map_len, prot, flags, fd, uring_cq_ring_off); ptr != MAP_FAILED) {
+		st.cq_map = static_cast<nat1_t*>(ptr);
+	}
+	st.sqes_len = params.sq_entries * sizeof(uring_sqe_t);
+	if (auto ptr = mmap(nullptr, st.sqes_len, prot, flags, fd, uring_sqes_off); ptr != MAP_FAILED) {
+		st.sqes_map = ptr;
+	}
+	if (!st.sq_map || !st.cq_map || !st.sqes_map) {
+		close_uring(st);
+		return false;
+	}
+
+	st.sq_head    = at_offset<nat4_t>(st.sq_map, params.sq_off.head);
+	st.sq_tail    = at_offset<nat4_t>(st.sq_map, params.sq_off.tail);
+	st.sq_array   = at_offset<nat4_t>(st.sq_map, params.sq_off.array);
+	st.sq_mask    = *at_offset<nat4_t>(st.sq_map, params.sq_off.ring_mask);
+	st.cq_head    = at_offset<nat4_t>(st.cq_map, params.cq_off.head);
+	st.cq_tail    = at_offset<nat4_t>(st.cq_map, params.cq_off.tail);
+	st.cq_mask    = *at_offset<nat4_t>(st.cq_map, params.cq_off.ring_mask);
+	st.cqes       = st.cq_map + params.cq_off.cqes;
+	st.sqes       = st.sqes_map;
+	st.sq_entries = params.sq_entries;
+	st.sq_local   = *st.sq_tail;
+
+	const auto efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd < 0) {
+		close_uring(st);
+		return false;
+	}
+	st.done_fd = create_opaque_fd(efd);
+	if (syscall(uring_register_nr, fd, uring_register_eventfd, &efd, 1) != 0) {
+		close_uring(st);
+		return false;
+	}
+	return true;
+}
+
+void_t flush_uring (io_ring_state_t& st, err_t& err)
+{
+	__atomic_store_n(st.sq_tail, st.sq_local, __ATOMIC_RELEASE);
+	auto left = st.sq_local - __atomic_load_n(st.sq_head, __ATOMIC_ACQUIRE);
+	while (left > 0) {
+		const auto stat = syscall(uring_enter_nr, get_fd(st.ring), left, 0, 0, nullptr, 0);
+		if (stat < 0) {
+			if (errno == EINTR) { continue; }
+			err = decode_os_err(errno);
+			break;
+		}
+		st.in_flight += static_cast<nat8_t>(stat);
+		left -= static_cast<nat4_t>(stat);
+	}
+	// the kernel takes the paths of opens when they're submitted, but until all of them have been, the ones still
+	// in the ring point into these
+	if (!left) { st.open_paths = {}; }
+}
+
+// Null when the ring's full and couldn't be flushed to make room
+uring_sqe_t* next_sqe (io_ring_state_t& st, io_kind_t kind, nat8_t token, err_t& err)
+{
+	if (err) { return nullptr; }
+
+	if (st.sq_local - __atomic_load_n(st.sq_head, __ATOMIC_ACQUIRE) == st.sq_entries) {
+		flush_uring(st, err);
+		if (err) { return nullptr; }
+	}
+
+	if (!st.free_slots) {
+		const auto old_len = st.slots.len;
+		const auto inc_len = old_len > 64 ? old_len : 64;
+		grow(st.slots, old_len, inc_len);
+		grow(st.free_slots, 0, inc_len);
+		for (auto i : create_range(inc_len)) {
+			st.free_slots[i] = static_cast<nat4_t>(old_len + inc_len - 1 - i);
+		}
+	}
+	const auto slot_i = st.free_slots[st.free_slots.len - 1];
+	shrink(st.free_slots, st.free_slots.len - 1, 1);
+	st.slots[slot_i].token = token;
+	st.slots[slot_i].kind  = kind;
+
+	const auto i = st.sq_local & st.sq_mask;
+	st.sq_array[i] = i;
+	++st.sq_local;
+	auto& sqe = static_cast<uring_sqe_t*>(st.sqes)[i];
+	sqe = {};
+	sqe.user_data = slot_i;
+	return &sqe;
+}
+
+void_t set_file (io_ring_state_t& st, uring_sqe_t& sqe, file_t& file)
+{
+	sqe.fd = get_fd(file.opaq);
+	for (auto i : create_range(st.fixed_fds.len)) {
+		if (st.fixed_fds[i] == sqe.fd) {
+			sqe.fd = static_cast<int>(i);
+			sqe.flags |= uring_sqe_fixed_file;
+			return;
+		}
+	}
+}
+
+void_t set_buf (io_ring_state_t& st, uring_sqe_t& sqe, const nat1_t* ptr, nat8_t len, nat1_t op, nat1_t fixed_op)
+{
+	assert_lteq(len, max<nat4_t>());
+	sqe.opcode = op;
+	sqe.addr   = reinterpret_cast<nat8_t>(ptr);
+	sqe.len    = static_cast<nat4_t>(len);
+	for (auto i : create_range(st.fixed_bufs.len)) {
+		const auto& buf = st.fixed_bufs[i];
+		if (ptr >= buf.ptr && ptr + len <= buf.ptr + buf.len) {
+			sqe.opcode    = fixed_op;
+			sqe.buf_index = static_cast<nat2_t>(i);
+			return;
+		}
+	}
+}
+#endif
+
+io_done_t perform (io_req_t& req)
+{
+	io_done_t done;
+	done.token = req.token;
+	switch (req.kind) {
+		case io_kind_t::none:
+			break;
+		case io_kind_t::read:
+			done.len = read_at(*req.file, req.at, req.ptr, req.len, done.err);
+			break;
+		case io_kind_t::write:
+			write_at(*req.file, req.at, req.ptr, req.len, done.err);
+			done.len = done.err ? 0 : req.len;
+			break;
+		case io_kind_t::fsync:
+			sync(*req.file, done.err);
+			break;
+		case io_kind_t::open:
+			done.file = open_file(req.path, req.writing, done.err);
+			break;
+	}
+	return done;
+}
+
+void_t run_io_worker (io_ring_state_t& st)
+{
+	while (true) {
+		wait(st.work_sem);
+
+		io_req_t req;
+		{ auto lock = acquire(st.mutex);
+			if (st.reqs_at == st.reqs.len) {
+				assert_true(st.stopping);
+				break;
+			}
+			req = move(st.reqs[st.reqs_at++]);
+			if (st.reqs_at == st.reqs.len) {
+				st.reqs = {};
+				st.reqs_at = 0;
+			}
+		}
+
+		auto done = perform(req);
+		{ auto lock = acquire(st.mutex);
+			grow(st.dones, st.dones.len, 1);
+			st.dones[st.dones.len - 1] = move(done);
+		}
+		signal(st.done_sem);
+	}
+	signal(st.exit_sem);
+}
+
+io_ring_t::io_ring_t () { }
+io_ring_t::~io_ring_t ()
+{
+	if (!opaq) { return; }
+
+	box_t<io_ring_state_t> box;
+	acquire(box, &get_state(*this));
+	opaq = {};
+
+	auto& st = **box;
+	if (st.workers_n) {
+		{ auto lock = acquire(st.mutex);
+			st.stopping = true;
+		}
+		for (auto i : create_range(st.workers_n)) {
+			unused(i);
+			signal(st.work_sem);
+		}
+		for (auto i : create_range(st.workers_n)) {
+			unused(i);
+			wait(st.exit_sem);
+		}
+	}
+	#ifdef __linux__
+	close_uring(st);
+	#endif
+}
+
+io_ring_t::io_ring_t (io_ring_t&& ori) { *this = move(ori); }
+io_ring_t& io_ring_t::operator = (io_ring_t&& ori)
+{
+	if (&ori != this) {
+		this->~io_ring_t();
+		opaq = ori.opaq;
+		ori.opaq = {};
+	}
+	return *this;
+}
+
+io_ring_t::operator bool_t () const
+{
+	return bool_t(opaq);
+}
+
+io_ring_t create_io_ring (const io_ring_opts_t& opts, err_t& err)
+{
+	if (err) { return {}; }
+
+	box_t<io_ring_state_t> box;
+	auto& st = **box;
+	io_ring_t ring;
+
+	#ifdef __linux__
+	if (!opts.pooled && open_uring(st, opts.depth ? opts.depth : 256)) {
+		ring.opaq = create_opaque_ptr(release(box));
+		return ring;
+	}
+	#endif
+
+	auto workers_n = opts.workers_n;
+	if (!workers_n) {
+		const auto cpus_n = get_topology().logical_n;
+		workers_n = cpus_n < 2 ? 2 : cpus_n > 16 ? 16 : cpus_n;
+	}
+	ring.opaq = create_opaque_ptr(release(box));
+	for (auto i : create_range(workers_n)) {
+		unused(i);
+		spawn_thread(&run_io_worker, st, err);
+		if (err) { return {}; }
+		++st.workers_n;
+	}
+	return ring;
+}
+
+bool_t is_kernel_ring (const io_ring_t& ring)
+{
+	return bool_t(get_state(ring).ring);
+}
+
+void_t register_files (io_ring_t& ring, const view_t<file_t*>& files, err_t& err)
+{
+	if (err) { return; }
+
+	auto& st = get_state(ring);
+	if (!st.ring) { return; }
+
+	#ifdef __linux__
+	const auto ring_fd = get_fd(st.ring);
+	if (st.fixed_fds) {
+		syscall(uring_register_nr, ring_fd, uring_unregister_files, nullptr, 0);
+		st.fixed_fds = {};
+	}
+	if (!files) { return; }
+
+	auto fds = create_seq<int>(files.len);
+	for (auto i : create_range(files.len)) {
+		fds[i] = get_fd(files[i]->opaq);
+	}
+	if (syscall(uring_register_nr, ring_fd, uring_register_files, fds.ptr, static_cast<nat4_t>(fds.len)) != 0) {
+		err = decode_os_err(errno);
+		return;
+	}
+	st.fixed_fds = move(fds);
+	#endif
+}
+
+void_t register_bufs (io_ring_t& ring, const view_t<view_t<nat1_t>>& bufs, err_t& err)
+{
+	if (err) { return; }
+
+	auto& st = get_state(ring);
+	if (!st.ring) { return; }
+
+	#ifdef __linux__
+	const auto ring_fd = get_fd(st.ring);
+	if (st.fixed_bufs) {
+		syscall(uring_register_nr, ring_fd, uring_unregister_bufs, nullptr, 0);
+		st.fixed_bufs = {};
+	}
+	if (!bufs) { return; }
+
+	auto iovs = create_seq<iovec>(bufs.len);
+	auto fixed_bufs = create_seq<view_t<nat1_t>>(bufs.len);
+	for (auto i : create_range(bufs.len)) {
+		iovs[i].iov_base = bufs[i].ptr;
+		iovs[i].iov_len  = bufs[i].len;
+		fixed_bufs[i] = bufs[i];
+	}
+	if (syscall(uring_register_nr, ring_fd, uring_register_bufs, iovs.ptr, static_cast<nat4_t>(iovs.len)) != 0) {
+		err = decode_os_err(errno);
+		return;
+	}
+	st.fixed_bufs = move(fixed_bufs);
+	#endif
+}
+
+void_t queue_req (io_ring_state_t& st, io_req_t&& req)
+{
+	grow(st.queued, st.queued.len, 1);
+	st.queued[st.queued.len - 1] = move(req);
+}
+
+void_t queue_read (io_ring_t& ring, file_t& file, nat8_t at, const view_t<nat1_t>& buf, nat8_t token, err_t& err)
+{
+	if (err) { return; }
+
+	auto& st = get_state(ring);
+
+	#ifdef __linux__
+	if (st.ring) {
+		auto sqe_ptr = next_sqe(st, io_kind_t::read, token, err);
+		if (!sqe_ptr) { return; }
+		auto& sqe = *sqe_ptr;
+		set_file(st, sqe, file);
+		set_buf(st, sqe, buf.ptr, buf.len, uring_op_read, uring_op_read_fixed);
+		sqe.off = at;
+		return;
+	}
+	#endif
+
+	io_req_t req;
+	req.kind  = io_kind_t::read;
+	req.token = token;
+	req.file  = &file;
+	req.at    = at;
+	req.ptr   = buf.ptr;
+	req.len   = buf.len;
+	queue_req(st, move(req));
+}
+
+void_t queue_write (io_ring_t& ring, file_t& file, nat8_t at, const view_t<const nat1_t>& buf, nat8_t token,
+                    err_t& err)
+{
+	if (err) { return; }
+
+	auto& st = get_state(ring);
+
+	#ifdef __linux__
+	if (st.ring) {
+		auto sqe_ptr = next_sqe(st, io_kind_t::write, token, err);
+		if (!sqe_ptr) { return; }
+		auto& sqe = *sqe_ptr;
+		set_file(st, sqe, file);
+		set_buf(st, sqe, buf.ptr, buf.len, uring_op_write, uring_op_write_fixed);
+		sqe.off = at;
+		return;
+	}
+	#endif
+
+	io_req_t req;
+	req.kind  = io_kind_t::write;
+	req.token = token;
+	req.file  = &file;
+	req.at    = at;
+	req.ptr   = const_cast<nat1_t*>(buf.ptr);
+	req.len   = buf.len;
+	queue_req(st, move(req));
+}
+
+void_t queue_fsync (io_ring_t& ring, file_t& file, nat8_t token, err_t& err)
+{
+	if (err) { return; }
+
+	auto& st = get_state(ring);
+
+	#ifdef __linux__
+	if (st.ring) {
+		auto sqe_ptr = next_sqe(st, io_kind_t::fsync, token, err);
+		if (!sqe_ptr) { return; }
+		auto& sqe = *sqe_ptr;
+		set_file(st, sqe, file);
+		sqe.opcode = uring_op_fsync;
+		return;
+	}
+	#endif
+
+	io_req_t req;
+	req.kind  = io_kind_t::fsync;
+	req.token = token;
+	req.file  = &file;
+	queue_req(st, move(req));
+}
+
+void_t queue_open (io_ring_t& ring, const path_t& path, bool_t writing, nat8_t token, err_t& err)
+{
+	if (err) { return; }
+
+	auto& st = get_state(ring);
+
+	#ifdef __linux__
+	if (st.ring) {
+		auto sqe_ptr = next_sqe(st, io_kind_t::open, token, err);
+		if (!sqe_ptr) { return; }
+		auto& sqe = *sqe_ptr;
+		grow(st.open_paths, st.open_paths.len, 1);
+		st.open_paths[st.open_paths.len - 1] = as_strz(as_text(path));
+		sqe.opcode   = uring_op_openat;
+		sqe.fd       = AT_FDCWD;
+		sqe.addr     = reinterpret_cast<nat8_t>(st.open_paths[st.open_paths.len - 1].ptr);
+		sqe.len      = S_IRWXU | S_IRGRP | S_IROTH;
+		sqe.op_flags = static_cast<nat4_t>(writing ? O_RDWR | O_CREAT : O_RDONLY);
+		return;
+	}
+	#endif
+
+	io_req_t req;
+	req.kind    = io_kind_t::open;
+	req.token   = token;
+	req.path    = clone(path);
+	req.writing = writing;
+	queue_req(st, move(req));
+}
+
+void_t submit (io_ring_t& ring, err_t& err)
+{
+	if (err) { return; }
+
+	auto& st = get_state(ring);
+
+	#ifdef __linux__
+	if (st.ring) {
+		flush_uring(st, err);
+		return;
+	}
+	#endif
+
+	const auto queued_n = st.queued.len;
+	if (!queued_n) { return; }
+	{ auto lock = acquire(st.mutex);
+		const auto old_len = st.reqs.len;
+		grow(st.reqs, old_len, queued_n);
+		for (auto i : create_range(queued_n)) {
+			st.reqs[old_len + i] = move(st.queued[i]);
+		}
+	}
+	st.queued = {};
+	st.in_flight += queued_n;
+	for (auto i : create_range(queued_n)) {
+		unused(i);
+		signal(st.work_sem);
+	}
+}
+
+nat8_t reap (io_ring_t& ring, io_done_t* dones_ptr, nat8_t dones_len, nat8_t wait_n, err_t& err)
+{
+	if (err) { return {}; }
+
+	auto& st = get_state(ring);
+	wait_n = wait_n < dones_len ? wait_n : dones_len;
+	wait_n = wait_n < st.in_flight ? wait_n : st.in_flight;
+	nat8_t got = 0;
+
+	#ifdef __linux__
+	if (st.ring) {
+		// drained first, so that a poller can't miss completions arriving from here on
+		nat8_t counter = 0;
+		const auto stat = read(get_fd(st.done_fd), &counter, sizeof(counter));
+		unused(stat);
+
+		while (got < dones_len) {
+			const auto head = *st.cq_head;
+			if (head == __atomic_load_n(st.cq_tail, __ATOMIC_ACQUIRE)) {
+				if (got >= wait_n) { break; }
+				const auto min_n = static_cast<nat4_t>(wait_n - got);
+				if (syscall(uring_enter_nr, get_fd(st.ring), 0, min_n, uring_enter_getevents, nullptr, 0) < 0) {
+					if (errno == EINTR) { continue; }
+					err = decode_os_err(errno);
+					return got;
+				}
+				continue;
+			}
+
+			const auto& cqe = static_cast<const uring_cqe_t*>(st.cqes)[head & st.cq_mask];
+			auto& slot = st.slots[cqe.user_data];
+			auto& done = dones_ptr[got++];
+			done = {};
+			done.token = slot.token;
+			if (cqe.res < 0) {
+				done.err = decode_os_err(cqe.res);
+			} else if (slot.kind == io_kind_t::open) {
+				done.file.opaq = create_opaque_fd(cqe.res);
+			} else {
+				done.len = static_cast<nat8_t>(cqe.res);
+			}
+			grow(st.free_slots, st.free_slots.len, 1);
+			st.free_slots[st.free_slots.len - 1] = static_cast<nat4_t>(cqe.user_data);
+			__atomic_store_n(st.cq_head, head + 1, __ATOMIC_RELEASE);
+			--st.in_flight;
+		}
+		return got;
+	}
+	#endif
+
+	while (true) {
+		{ auto lock = acquire(st.mutex);
+			while (got < dones_len && st.dones_at < st.dones.len) {
+				dones_ptr[got++] = move(st.dones[st.dones_at++]);
+				--st.in_flight;
+			}
+			if (st.dones_at == st.dones.len) {
+				st.dones = {};
+				st.dones_at = 0;
+			}
+		}
+		if (got >= wait_n) { break; }
+		// a signal may belong to a completion already taken, in which case this just goes round again
+		wait(st.done_sem);
+	}
+	return got;
+}
+
+nat8_t get_in_flight (const io_ring_t& ring)
+{
+	return get_state(ring).in_flight;
+}
+
+opaque_t get_done_handle (const io_ring_t& ring)
+{
+	void_t init (sem_t& sem);
+
+	auto& st = get_state(ring);
+	if (st.ring) { return st.done_fd; }
+	if (!st.done_sem.opaq) { init(st.done_sem); }
+	return st.done_sem.opaq;
+}
+
+const char* prove_io_ring (const io_ring_opts_t& opts)
+{
+	err_t err;
+	auto ring = create_io_ring(opts, err);
+	prove_same(as_text(err), "");
+	prove_eq(is_kernel_ring(ring) && opts.pooled, false);
+
+	const auto path = create_temp_path(err);
+	auto file = open_file(path, true, err);
+	file_t* files[] = { &file };
+	register_files(ring, create_view(files, 1), err);
+
+	// a couple of hundred writes in flight at once, more than the ring holds
+	const nat8_t chunks_n = 300;
+	const nat8_t chunk_len = 64;
+	auto data = create_str(chunks_n * chunk_len);
+	for (auto i : create_range(data.len)) { data[i] = static_cast<nat1_t>(i / chunk_len); }
+	const auto data_view = create_view(static_cast<const str_t&>(data));
+	for (auto i : create_range(chunks_n)) {
+		queue_write(ring, file, i * chunk_len, create_view(data_view, i * chunk_len, chunk_len), i, err);
+	}
+	submit(ring, err);
+	prove_same(as_text(err), "");
+
+	auto dones = create_seq<io_done_t>(chunks_n);
+	nat8_t got = 0;
+	nat8_t tokens_sum = 0;
+	while (got < chunks_n) {
+		const auto n = reap(ring, &dones[got], chunks_n - got, 1, err);
+		for (auto i : create_range(n)) {
+			prove_same(as_text(dones[got + i].err), "");
+			prove_eq(dones[got + i].len, chunk_len);
+			tokens_sum += dones[got + i].token;
+		}
+		got += n;
+	}
+	prove_same(as_text(err), "");
+	prove_eq(tokens_sum, chunks_n * (chunks_n - 1) / 2);
+	prove_eq(get_in_flight(ring), 0);
+
+	queue_fsync(ring, file, 1, err);
+	queue_open(ring, path, false, 2, err);
+	submit(ring, err);
+	prove_eq(reap(ring, dones.ptr, 2, 2, err), 2);
+	const nat8_t opened_i = dones[0].token == 2 ? 0 : 1;
+	prove_same(as_text(dones[0].err), "");
+	prove_same(as_text(dones[1].err), "");
+	prove_true(dones[opened_i].file);
+
+	auto got_data = create_str(data.len);
+	view_t<nat1_t> bufs[] = { create_view(got_data) };
+	register_bufs(ring, create_view(bufs, 1), err);
+	queue_read(ring, dones[opened_i].file, 0, create_view(got_data), 3, err);
+	submit(ring, err);
+	prove_eq(reap(ring, dones.ptr, 1, 1, err), 1);
+	prove_eq(dones[0].token, 3ULL);
+	prove_eq(dones[0].len, data.len);
+	prove_true(got_data == data);
+
+	prove_true(get_done_handle(ring));
+	prove_eq(reap(ring, dones.ptr, 1, 0, err), 0);
+	prove_same(as_text(err), "");
+
+	remove_file(path, err);
+	return {};
+}
+
+define_test(aio, "path,thread,platform")
+{
+	io_ring_opts_t opts;
+	opts.depth = 64;
+	if (const auto msg = prove_io_ring(opts)) { return msg; }
+	opts.pooled = true;
+	opts.workers_n = 3;
+	if (const auto msg = prove_io_ring(opts)) { return msg; }
+	return {};
+}
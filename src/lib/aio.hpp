@@ -0,0 +1,60 @@
+#ifndef libcx3_aio_hpp
+#define libcx3_aio_hpp
+#include "prelude.hpp"
+#include "file.hpp"
+#include "error.hpp"
+
+struct io_ring_opts_t
+{
+	nat4_t depth     {}; // ops the kernel ring holds before queueing flushes it, 256 when zero
+	nat4_t workers_n {}; // threads used when the kernel has no io_uring, picked from the topology when zero
+	bool_t pooled    {}; // skip io_uring even where it's available
+	pad_t<7> padding {};
+};
+
+struct io_ring_t
+{
+	opaque_t opaq {};
+
+	io_ring_t ();
+	~io_ring_t ();
+	io_ring_t (const io_ring_t& ori) = delete;
+	io_ring_t& operator = (const io_ring_t& ori) = delete;
+	io_ring_t (io_ring_t&& ori);
+	io_ring_t& operator = (io_ring_t&& ori);
+
+	explicit operator bool_t () const;
+};
+
+struct io_done_t
+{
+	nat8_t token {};
+	nat8_t len   {}; // bytes moved, which for reads is short at the end of the file
+	err_t  err   {};
+	file_t file  {}; // the result of an open
+};
+
+io_ring_t create_io_ring (const io_ring_opts_t& opts, err_t& err);
+bool_t is_kernel_ring (const io_ring_t& ring);
+
+// Files and buffers must outlive the ops using them. Once registered, they're used through the kernel's
+// fixed tables whenever an op names one of them (or, for buffers, a range inside one).
+void_t register_files (io_ring_t& ring, const view_t<file_t*>& files, err_t& err);
+void_t register_bufs (io_ring_t& ring, const view_t<view_t<nat1_t>>& bufs, err_t& err);
+
+// Queued ops go out with the next submit, or sooner when the ring fills up
+void_t queue_read (io_ring_t& ring, file_t& file, nat8_t at, const view_t<nat1_t>& buf, nat8_t token, err_t& err);
+void_t queue_write (io_ring_t& ring, file_t& file, nat8_t at, const view_t<const nat1_t>& buf, nat8_t token,
+                    err_t& err);
+void_t queue_fsync (io_ring_t& ring, file_t& file, nat8_t token, err_t& err);
+void_t queue_open (io_ring_t& ring, const path_t& path, bool_t writing, nat8_t token, err_t& err);
+void_t submit (io_ring_t& ring, err_t& err);
+
+// Blocks until at least wait_n ops have completed, then takes up to dones_len of them
+nat8_t reap (io_ring_t& ring, io_done_t* dones_ptr, nat8_t dones_len, nat8_t wait_n, err_t& err);
+nat8_t get_in_flight (const io_ring_t& ring);
+
+// Readable (as an eventfd, or a semaphore on windows) whenever completions may be waiting
+opaque_t get_done_handle (const io_ring_t& ring);
+
+#endif
@@ -31,7 +31,7 @@ template<typename el_t> struct box_t
 		return *this;
 	}
 
-	el_t* operator * ()
+	alloc_inline el_t* operator * ()
 	{
 		void_t* alloc_mem (nat8_t len);
 
@@ -0,0 +1,421 @@
+#include "checksum.hpp"
+#include "platform.hpp"
+#include "text.hpp"
+#ifdef __x86_64__
+#include <emmintrin.h>
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+// Every crc here is the reflected kind, shifting towards the low bit, so a width below 64 sits in the low bits
+struct crc_def_t
+{
+	nat8_t poly  {}; // reflected
+	nat8_t width {};
+};
+
+constexpr crc_def_t crc32c_def = {0x82F63B78,         32};
+constexpr crc_def_t crc32_def  = {0xEDB88320,         32};
+constexpr crc_def_t crc64_def  = {0xC96C5795D7870F42, 64};
+
+constexpr nat8_t get_mask (const crc_def_t& def)
+{
+	return def.width == 64 ? ~0ULL : (1ULL << def.width) - 1;
+}
+
+// Row k has each byte's crc with k zeros after it, so eight bytes go through in one step
+struct crc_table_t
+{
+	nat8_t rows[8][256] {};
+};
+
+constexpr crc_table_t create_crc_table (const crc_def_t& def)
+{
+	crc_table_t table;
+	for (nat8_t i = 0; i < 256; ++i) {
+		auto reg = i;
+		for (auto bit = 0; bit < 8; ++bit) {
+			reg = reg & 1 ? (reg >> 1) ^ def.poly : reg >> 1;
+		}
+		table.rows[0][i] = reg;
+	}
+	for (nat8_t k = 1; k < 8; ++k) {
+		for (nat8_t i = 0; i < 256; ++i) {
+			const auto prev = table.rows[k - 1][i];
+			table.rows[k][i] = (prev >> 8) ^ table.rows[0][prev & 0xFF];
+		}
+	}
+	return table;
+}
+
+constexpr crc_table_t crc32c_table = create_crc_table(crc32c_def);
+constexpr crc_table_t crc32_table  = create_crc_table(crc32_def);
+constexpr crc_table_t crc64_table  = create_crc_table(crc64_def);
+
+nat8_t load_le64 (const nat1_t* ptr)
+{
+	nat8_t word = 0;
+	for (auto i : create_range(8)) {
+		word |= static_cast<nat8_t>(ptr[i]) << (i * 8);
+	}
+	return word;
+}
+
+nat8_t update_crc (const crc_table_t& table, nat8_t reg, const nat1_t* ptr, nat8_t len)
+{
+	const auto& rows = table.rows;
+	for (; len >= 8; ptr += 8, len -= 8) {
+		const auto word = load_le64(ptr) ^ reg;
+		reg = rows[7][word & 0xFF] ^ rows[6][(word >> 8) & 0xFF] ^ rows[5][(word >> 16) & 0xFF] ^
+		      rows[4][(word >> 24) & 0xFF] ^ rows[3][(word >> 32) & 0xFF] ^ rows[2][(word >> 40) & 0xFF] ^
+		      rows[1][(word >> 48) & 0xFF] ^ rows[0][word >> 56];
+	}
+	for (; len > 0; ++ptr, --len) {
+		reg = (reg >> 8) ^ rows[0][(reg ^ *ptr) & 0xFF];
+	}
+	return reg;
+}
+
+nat8_t update_crc32c_base (nat8_t reg, const nat1_t* ptr, nat8_t len) { return update_crc(crc32c_table, reg, ptr, len); }
+nat8_t update_crc32_base  (nat8_t reg, const nat1_t* ptr, nat8_t len) { return update_crc(crc32_table,  reg, ptr, len); }
+nat8_t update_crc64_base  (nat8_t reg, const nat1_t* ptr, nat8_t len) { return update_crc(crc64_table,  reg, ptr, len); }
+
+#ifdef __x86_64__
+__attribute__((target("sse4.2"))) nat8_t update_crc32c_sse42 (nat8_t reg, const nat1_t* ptr, nat8_t len)
+{
+	for (; len >= 8; ptr += 8, len -= 8) {
+		reg = _mm_crc32_u64(reg, load_le64(ptr));
+	}
+	auto reg32 = static_cast<nat4_t>(reg);
+	for (; len > 0; ++ptr, --len) {
+		reg32 = _mm_crc32_u8(reg32, *ptr);
+	}
+	return reg32;
+}
+
+constexpr nat8_t reflect (nat8_t val)
+{
+	nat8_t prod = 0;
+	for (auto i = 0; i < 64; ++i) {
+		prod |= ((val >> i) & 1) << (63 - i);
+	}
+	return prod;
+}
+
+// x to the power, mod the crc's polynomial, with the low bit as x^0 (unreflected)
+constexpr nat8_t get_x_pow_mod (const crc_def_t& def, nat8_t power)
+{
+	const auto poly = reflect(def.poly) >> (64 - def.width);
+	const auto top = 1ULL << (def.width - 1);
+	nat8_t prod = 1;
+	for (nat8_t i = 0; i < power; ++i) {
+		prod = prod & top ? ((prod << 1) & get_mask(def)) ^ poly : prod << 1;
+	}
+	return prod;
+}
+
+// A 16-byte block's first half is the higher powers, so it's carried dist bits on with x^(dist+63) and the second
+// half with x^(dist-1). The missing power comes back from clmul's products landing one bit short when reflected.
+struct fold_consts_t
+{
+	nat8_t by_4[2] {};
+	nat8_t by_1[2] {};
+};
+
+constexpr fold_consts_t create_fold_consts (const crc_def_t& def)
+{
+	fold_consts_t consts;
+	consts.by_4[0] = reflect(get_x_pow_mod(def, 512 + 63));
+	consts.by_4[1] = reflect(get_x_pow_mod(def, 512 - 1));
+	consts.by_1[0] = reflect(get_x_pow_mod(def, 128 + 63));
+	consts.by_1[1] = reflect(get_x_pow_mod(def, 128 - 1));
+	return consts;
+}
+
+constexpr fold_consts_t crc32_consts = create_fold_consts(crc32_def);
+constexpr fold_consts_t crc64_consts = create_fold_consts(crc64_def);
+
+__attribute__((target("pclmul,sse4.1"))) __m128i fold (__m128i block, __m128i consts, __m128i next)
+{
+	const auto first  = _mm_clmulepi64_si128(block, consts, 0x00);
+	const auto second = _mm_clmulepi64_si128(block, consts, 0x11);
+	return _mm_xor_si128(_mm_xor_si128(first, second), next);
+}
+
+// Folds four streams of blocks down to one 16-byte remainder with the same crc as everything before it, which
+// the table finishes along with the tail
+__attribute__((target("pclmul,sse4.1")))
+nat8_t update_crc_clmul (const crc_table_t& table, const fold_consts_t& consts, nat8_t reg, const nat1_t* ptr,
+                         nat8_t len)
+{
+	if (len < 64) { return update_crc(table, reg, ptr, len); }
+
+	const auto load = [] (const nat1_t* at) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(at)); };
+	auto x0 = _mm_xor_si128(load(ptr), _mm_cvtsi64_si128(static_cast<long long>(reg)));
+	auto x1 = load(ptr + 16);
+	auto x2 = load(ptr + 32);
+	auto x3 = load(ptr + 48);
+	ptr += 64;
+	len -= 64;
+
+	const auto by_4 = _mm_set_epi64x(static_cast<long long>(consts.by_4[1]), static_cast<long long>(consts.by_4[0]));
+	for (; len >= 64; ptr += 64, len -= 64) {
+		x0 = fold(x0, by_4, load(ptr));
+		x1 = fold(x1, by_4, load(ptr + 16));
+		x2 = fold(x2, by_4, load(ptr + 32));
+		x3 = fold(x3, by_4, load(ptr + 48));
+	}
+
+	const auto by_1 = _mm_set_epi64x(static_cast<long long>(consts.by_1[1]), static_cast<long long>(consts.by_1[0]));
+	x0 = fold(x0, by_1, x1);
+	x0 = fold(x0, by_1, x2);
+	x0 = fold(x0, by_1, x3);
+	for (; len >= 16; ptr += 16, len -= 16) {
+		x0 = fold(x0, by_1, load(ptr));
+	}
+
+	alignas(16) nat1_t rest[16];
+	_mm_store_si128(reinterpret_cast<__m128i*>(rest), x0);
+	return update_crc(table, update_crc(table, 0, rest, sizeof(rest)), ptr, len);
+}
+
+nat8_t update_crc32_clmul (nat8_t reg, const nat1_t* ptr, nat8_t len)
+{
+	return update_crc_clmul(crc32_table, crc32_consts, reg, ptr, len);
+}
+
+nat8_t update_crc64_clmul (nat8_t reg, const nat1_t* ptr, nat8_t len)
+{
+	return update_crc_clmul(crc64_table, crc64_consts, reg, ptr, len);
+}
+
+kernel_t<nat8_t (*) (nat8_t, const nat1_t*, nat8_t)> update_crc32c (&update_crc32c_base, &update_crc32c_sse42);
+// pclmulqdq has a feature bit of its own, which no tier implies and a hypervisor can mask at any of them, so the
+// clmul impls sit in the sse4.2 slot (for sse4.1) only when the bit's set, leaving the tables otherwise
+const bool_t has_clmul = get_cpu().clmul;
+kernel_t<nat8_t (*) (nat8_t, const nat1_t*, nat8_t)> update_crc32 (&update_crc32_base,
+	has_clmul ? &update_crc32_clmul : nullptr);
+kernel_t<nat8_t (*) (nat8_t, const nat1_t*, nat8_t)> update_crc64 (&update_crc64_base,
+	has_clmul ? &update_crc64_clmul : nullptr);
+#else
+kernel_t<nat8_t (*) (nat8_t, const nat1_t*, nat8_t)> update_crc32c (&update_crc32c_base);
+kernel_t<nat8_t (*) (nat8_t, const nat1_t*, nat8_t)> update_crc32 (&update_crc32_base);
+kernel_t<nat8_t (*) (nat8_t, const nat1_t*, nat8_t)> update_crc64 (&update_crc64_base);
+#endif
+
+const crc_def_t& get_def (sum_kind_t kind)
+{
+	assert_true(kind != sum_kind_t::xxh64);
+	return kind == sum_kind_t::crc32c ? crc32c_def : kind == sum_kind_t::crc32 ? crc32_def : crc64_def;
+}
+
+const nat8_t xxh_prime_1 = 0x9E3779B185EBCA87;
+const nat8_t xxh_prime_2 = 0xC2B2AE3D27D4EB4F;
+const nat8_t xxh_prime_3 = 0x165667B19E3779F9;
+const nat8_t xxh_prime_4 = 0x85EBCA77C2B2AE63;
+const nat8_t xxh_prime_5 = 0x27D4EB2F165667C5;
+
+nat8_t rotate_left (nat8_t val, nat8_t n)
+{
+	return (val << n) | (val >> (64 - n));
+}
+
+nat8_t xxh_round (nat8_t acc, nat8_t input)
+{
+	return rotate_left(acc + input * xxh_prime_2, 31) * xxh_prime_1;
+}
+
+nat8_t xxh_merge (nat8_t acc, nat8_t val)
+{
+	return (acc ^ xxh_round(0, val)) * xxh_prime_1 + xxh_prime_4;
+}
+
+void_t xxh_stripes (nat8_t (&acc)[4], const nat1_t* ptr, nat8_t stripes_n)
+{
+	auto v0 = acc[0];
+	auto v1 = acc[1];
+	auto v2 = acc[2];
+	auto v3 = acc[3];
+	for (; stripes_n > 0; ptr += 32, --stripes_n) {
+		v0 = xxh_round(v0, load_le64(ptr));
+		v1 = xxh_round(v1, load_le64(ptr + 8));
+		v2 = xxh_round(v2, load_le64(ptr + 16));
+		v3 = xxh_round(v3, load_le64(ptr + 24));
+	}
+	acc[0] = v0;
+	acc[1] = v1;
+	acc[2] = v2;
+	acc[3] = v3;
+}
+
+sum_t create_sum (sum_kind_t kind)
+{
+	sum_t sum;
+	sum.kind = kind;
+	if (kind == sum_kind_t::xxh64) {
+		sum.acc[0] = xxh_prime_1 + xxh_prime_2;
+		sum.acc[1] = xxh_prime_2;
+		sum.acc[2] = 0;
+		sum.acc[3] = 0 - xxh_prime_1;
+	} else {
+		sum.acc[0] = get_mask(get_def(kind));
+	}
+	return sum;
+}
+
+void_t update (sum_t& sum, const void_t* ptr, nat8_t len)
+{
+	if (!len) { return; }
+	auto at = static_cast<const nat1_t*>(ptr);
+
+	switch (sum.kind) {
+		case sum_kind_t::crc32c: sum.acc[0] = resolve(update_crc32c)(sum.acc[0], at, len); break;
+		case sum_kind_t::crc32:  sum.acc[0] = resolve(update_crc32)(sum.acc[0], at, len);  break;
+		case sum_kind_t::crc64:  sum.acc[0] = resolve(update_crc64)(sum.acc[0], at, len);  break;
+		case sum_kind_t::xxh64: {
+			// a stripe split between updates waits in buf for the rest of it
+			const auto buf_len = sum.len % 32;
+			if (buf_len) {
+				const auto fill_len = len < 32 - buf_len ? len : 32 - buf_len;
+				__builtin_memcpy(sum.buf + buf_len, at, fill_len);
+				if (buf_len + fill_len == 32) { xxh_stripes(sum.acc, sum.buf, 1); }
+				at += fill_len;
+				len -= fill_len;
+				sum.len += fill_len;
+			}
+			xxh_stripes(sum.acc, at, len / 32);
+			__builtin_memcpy(sum.buf, at + len / 32 * 32, len % 32);
+			break;
+		}
+	}
+	sum.len += len;
+}
+
+void_t update (sum_t& sum, const str_t& data)
+{
+	update(sum, data.ptr, data.len);
+}
+
+nat8_t finish (const sum_t& sum)
+{
+	if (sum.kind != sum_kind_t::xxh64) {
+		return ~sum.acc[0] & get_mask(get_def(sum.kind));
+	}
+
+	nat8_t hash = 0;
+	if (sum.len >= 32) {
+		hash = rotate_left(sum.acc[0], 1) + rotate_left(sum.acc[1], 7) + rotate_left(sum.acc[2], 12) +
+		       rotate_left(sum.acc[3], 18);
+		for (auto acc : sum.acc) {
+			hash = xxh_merge(hash, acc);
+		}
+	} else {
+		hash = sum.acc[2] + xxh_prime_5;
+	}
+	hash += sum.len;
+
+	const auto rest_len = sum.len % 32;
+	auto at = sum.buf;
+	for (; at + 8 <= sum.buf + rest_len; at += 8) {
+		hash = rotate_left(hash ^ xxh_round(0, load_le64(at)), 27) * xxh_prime_1 + xxh_prime_4;
+	}
+	if (at + 4 <= sum.buf + rest_len) {
+		const auto word = static_cast<nat8_t>(at[0]) | static_cast<nat8_t>(at[1]) << 8 |
+		                  static_cast<nat8_t>(at[2]) << 16 | static_cast<nat8_t>(at[3]) << 24;
+		hash = rotate_left(hash ^ (word * xxh_prime_1), 23) * xxh_prime_2 + xxh_prime_3;
+		at += 4;
+	}
+	for (; at < sum.buf + rest_len; ++at) {
+		hash = rotate_left(hash ^ (*at * xxh_prime_5), 11) * xxh_prime_1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= xxh_prime_2;
+	hash ^= hash >> 29;
+	hash *= xxh_prime_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+nat8_t calc_sum (sum_kind_t kind, const void_t* ptr, nat8_t len)
+{
+	auto sum = create_sum(kind);
+	update(sum, ptr, len);
+	return finish(sum);
+}
+
+nat8_t calc_sum (sum_kind_t kind, const str_t& data)
+{
+	return calc_sum(kind, data.ptr, data.len);
+}
+
+// Polynomials mod the crc's, reflected, so x^0 is the top bit
+nat8_t mul_mod (const crc_def_t& def, nat8_t left, nat8_t right)
+{
+	nat8_t prod = 0;
+	for (auto bit = 1ULL << (def.width - 1); bit; bit >>= 1) {
+		if (left & bit) { prod ^= right; }
+		right = right & 1 ? (right >> 1) ^ def.poly : right >> 1;
+	}
+	return prod;
+}
+
+// Shifting the left crc past the right piece's zeros, by squaring up x^8 for each bit of the length, leaves what
+// xors with the right one's crc. The pre and post inversions cancel between the three.
+nat8_t combine_sums (sum_kind_t kind, nat8_t left, nat8_t right, nat8_t right_len)
+{
+	const auto& def = get_def(kind);
+	auto shift = 1ULL << (def.width - 1);
+	auto x_pow = 1ULL << (def.width - 1 - 8);
+	for (; right_len; right_len >>= 1) {
+		if (right_len & 1) { shift = mul_mod(def, shift, x_pow); }
+		x_pow = mul_mod(def, x_pow, x_pow);
+	}
+	return mul_mod(def, left, shift) ^ right;
+}
+
+define_test(checksum, "platform")
+{
+	const str_t check = "123456789";
+	prove_eq(calc_sum(sum_kind_t::crc32c, check), 0xE3069283);
+	prove_eq(calc_sum(sum_kind_t::crc32,  check), 0xCBF43926);
+	prove_eq(calc_sum(sum_kind_t::crc64,  check), 0x995DC9BBDF1939FA);
+	prove_eq(calc_sum(sum_kind_t::xxh64,  ""),    0xEF46DB3751D8E999);
+	prove_eq(calc_sum(sum_kind_t::xxh64,  "a"),   0xD24EC4F1A98C6E5B);
+	prove_eq(calc_sum(sum_kind_t::xxh64,  "abc"), 0x44BC2CF5AD770999);
+
+	auto data = create_str(10'000);
+	nat8_t seed = 1;
+	for (auto& g : data) {
+		seed = seed * 6364136223846793005 + 1442695040888963407;
+		g = static_cast<nat1_t>(seed >> 56);
+	}
+
+	const sum_kind_t kinds[] = { sum_kind_t::crc32c, sum_kind_t::crc32, sum_kind_t::crc64, sum_kind_t::xxh64 };
+	for (auto kind : kinds) {
+		// the table and the instructions agree at every length and alignment
+		for (nat8_t len = 0; len < 300; len += 7) {
+			const auto accel = calc_sum(kind, data.ptr + len % 13, len * 31);
+			cap_isa(isa_t::base);
+			const auto base = calc_sum(kind, data.ptr + len % 13, len * 31);
+			cap_isa(isa_t::avx512);
+			prove_eq(accel, base);
+		}
+
+		// pieces of any size make the same sum as the whole
+		const auto whole = calc_sum(kind, data);
+		auto sum = create_sum(kind);
+		for (nat8_t at = 0, piece = 1; at < data.len; at += piece, piece = piece * 3 % 97 + 1) {
+			update(sum, data.ptr + at, piece < data.len - at ? piece : data.len - at);
+		}
+		prove_eq(finish(sum), whole);
+
+		if (kind == sum_kind_t::xxh64) { continue; }
+		for (nat8_t split = 0; split <= data.len; split += 1'111) {
+			const auto left = calc_sum(kind, data.ptr, split);
+			const auto right = calc_sum(kind, data.ptr + split, data.len - split);
+			prove_eq(combine_sums(kind, left, right, data.len - split), whole);
+		}
+	}
+	return {};
+}
@@ -0,0 +1,35 @@
+#ifndef libcx3_checksum_hpp
+#define libcx3_checksum_hpp
+#include "prelude.hpp"
+
+enum class sum_kind_t : nat1_t
+{
+	crc32c = 0, // castagnoli, as in iscsi, ext4 and sctp
+	crc32  = 1, // as in zlib, gzip, zip and png
+	crc64  = 2, // ecma-182, as in xz
+	xxh64  = 3, // xxhash's 64-bit hash, which isn't a crc, so it's faster but can't be combined
+};
+
+// A sum part way through its input, which can be fed in any number of pieces
+struct sum_t
+{
+	sum_kind_t kind    {};
+	pad_t<7>   padding {};
+	nat8_t     len     {}; // bytes taken so far
+	nat8_t     acc[4]  {}; // a crc's register, or xxh64's four lanes
+	nat1_t     buf[32] {}; // the stripe xxh64 hasn't got the whole of yet
+};
+
+sum_t create_sum (sum_kind_t kind);
+void_t update (sum_t& sum, const void_t* ptr, nat8_t len);
+void_t update (sum_t& sum, const str_t& data);
+nat8_t finish (const sum_t& sum); // can go on being updated afterwards
+
+nat8_t calc_sum (sum_kind_t kind, const void_t* ptr, nat8_t len);
+nat8_t calc_sum (sum_kind_t kind, const str_t& data);
+
+// The crc of two pieces one after the other, from the crc of each and the right one's length. So a big file can be
+// split across threads and its crc put together from theirs. Not for xxh64.
+nat8_t combine_sums (sum_kind_t kind, nat8_t left, nat8_t right, nat8_t right_len);
+
+#endif
@@ -0,0 +1,383 @@
+#include "commit.hpp"
+#include "file.hpp"
+#include "dir.hpp"
+#include "error.hpp"
+#include "text.hpp"
+#include "thread.hpp"
+#include "box.hpp"
+#ifdef __unix__
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <errno.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#ifdef __unix__
+int get_fd (opaque_t opaq);
+opaque_t create_opaque_fd (int fd);
+#endif
+#ifdef _WIN32
+HANDLE get_handle (opaque_t opaq);
+opaque_t create_opaque_handle (HANDLE h);
+#endif
+void_t* get_ptr (opaque_t opaq);
+opaque_t create_opaque_ptr (void_t* ptr);
+nat8_t add_atomic (nat8_t& datum, nat8_t val);
+
+nat8_t commit_tmp_n;
+
+// A file written in full but not yet in place
+struct staged_t
+{
+	path_t   path     {};
+	path_t   tmp_path {};
+	file_t   file     {};
+	file_t   dir      {}; // for syncing the rename
+	bool_t   anon     {}; // made with O_TMPFILE, so it only gets its temp name just before the rename
+	pad_t<7> padding  {};
+};
+
+path_t get_tmp_path (const path_t& path)
+{
+	#ifdef __unix__
+	const auto pid = static_cast<nat8_t>(getpid());
+	#endif
+	#ifdef _WIN32
+	const auto pid = static_cast<nat8_t>(GetCurrentProcessId());
+	#endif
+	const auto leaf = "." + create_str(get_leaf(path)) + ".tmp." + as_text(pid) + "." +
+	                  as_text(add_atomic(commit_tmp_n, 1));
+	return get_dir(path) + leaf;
+}
+
+void_t stage (staged_t& staged, const path_t& path, const str_t& data, err_t& err)
+{
+	if (err) { return; }
+
+	staged.path = clone(path);
+	staged.tmp_path = get_tmp_path(path);
+	auto dir_path = get_dir(path);
+	if (!dir_path) { dir_path = create_path("."); }
+
+	#ifdef __unix__
+	const mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+	const auto dir_fd = open(as_strz(as_text(dir_path)).ptr, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd < 0) {
+		err = decode_os_err(errno);
+		return;
+	}
+	staged.dir.opaq = create_opaque_fd(dir_fd);
+
+	auto fd = -1;
+	#ifdef O_TMPFILE
+	fd = openat(dir_fd, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, mode);
+	staged.anon = fd >= 0;
+	#endif
+	// not every file system has anonymous files
+	if (fd < 0) { fd = open(as_strz(as_text(staged.tmp_path)).ptr, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode); }
+	if (fd < 0) {
+		err = decode_os_err(errno);
+		return;
+	}
+	staged.file.opaq = create_opaque_fd(fd);
+	#endif
+
+	#ifdef _WIN32
+	const auto handle = CreateFile(as_wstr(as_text(staged.tmp_path)).ptr, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+	                               CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		err = decode_os_err(GetLastError());
+		return;
+	}
+	staged.file.opaq = create_opaque_handle(handle);
+	#endif
+
+	write(staged.file, data, err);
+}
+
+// Puts a synced file in place, which is only durable once its directory is synced too
+void_t unstage (staged_t& staged, err_t& err)
+{
+	#ifdef __unix__
+	if (!err && staged.anon) {
+		const auto proc_path = "/proc/self/fd/" + as_text(static_cast<nat8_t>(get_fd(staged.file.opaq)));
+		if (linkat(AT_FDCWD, as_strz(proc_path).ptr, AT_FDCWD, as_strz(as_text(staged.tmp_path)).ptr,
+		           AT_SYMLINK_FOLLOW) != 0) {
+			err = decode_os_err(errno);
+			return;
+		}
+		staged.anon = false;
+	}
+	if (!err && rename(as_strz(as_text(staged.tmp_path)).ptr, as_strz(as_text(staged.path)).ptr) == 0) { return; }
+	if (!err) { err = decode_os_err(errno); }
+	if (!staged.anon) { unlink(as_strz(as_text(staged.tmp_path)).ptr); }
+	#endif
+
+	#ifdef _WIN32
+	staged.file = {};
+	if (!err && MoveFileEx(as_wstr(as_text(staged.tmp_path)).ptr, as_wstr(as_text(staged.path)).ptr,
+	                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) { return; }
+	if (!err) { err = decode_os_err(GetLastError()); }
+	DeleteFile(as_wstr(as_text(staged.tmp_path)).ptr);
+	#endif
+}
+
+void_t commit_file (const path_t& path, const str_t& data, err_t& err)
+{
+	if (err) { return; }
+
+	staged_t staged;
+	stage(staged, path, data, err);
+	sync(staged.file, err);
+	unstage(staged, err);
+	#ifdef __unix__
+	// windows has no handles on directories to flush, but MOVEFILE_WRITE_THROUGH covered it
+	sync(staged.dir, err);
+	#endif
+}
+
+struct commit_req_t
+{
+	staged_t staged {};
+	err_t    err    {};
+	sem_t    done   {};
+};
+
+struct commit_group_state_t
+{
+	mutex_t              mutex    {};
+	sem_t                work_sem {}; // at least one count per request waiting, then one to stop
+	sem_t                exit_sem {};
+	seq_t<commit_req_t*> reqs     {};
+	bool_t               stopping {};
+	pad_t<7>             padding  {};
+};
+
+#ifdef __linux__
+// One syncfs flushes a whole file system, so a batch needs one per device it touches
+void_t sync_devices (seq_t<commit_req_t*>& reqs, bool_t by_dir)
+{
+	seq_t<dev_t> devs;
+	for (auto req : reqs) {
+		if (req->err) { continue; }
+		auto& file = by_dir ? req->staged.dir : req->staged.file;
+		struct stat st = {};
+		if (fstat(get_fd(file.opaq), &st) != 0) {
+			req->err = decode_os_err(errno);
+			continue;
+		}
+		auto seen = false;
+		for (auto dev : devs) {
+			if (dev == st.st_dev) { seen = true; }
+		}
+		if (seen) { continue; }
+
+		if (syncfs(get_fd(file.opaq)) != 0) {
+			sync(file, req->err);
+			continue;
+		}
+		grow(devs, devs.len, 1);
+		devs[devs.len - 1] = st.st_dev;
+	}
+	// a failed syncfs has to fail every file on that device, so those that shared it sync for themselves
+	for (auto req : reqs) {
+		if (req->err) { continue; }
+		struct stat st = {};
+		auto& file = by_dir ? req->staged.dir : req->staged.file;
+		if (fstat(get_fd(file.opaq), &st) != 0) { continue; }
+		auto synced = false;
+		for (auto dev : devs) {
+			if (dev == st.st_dev) { synced = true; }
+		}
+		if (!synced) { sync(file, req->err); }
+	}
+}
+#endif
+
+void_t commit_batch (seq_t<commit_req_t*>& reqs)
+{
+	#ifdef __linux__
+	sync_devices(reqs, false);
+	for (auto req : reqs) {
+		unstage(req->staged, req->err);
+	}
+	sync_devices(reqs, true);
+	#else
+	for (auto req : reqs) {
+		sync(req->staged.file, req->err);
+		unstage(req->staged, req->err);
+		#ifdef __unix__
+		sync(req->staged.dir, req->err);
+		#endif
+	}
+	#endif
+}
+
+void_t run_committer (commit_group_state_t& st)
+{
+	while (true) {
+		wait(st.work_sem);
+
+		seq_t<commit_req_t*> reqs;
+		{ auto lock = acquire(st.mutex);
+			if (!st.reqs && st.stopping) { break; }
+			reqs = move(st.reqs);
+		}
+		// requests that came in while the last batch was syncing leave spare counts behind
+		if (!reqs) { continue; }
+
+		commit_batch(reqs);
+		for (auto req : reqs) {
+			signal(req->done);
+		}
+	}
+	signal(st.exit_sem);
+}
+
+commit_group_state_t& get_state (const commit_group_t& group)
+{
+	assert_true(group.opaq);
+	return *static_cast<commit_group_state_t*>(get_ptr(group.opaq));
+}
+
+commit_group_t::commit_group_t () { }
+commit_group_t::~commit_group_t ()
+{
+	if (!opaq) { return; }
+
+	box_t<commit_group_state_t> box;
+	acquire(box, &get_state(*this));
+	opaq = {};
+
+	auto& st = **box;
+	{ auto lock = acquire(st.mutex);
+		st.stopping = true;
+	}
+	signal(st.work_sem);
+	wait(st.exit_sem);
+}
+
+commit_group_t::commit_group_t (commit_group_t&& ori) { *this = move(ori); }
+commit_group_t& commit_group_t::operator = (commit_group_t&& ori)
+{
+	if (&ori != this) {
+		this->~commit_group_t();
+		opaq = ori.opaq;
+		ori.opaq = {};
+	}
+	return *this;
+}
+
+commit_group_t::operator bool_t () const
+{
+	return bool_t(opaq);
+}
+
+commit_group_t create_commit_group (err_t& err)
+{
+	if (err) { return {}; }
+
+	box_t<commit_group_state_t> box;
+	spawn_thread(&run_committer, **box, err);
+	if (err) { return {}; }
+
+	commit_group_t group;
+	group.opaq = create_opaque_ptr(release(box));
+	return group;
+}
+
+void_t commit_file (commit_group_t& group, const path_t& path, const str_t& data, err_t& err)
+{
+	if (err) { return; }
+
+	commit_req_t req;
+	stage(req.staged, path, data, err);
+	if (err) { return; }
+
+	auto& st = get_state(group);
+	{ auto lock = acquire(st.mutex);
+		grow(st.reqs, st.reqs.len, 1);
+		st.reqs[st.reqs.len - 1] = &req;
+	}
+	signal(st.work_sem);
+	wait(req.done);
+	err = move(req.err);
+}
+
+struct commit_client_t
+{
+	commit_group_t* group    {};
+	const path_t*   dir      {};
+	nat8_t          id       {};
+	err_t           err      {};
+	sem_t           finished {};
+};
+
+void_t run_commit_client (commit_client_t& client)
+{
+	for (auto i : create_range(20)) {
+		const auto name = as_text(client.id) + "-" + as_text(i);
+		commit_file(*client.group, *client.dir + name, "v1 " + name, client.err);
+		commit_file(*client.group, *client.dir + name, "v2 " + name, client.err);
+	}
+	signal(client.finished);
+}
+
+define_test(commit, "path,thread,dir")
+{
+	err_t err;
+	auto dir = create_temp_path(err);
+	remove_file(dir, err);
+	create_dir(dir, err);
+
+	const auto path = dir + "config";
+	commit_file(path, "first", err);
+	commit_file(path, "second", err);
+	{ auto file = open_file(path, false, err);
+		prove_same(read_all(file, err), "second");
+	}
+	prove_same(as_text(err), "");
+	commit_file(dir + "missing" + "config", "lost", err);
+	prove_true(err);
+	err = {};
+
+	{ auto group = create_commit_group(err);
+		commit_client_t clients[4];
+		for (auto i : create_range(4)) {
+			clients[i].group = &group;
+			clients[i].dir   = &dir;
+			clients[i].id    = i;
+			spawn_thread(&run_commit_client, clients[i], err);
+		}
+		for (auto& client : clients) {
+			wait(client.finished);
+			prove_same(as_text(client.err), "");
+		}
+	}
+
+	// only the committed files are left, without any temps
+	nat8_t entries_n = 0;
+	{ auto listing = open_dir(dir, err);
+		while (read_dir(listing, err).name.ptr) { ++entries_n; }
+	}
+	prove_eq(entries_n, 4 * 20 + 1);
+	{ auto file = open_file(dir + "3-19", false, err);
+		prove_same(read_all(file, err), "v2 3-19");
+	}
+	prove_same(as_text(err), "");
+
+	remove_file(path, err);
+	for (auto i : create_range(4)) {
+		for (auto j : create_range(20)) {
+			remove_file(dir + (as_text(i) + "-" + as_text(j)), err);
+		}
+	}
+	remove_dir(dir, err);
+	prove_same(as_text(err), "");
+	return {};
+}
@@ -0,0 +1,31 @@
+#ifndef libcx3_commit_hpp
+#define libcx3_commit_hpp
+#include "prelude.hpp"
+
+struct path_t;
+struct err_t;
+
+// Replaces the file at path so readers see either all the old data or all the new, never a mix, and the new data
+// survives a crash once this returns. Takes a temp file, an fsync, a rename and an fsync of the directory.
+void_t commit_file (const path_t& path, const str_t& data, err_t& err);
+
+// Commits from any number of threads share their syncs. A background thread flushes everything waiting with one
+// syncfs per file system, renames the lot, and flushes again, while the next batch gathers behind it.
+struct commit_group_t
+{
+	opaque_t opaq {};
+
+	commit_group_t ();
+	~commit_group_t ();
+	commit_group_t (const commit_group_t& ori) = delete;
+	commit_group_t& operator = (const commit_group_t& ori) = delete;
+	commit_group_t (commit_group_t&& ori);
+	commit_group_t& operator = (commit_group_t&& ori);
+
+	explicit operator bool_t () const;
+};
+
+commit_group_t create_commit_group (err_t& err);
+void_t commit_file (commit_group_t& group, const path_t& path, const str_t& data, err_t& err); // waits for its batch
+
+#endif
@@ -84,7 +84,7 @@ void_t install_test (test_result_t (*func) (), const char* name, const char* dep
 #pragma clang diagnostic ignored "-Wglobal-constructors"
 #define define_test(func, deps) \
 	test_result_t test_##func (); \
-	namespace { nullptr_t dummy = (install_test(&test_##func, #func, deps), nullptr); } \
+	namespace { nullptr_t dummy_##func = (install_test(&test_##func, #func, deps), nullptr); } \
 	test_result_t test_##func ()
 
 #define prove_eq(   left, right) \
@@ -0,0 +1,492 @@
+#include "dir.hpp"
+#include "file.hpp"
+#include "error.hpp"
+#include "text.hpp"
+#include "raw.hpp"
+#include "thread.hpp"
+#include "platform.hpp"
+#ifdef __unix__
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#ifdef __unix__
+int get_fd (opaque_t opaq);
+opaque_t create_opaque_fd (int fd);
+#endif
+#ifdef _WIN32
+HANDLE get_handle (opaque_t opaq);
+opaque_t create_opaque_handle (HANDLE h);
+#endif
+
+void_t create_dir (const path_t& path, err_t& err)
+{
+	if (err) { return; }
+
+	#ifdef __unix__
+	if (mkdir(as_strz(as_text(path)).ptr, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == 0) { return; }
+	err = decode_os_err(errno);
+	#endif
+
+	#ifdef _WIN32
+	if (CreateDirectory(as_wstr(as_text(path)).ptr, NULL)) { return; }
+	err = decode_os_err(GetLastError());
+	#endif
+}
+
+void_t remove_dir (const path_t& path, err_t& err)
+{
+	if (err) { return; }
+
+	#ifdef __unix__
+	if (rmdir(as_strz(as_text(path)).ptr) == 0) { return; }
+	err = decode_os_err(errno);
+	#endif
+
+	#ifdef _WIN32
+	if (RemoveDirectory(as_wstr(as_text(path)).ptr)) { return; }
+	err = decode_os_err(GetLastError());
+	#endif
+}
+
+dir_t::dir_t () { }
+dir_t::~dir_t ()
+{
+	if (!opaq) { return; }
+	#ifdef __unix__
+	close(get_fd(opaq));
+	#endif
+	#ifdef _WIN32
+	FindClose(get_handle(opaq));
+	#endif
+}
+
+dir_t::dir_t (dir_t&& ori) { *this = move(ori); }
+dir_t& dir_t::operator = (dir_t&& ori)
+{
+	if (&ori != this) {
+		this->~dir_t();
+		opaq = ori.opaq;
+		buf  = move(ori.buf);
+		at   = ori.at;
+		len  = ori.len;
+		name = move(ori.name);
+		ori.opaq = {};
+		ori.at   = {};
+		ori.len  = {};
+	}
+	return *this;
+}
+
+dir_t::operator bool_t () const
+{
+	return bool_t(opaq);
+}
+
+bool_t is_dot_or_dots (const view_t<const nat1_t>& name)
+{
+	return (name.len == 1 && name[0] == '.') || (name.len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+dir_t open_dir (const path_t& path, err_t& err)
+{
+	if (err) { return {}; }
+
+	#ifdef __unix__
+	const auto fd = open(as_strz(as_text(path)).ptr, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		err = decode_os_err(errno);
+		return {};
+	}
+	dir_t dir;
+	dir.opaq = create_opaque_fd(fd);
+	// big enough for a few thousand names a call
+	dir.buf = create_str(128 * 1024);
+	return dir;
+	#endif
+
+	#ifdef _WIN32
+	WIN32_FIND_DATAW data = {};
+	const auto pattern = as_wstr(as_text(path) + "\\*");
+	const auto handle = FindFirstFileEx(pattern.ptr, FindExInfoBasic, &data, FindExSearchNameMatch, NULL,
+	                                    FIND_FIRST_EX_LARGE_FETCH);
+	if (handle == INVALID_HANDLE_VALUE) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	dir_t dir;
+	dir.opaq = create_opaque_handle(handle);
+	dir.buf = create_str(sizeof(data));
+	copy_mem(dir.buf.ptr, &data, sizeof(data));
+	dir.len = 1; // the first entry comes with the handle
+	return dir;
+	#endif
+}
+
+dir_entry_t read_dir (dir_t& dir, err_t& err)
+{
+	if (err) { return {}; }
+
+	#ifdef __unix__
+	// linux_dirent64: d_ino (8), d_off (8), d_reclen (2), d_type (1), then the name and its nul
+	const nat8_t reclen_at = 16;
+	const nat8_t type_at   = 18;
+	const nat8_t name_at   = 19;
+
+	while (true) {
+		if (dir.at == dir.len) {
+			const auto stat = syscall(SYS_getdents64, get_fd(dir.opaq), dir.buf.ptr, dir.buf.len);
+			if (stat < 0) {
+				err = decode_os_err(errno);
+				return {};
+			}
+			if (stat == 0) { return {}; }
+			dir.at  = 0;
+			dir.len = static_cast<nat8_t>(stat);
+		}
+
+		const auto rec = dir.buf.ptr + dir.at;
+		nat2_t rec_len = 0;
+		copy_mem(&rec_len, rec + reclen_at, sizeof(rec_len));
+		dir.at += rec_len;
+
+		dir_entry_t entry;
+		const auto name = reinterpret_cast<const char*>(rec + name_at);
+		entry.name = create_view(static_cast<const nat1_t*>(rec + name_at), __builtin_strlen(name));
+		if (is_dot_or_dots(entry.name)) { continue; }
+		switch (rec[type_at]) {
+			case DT_REG:     entry.kind = entry_kind_t::file;    break;
+			case DT_DIR:     entry.kind = entry_kind_t::dir;     break;
+			case DT_LNK:     entry.kind = entry_kind_t::link;    break;
+			case DT_UNKNOWN: entry.kind = entry_kind_t::unknown; break;
+			default:         entry.kind = entry_kind_t::other;   break;
+		}
+		return entry;
+	}
+	#endif
+
+	#ifdef _WIN32
+	WIN32_FIND_DATAW data = {};
+	while (true) {
+		if (dir.len == 0) {
+			if (!FindNextFile(get_handle(dir.opaq), &data)) {
+				if (GetLastError() == ERROR_NO_MORE_FILES) { return {}; }
+				err = decode_os_err(GetLastError());
+				return {};
+			}
+		} else {
+			copy_mem(&data, dir.buf.ptr, sizeof(data));
+			dir.len = 0;
+		}
+
+		dir.name = create_str(data.cFileName);
+		dir_entry_t entry;
+		entry.name = create_view(static_cast<const str_t&>(dir.name));
+		if (is_dot_or_dots(entry.name)) { continue; }
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+			entry.kind = entry_kind_t::link;
+		} else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			entry.kind = entry_kind_t::dir;
+		} else {
+			entry.kind = entry_kind_t::file;
+		}
+		return entry;
+	}
+	#endif
+}
+
+entry_kind_t stat_kind (dir_t& dir, const dir_entry_t& entry, err_t& err)
+{
+	if (err) { return {}; }
+	if (entry.kind != entry_kind_t::unknown) { return entry.kind; }
+
+	#ifdef __unix__
+	// the name is still followed by its nul in the buffer
+	struct stat st = {};
+	const auto name = reinterpret_cast<const char*>(entry.name.ptr);
+	if (fstatat(get_fd(dir.opaq), name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+		err = decode_os_err(errno);
+		return {};
+	}
+	if (S_ISREG(st.st_mode)) { return entry_kind_t::file; }
+	if (S_ISDIR(st.st_mode)) { return entry_kind_t::dir; }
+	if (S_ISLNK(st.st_mode)) { return entry_kind_t::link; }
+	return entry_kind_t::other;
+	#endif
+
+	#ifdef _WIN32
+	unused(dir);
+	return entry_kind_t::other;
+	#endif
+}
+
+bool_t is_glob_match (const view_t<const nat1_t>& name, const str_t& glob)
+{
+	// backtracks only to the last star, which is enough since a later star can match anything an earlier one did
+	nat8_t name_i = 0;
+	nat8_t glob_i = 0;
+	nat8_t star_name_i = 0;
+	nat8_t star_glob_i = max<nat8_t>();
+	while (name_i < name.len) {
+		if (glob_i < glob.len && (glob[glob_i] == '?' || glob[glob_i] == name[name_i])) {
+			++glob_i;
+			++name_i;
+		} else if (glob_i < glob.len && glob[glob_i] == '*') {
+			star_glob_i = glob_i++;
+			star_name_i = name_i;
+		} else if (star_glob_i != max<nat8_t>()) {
+			glob_i = star_glob_i + 1;
+			name_i = ++star_name_i;
+		} else {
+			return false;
+		}
+	}
+	while (glob_i < glob.len && glob[glob_i] == '*') { ++glob_i; }
+	return glob_i == glob.len;
+}
+
+bool_t is_wanted (const walk_opts_t& opts, const view_t<const nat1_t>& name)
+{
+	if (opts.exts) {
+		auto found = false;
+		for (const auto& ext : opts.exts) {
+			if (name.len > ext.len && name[name.len - ext.len - 1] == '.' &&
+			    is_mem_eq(name.ptr + name.len - ext.len, ext.len, ext.ptr, ext.len)) {
+				found = true;
+				break;
+			}
+		}
+		if (!found) { return false; }
+	}
+	return !opts.glob || is_glob_match(name, opts.glob);
+}
+
+struct walk_state_t
+{
+	const walk_opts_t* opts      {};
+	walk_func_raw_t    func      {};
+	void_t*            arg       {};
+	mutex_t            mutex     {};
+	sem_t              work_sem  {}; // one count per directory waiting, then one per worker to stop them
+	sem_t              exit_sem  {};
+	seq_t<path_t>      dirs      {};
+	err_t              err       {};
+	nat8_t             busy_n    {};
+	nat4_t             workers_n {};
+	bool_t             stopping  {};
+	pad_t<3>           padding   {};
+};
+
+void_t walk_dir (walk_state_t& st, const path_t& path, seq_t<path_t>& found, err_t& err)
+{
+	auto dir = open_dir(path, err);
+	while (!err) {
+		auto entry = read_dir(dir, err);
+		if (err || !entry.name.ptr) { break; }
+		entry.kind = stat_kind(dir, entry, err);
+		if (err) { break; }
+
+		if (entry.kind == entry_kind_t::dir) {
+			grow(found, found.len, 1);
+			found[found.len - 1] = path + create_str(entry.name);
+			if (st.opts->with_dirs) { st.func(st.arg, path, entry); }
+		} else if (is_wanted(*st.opts, entry.name)) {
+			st.func(st.arg, path, entry);
+		}
+	}
+}
+
+void_t run_walker (walk_state_t& st)
+{
+	while (true) {
+		wait(st.work_sem);
+
+		path_t path;
+		{ auto lock = acquire(st.mutex);
+			if (st.stopping) { break; }
+			assert_true(st.dirs);
+			path = move(st.dirs[st.dirs.len - 1]);
+			shrink(st.dirs, st.dirs.len - 1, 1);
+			++st.busy_n;
+		}
+
+		seq_t<path_t> found;
+		err_t err;
+		walk_dir(st, path, found, err);
+		if (err && st.opts->skip_errs) {
+			err = {};
+		}
+
+		nat8_t wake_n = 0;
+		{ auto lock = acquire(st.mutex);
+			--st.busy_n;
+			if (err && !st.stopping) {
+				st.err = move(err);
+				st.stopping = true;
+				wake_n = st.workers_n;
+			} else if (!st.stopping) {
+				const auto old_len = st.dirs.len;
+				grow(st.dirs, old_len, found.len);
+				for (auto i : create_range(found.len)) {
+					st.dirs[old_len + i] = move(found[i]);
+				}
+				wake_n = found.len;
+				if (!st.dirs && !st.busy_n) {
+					st.stopping = true;
+					wake_n = st.workers_n;
+				}
+			}
+		}
+		for (auto i : create_range(wake_n)) {
+			unused(i);
+			signal(st.work_sem);
+		}
+	}
+	signal(st.exit_sem);
+}
+
+void_t walk_tree_raw_param (const path_t& root, const walk_opts_t& opts, walk_func_raw_t func, void_t* arg, err_t& err)
+{
+	if (err) { return; }
+
+	// the root has to open even when other directories are allowed to fail
+	{ auto dir = open_dir(root, err); }
+	if (err) { return; }
+
+	walk_state_t st;
+	st.opts = &opts;
+	st.func = func;
+	st.arg  = arg;
+	st.dirs = create_seq<path_t>(1);
+	st.dirs[0] = clone(root);
+	st.workers_n = opts.workers_n;
+	if (!st.workers_n) {
+		const auto cpus_n = get_topology().logical_n;
+		st.workers_n = cpus_n < 1 ? 1 : cpus_n > 16 ? 16 : cpus_n;
+	}
+	signal(st.work_sem);
+
+	// this thread walks too, so it's one fewer to spawn
+	nat4_t spawned_n = 0;
+	for (auto i : create_range(st.workers_n - 1)) {
+		unused(i);
+		err_t spawn_err;
+		spawn_thread(&run_walker, st, spawn_err);
+		if (spawn_err) { break; }
+		++spawned_n;
+	}
+	{ auto lock = acquire(st.mutex);
+		st.workers_n = spawned_n + 1;
+	}
+	run_walker(st);
+	for (auto i : create_range(spawned_n + 1)) {
+		unused(i);
+		wait(st.exit_sem);
+	}
+	err = move(st.err);
+}
+
+struct walk_tally_t
+{
+	mutex_t mutex   {};
+	nat8_t  files_n {};
+	nat8_t  dirs_n  {};
+	nat8_t  deep_n  {};
+};
+
+void_t tally_entry (walk_tally_t& tally, const path_t& dir, const dir_entry_t& entry)
+{
+	auto lock = acquire(tally.mutex);
+	if (entry.kind == entry_kind_t::dir) {
+		++tally.dirs_n;
+	} else {
+		++tally.files_n;
+	}
+	if (create_str(get_leaf(dir)) == "deep") { ++tally.deep_n; }
+}
+
+define_test(dir, "path,thread,platform")
+{
+	err_t err;
+	auto root = create_temp_path(err);
+	remove_file(root, err);
+	create_dir(root, err);
+	create_dir(root + "sub", err);
+	create_dir(root + "sub" + "deep", err);
+	const char* names[] = { "a.txt", "b.log", "sub/c.txt", "sub/deep/d.txt", "sub/deep/e.TXT", "sub/deep/txt" };
+	for (auto name : names) {
+		auto file = open_file(create_path(as_text(root) + "/" + name), true, err);
+	}
+	prove_same(as_text(err), "");
+
+	{
+		auto dir = open_dir(root, err);
+		nat8_t entries_n = 0;
+		nat8_t dirs_n = 0;
+		while (true) {
+			const auto entry = read_dir(dir, err);
+			if (!entry.name.ptr) { break; }
+			++entries_n;
+			if (stat_kind(dir, entry, err) == entry_kind_t::dir) {
+				prove_same(create_str(entry.name), "sub");
+				++dirs_n;
+			}
+		}
+		prove_eq(entries_n, 3);
+		prove_eq(dirs_n, 1);
+		prove_same(as_text(err), "");
+	}
+
+	prove_true(is_glob_match(create_view(create_str("abc.txt")), "*.txt"));
+	prove_true(is_glob_match(create_view(create_str("abc.txt")), "a?c*"));
+	prove_true(is_glob_match(create_view(create_str("a.b.txt")), "*.*.txt"));
+	prove_false(is_glob_match(create_view(create_str("abc.txt")), "*.log"));
+	prove_false(is_glob_match(create_view(create_str("abc")), "abcd"));
+
+	for (nat4_t workers_n = 1; workers_n <= 4; ++workers_n) {
+		walk_opts_t opts;
+		opts.workers_n = workers_n;
+		opts.exts = create_seq<str_t>(1);
+		opts.exts[0] = create_str("txt");
+		walk_tally_t tally;
+		walk_tree(root, opts, &tally_entry, tally, err);
+		prove_same(as_text(err), "");
+		prove_eq(tally.files_n, 3);
+		prove_eq(tally.dirs_n, 0);
+		prove_eq(tally.deep_n, 1);
+	}
+	{
+		walk_opts_t opts;
+		opts.glob = create_str("?.*");
+		opts.with_dirs = true;
+		walk_tally_t tally;
+		walk_tree(root, opts, &tally_entry, tally, err);
+		prove_eq(tally.files_n, 5);
+		prove_eq(tally.dirs_n, 2);
+		prove_eq(tally.deep_n, 2);
+	}
+	{
+		walk_opts_t opts;
+		walk_tally_t tally;
+		walk_tree(root + "missing", opts, &tally_entry, tally, err);
+		prove_true(err);
+		err = {};
+	}
+
+	for (auto i : create_range(sizeof(names) / sizeof(names[0]))) {
+		remove_file(create_path(as_text(root) + "/" + names[i]), err);
+	}
+	remove_dir(root + "sub" + "deep", err);
+	remove_dir(root + "sub", err);
+	remove_dir(root, err);
+	prove_same(as_text(err), "");
+	return {};
+}
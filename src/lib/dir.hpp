@@ -0,0 +1,74 @@
+#ifndef libcx3_dir_hpp
+#define libcx3_dir_hpp
+#include "prelude.hpp"
+
+struct path_t;
+struct err_t;
+
+void_t create_dir (const path_t& path, err_t& err);
+void_t remove_dir (const path_t& path, err_t& err); // only when empty
+
+enum class entry_kind_t : nat1_t
+{
+	unknown = 0, // the file system didn't say, so it takes a stat to find out
+	file    = 1,
+	dir     = 2,
+	link    = 3,
+	other   = 4,
+};
+
+struct dir_entry_t
+{
+	view_t<const nat1_t> name    {}; // into the dir_t, until its next read_dir
+	entry_kind_t         kind    {};
+	pad_t<7>             padding {};
+};
+
+struct dir_t
+{
+	opaque_t opaq {};
+	str_t    buf  {}; // entries as the os hands them out, many per call
+	nat8_t   at   {};
+	nat8_t   len  {};
+	str_t    name {}; // the current name, on windows where it has to be converted
+
+	dir_t ();
+	~dir_t ();
+	dir_t (const dir_t& ori) = delete;
+	dir_t& operator = (const dir_t& ori) = delete;
+	dir_t (dir_t&& ori);
+	dir_t& operator = (dir_t&& ori);
+
+	explicit operator bool_t () const;
+};
+
+// Entries come in the file system's order, without . and .., and with a null name.ptr after the last one
+dir_t open_dir (const path_t& path, err_t& err);
+dir_entry_t read_dir (dir_t& dir, err_t& err);
+entry_kind_t stat_kind (dir_t& dir, const dir_entry_t& entry, err_t& err); // without following links
+
+bool_t is_glob_match (const view_t<const nat1_t>& name, const str_t& glob); // * and ? only
+
+struct walk_opts_t
+{
+	seq_t<str_t> exts      {}; // files must end in one of these (without the dot), when there are any
+	str_t        glob      {}; // and match this, when there is one
+	nat4_t       workers_n {}; // picked from the topology when zero
+	bool_t       with_dirs {}; // pass directories to the callback as well as files
+	bool_t       skip_errs {}; // leave out directories that can't be read, rather than stopping
+	pad_t<2>     padding   {};
+};
+
+// The callback runs on all the walking threads at once, so whatever it shares needs a lock or a queue_t.
+// Symbolic links are passed on as links (through the filters, like files) and never followed.
+typedef void_t (*walk_func_raw_t) (void_t* arg, const path_t& dir, const dir_entry_t& entry);
+void_t walk_tree_raw_param (const path_t& root, const walk_opts_t& opts, walk_func_raw_t func, void_t* arg, err_t& err);
+
+template<typename T> void_t walk_tree (const path_t& root, const walk_opts_t& opts,
+                                       void_t (*func) (T& arg, const path_t& dir, const dir_entry_t& entry), T& arg,
+                                       err_t& err)
+{
+	walk_tree_raw_param(root, opts, reinterpret_cast<walk_func_raw_t>(func), &arg, err);
+}
+
+#endif
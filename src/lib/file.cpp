@@ -9,10 +9,17 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
 #endif
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <winioctl.h>
 #endif
 
 #ifdef __unix__
@@ -22,9 +29,48 @@ int fd (nat8_t h);
 HANDLE handle (nat8_t h);
 #endif
 
+#ifdef __unix__
+const nat1_t path_delim = '/';
+#endif
+#ifdef _WIN32
+const nat1_t path_delim = '\\';
+#endif
+
 path_t::operator bool_t () const
 {
-	return bool_t(cos);
+	return cos_n > 0;
+}
+
+// Doubles whatever has to grow, so a run of appends copies each byte a bounded number of times
+void_t reserve (path_t& path, nat8_t len, nat8_t cos_n)
+{
+	assert_lt(len, max<nat4_t>());
+	if (path.buf.len < len) {
+		const auto new_len = len > 2 * path.buf.len ? len : 2 * path.buf.len;
+		grow(path.buf, path.buf.len, new_len - path.buf.len);
+	}
+	if (path.ends.len < cos_n) {
+		const auto new_len = cos_n > 2 * path.ends.len ? cos_n : 2 * path.ends.len;
+		grow(path.ends, path.ends.len, new_len - path.ends.len);
+	}
+}
+
+// The delimiter after a component sits at its end, and a root has its own there already
+void_t push_co (path_t& path, const nat1_t* ptr, nat8_t len)
+{
+	reserve(path, path.len + len + 1, path.cos_n + 1);
+	if (path.cos_n > 0 && path.len == path.ends[path.cos_n - 1]) {
+		path.buf[path.len] = path_delim;
+		++path.len;
+	}
+	copy_mem(&path.buf[path.len], ptr, len);
+	path.len += static_cast<nat4_t>(len);
+	path.ends[path.cos_n] = path.len;
+	++path.cos_n;
+	if (path.len == 0) {
+		path.buf[0] = path_delim;
+		path.len = 1;
+	}
 }
 
 path_t create_path (const str_t& text)
@@ -38,92 +84,108 @@ path_t create_path (const str_t& text)
 		}
 	}
 
-	path_t path; {
-		nat8_t n_cos = 0;
-		nat8_t front = 0;
-		for (auto i : create_range(text.len)) {
-			if (text[i] == '/' || (text[i] == '\\' && parse_back)) {
-				if (i != front || n_cos == 0) { ++n_cos; }
-				front = i + 1;
-			}
-		}
-		if (text.len != front) { ++n_cos; }
-		path.cos = create_seq<str_t>(n_cos);
-	}
-
-	nat8_t seg_i = 0;
+	path_t path;
+	reserve(path, text.len, 4);
 	nat8_t front = 0;
-	for (auto i : create_range(text.len)) {
-		if (text[i] == '/' || (text[i] == '\\' && parse_back)) {
-			if (i != front || seg_i == 0) {
-				path.cos[seg_i] = create_str(&text[front], i - front);
-				++seg_i;
-			}
-			front = i + 1;
+	for (auto i : create_range(text.len + 1)) {
+		if (i < text.len && text[i] != '/' && (text[i] != '\\' || !parse_back)) { continue; }
+		if (i != front || path.cos_n == 0) {
+			push_co(path, text.ptr + front, i - front);
 		}
+		front = i + 1;
 	}
-	if (text.len != front) {
-		path.cos[seg_i] = create_str(&text[front], text.len - front);
-		++seg_i;
-	}
-
-	assert_eq(seg_i, path.cos.len);
 	return path;
 }
 
-path_t clone (const path_t& path)
+// Copies the whole path into the room asked for, which has to hold it
+path_t copy_path (const path_t& path, nat8_t len, nat8_t cos_n)
 {
 	path_t prod;
-	prod.cos = create_seq<str_t>(path.cos.len);
-	for (auto i : create_range(path.cos.len)) {
-		prod.cos[i] = clone(path.cos[i]);
-	}
+	if (!path) { return prod; }
+
+	reserve(prod, len, cos_n);
+	copy_mem(prod.buf.ptr, path.buf.ptr, path.len);
+	copy_mem(prod.ends.ptr, path.ends.ptr, path.cos_n * sizeof(nat4_t));
+	prod.len   = path.len;
+	prod.cos_n = path.cos_n;
 	return prod;
 }
 
+path_t clone (const path_t& path)
+{
+	return copy_path(path, path.len, path.cos_n);
+}
+
 path_t operator + (const path_t& path, const str_t& right)
 {
-	path_t prod = clone(path);
-	if (right) {
-		grow(prod.cos, prod.cos.len, 1);
-		prod.cos[prod.cos.len - 1] = clone(right);
-	}
+	if (!right) { return clone(path); }
+
+	auto prod = copy_path(path, path.len + right.len + 1, path.cos_n + 1);
+	push_co(prod, right.ptr, right.len);
 	return prod;
 }
 
+void_t append (path_t& path, const str_t& co)
+{
+	if (!co) { return; }
+	push_co(path, co.ptr, co.len);
+}
+
+bool_t operator == (const path_t& left, const path_t& right)
+{
+	return is_mem_eq(left.buf.ptr, left.len, right.buf.ptr, right.len) &&
+	       is_mem_eq(left.ends.ptr, left.cos_n * sizeof(nat4_t), right.ends.ptr, right.cos_n * sizeof(nat4_t));
+}
+
+bool_t operator != (const path_t& left, const path_t& right)
+{
+	return !(left == right);
+}
+
+nat8_t count_cos (const path_t& path)
+{
+	return path.cos_n;
+}
+
+view_t<const nat1_t> get_co (const path_t& path, nat8_t i)
+{
+	assert_lt(i, path.cos_n);
+	const nat8_t front = i > 0 ? path.ends[i - 1] + 1 : 0;
+	return create_view(static_cast<const nat1_t*>(path.buf.ptr) + front, path.ends[i] - front);
+}
+
+view_t<const nat1_t> get_leaf (const path_t& path)
+{
+	if (!path) { return {}; }
+	return get_co(path, path.cos_n - 1);
+}
+
+view_t<const nat1_t> get_text (const path_t& path)
+{
+	return create_view(static_cast<const nat1_t*>(path.buf.ptr), path.len);
+}
+
 str_t as_text (const path_t& path)
 {
-	#ifdef __unix__
-	return as_text(path, "/");
-	#endif
-	#ifdef _WIN32
-	return as_text(path, "\\");
-	#endif
+	return create_str(get_text(path));
 }
 
 str_t as_text (const path_t& path, const str_t& delim)
 {
-	if (path.cos.len == 1 && !path.cos[0]) { return clone(delim); }
-
-	str_t text; {
-		nat8_t len = 0;
-		for (auto& seg : path.cos) {
-			if (&seg != &path.cos[0]) { len += delim.len; }
-			len += seg.len;
-		}
-		text = create_str(len);
-	}
+	if (!path) { return {}; }
+	if (delim.len == 1 && delim[0] == path_delim) { return as_text(path); }
+	if (path.cos_n == 1 && path.ends[0] == 0) { return clone(delim); }
 
+	auto text = create_str(path.len - (path.cos_n - 1) + (path.cos_n - 1) * delim.len);
 	nat8_t buf_i = 0;
-	for (auto& seg : path.cos) {
-		if (&seg != &path.cos[0]) {
+	for (auto i : create_range(path.cos_n)) {
+		if (i > 0) {
 			copy_mem(&text[buf_i], delim.ptr, delim.len);
 			buf_i += delim.len;
 		}
-		if (seg.len > 0) {
-			copy_mem(&text[buf_i], seg.ptr, seg.len);
-			buf_i += seg.len;
-		}
+		const auto co = get_co(path, i);
+		copy_mem(&text[buf_i], co.ptr, co.len);
+		buf_i += co.len;
 	}
 	assert_eq(buf_i, text.len);
 	return text;
@@ -204,27 +266,43 @@ path_t create_temp_path (err_t& err)
 	#endif
 }
 
+void_t remove_file (const path_t& path, err_t& err)
+{
+	if (err) { return; }
+
+	#ifdef __unix__
+	if (unlink(as_strz(as_text(path)).ptr) == 0) { return; }
+	err = decode_os_err(errno);
+	#endif
+
+	#ifdef _WIN32
+	if (DeleteFile(as_wstr(as_text(path)).ptr)) { return; }
+	err = decode_os_err(GetLastError());
+	#endif
+}
+
 path_t get_dir (const path_t& path)
 {
-	if (path.cos.len <= 1) { return {}; }
+	if (path.cos_n <= 1) { return {}; }
 
+	// only a root ends at zero, and it keeps its delimiter
+	const nat8_t len = path.ends[path.cos_n - 2] > 0 ? path.ends[path.cos_n - 2] : 1;
 	path_t prod;
-	prod.cos = create_seq<str_t>(path.cos.len - 1);
-	for (auto i : create_range(path.cos.len - 1)) {
-		prod.cos[i] = clone(path.cos[i]);
-	}
+	reserve(prod, len, path.cos_n - 1);
+	copy_mem(prod.buf.ptr, path.buf.ptr, len);
+	copy_mem(prod.ends.ptr, path.ends.ptr, (path.cos_n - 1) * sizeof(nat4_t));
+	prod.len   = static_cast<nat4_t>(len);
+	prod.cos_n = path.cos_n - 1;
 	return prod;
 }
 
 str_t get_ext (const path_t& path)
 {
-	if (!path) { return {}; }
-
-	const auto& leaf = path.cos[path.cos.len - 1];
+	const auto leaf = get_leaf(path);
 	for (auto i : create_range(leaf.len)) {
 		i = leaf.len - i;
 		if (leaf[i - 1] == '.') {
-			return create_str(&leaf[i], leaf.len - i);
+			return create_str(leaf.ptr + i, leaf.len - i);
 		}
 	}
 	return {};
@@ -234,25 +312,30 @@ void_t set_ext (path_t& path, const str_t& ext)
 {
 	if (!path) { return; }
 
-	auto& leaf = path.cos[path.cos.len - 1];
+	const auto leaf = get_leaf(path);
+	const auto leaf_at = static_cast<nat8_t>(leaf.ptr - path.buf.ptr);
+	auto stem_len = leaf.len;
 	for (auto i : create_range(leaf.len)) {
 		i = leaf.len - i;
 		if (leaf[i - 1] == '.') {
-			if (ext) {
-				leaf = create_str(leaf.ptr, i) + ext;
-			} else {
-				if (i - 1 > 0) {
-					leaf = create_str(leaf.ptr, i - 1);
-				} else {
-					path = get_dir(path);
-				}
+			if (!ext && i - 1 == 0) {
+				path = get_dir(path);
+				return;
 			}
-			return;
+			stem_len = i - 1;
+			break;
 		}
 	}
+	if (stem_len == leaf.len && !ext) { return; }
+
+	path.len = static_cast<nat4_t>(leaf_at + stem_len);
 	if (ext) {
-		leaf = leaf + "." + ext;
+		reserve(path, path.len + 1 + ext.len, path.cos_n);
+		path.buf[path.len] = '.';
+		copy_mem(&path.buf[path.len + 1], ext.ptr, ext.len);
+		path.len += static_cast<nat4_t>(1 + ext.len);
 	}
+	path.ends[path.cos_n - 1] = path.len;
 }
 
 #ifdef __unix__
@@ -293,14 +376,32 @@ file_t::operator bool_t () const
 }
 
 file_t open_file (const path_t& path, bool_t writing, err_t& err)
+{
+	open_opts_t opts;
+	opts.writing = writing;
+	return open_file(path, opts, err);
+}
+
+file_t open_file (const path_t& path, const open_opts_t& opts, err_t& err)
 {
 	if (err) { return {}; }
 
 	#ifdef __unix__
 	const mode_t mode = S_IRWXU | S_IRGRP | S_IROTH;
-	if (int fd = open(as_strz(as_text(path)).ptr, writing ? O_RDWR | O_CREAT : O_RDONLY, mode); fd >= 0) {
+	auto flags = opts.writing ? O_RDWR | O_CREAT : O_RDONLY;
+	#ifdef __linux__
+	if (opts.direct) { flags |= O_DIRECT; }
+	#endif
+	if (int fd = open(as_strz(as_text(path)).ptr, flags, mode); fd >= 0) {
 		file_t file;
 		file.opaq = create_opaque_fd(fd);
+		if (opts.access != access_t::normal) {
+			const auto advice = opts.access == access_t::sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_RANDOM;
+			if (const auto stat = posix_fadvise(fd, 0, 0, advice); stat != 0) {
+				err = decode_os_err(stat);
+				return {};
+			}
+		}
 		return file;
 	}
 	err = decode_os_err(errno);
@@ -308,9 +409,13 @@ file_t open_file (const path_t& path, bool_t writing, err_t& err)
 	#endif
 
 	#ifdef _WIN32
-	const DWORD access = writing ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
-	if (HANDLE handle = CreateFile(as_wstr(as_text(path)).ptr, access, writing ? 0 : FILE_SHARE_READ, NULL,
-	                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL); handle != INVALID_HANDLE_VALUE) {
+	const DWORD access = opts.writing ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+	DWORD flags = FILE_ATTRIBUTE_NORMAL;
+	if (opts.direct) { flags |= FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH; }
+	if (opts.access == access_t::sequential) { flags |= FILE_FLAG_SEQUENTIAL_SCAN; }
+	if (opts.access == access_t::random) { flags |= FILE_FLAG_RANDOM_ACCESS; }
+	if (HANDLE handle = CreateFile(as_wstr(as_text(path)).ptr, access, opts.writing ? 0 : FILE_SHARE_READ, NULL,
+	                               OPEN_EXISTING, flags, NULL); handle != INVALID_HANDLE_VALUE) {
 		assert_true(handle);
 		file_t file;
 		file.opaq = create_opaque_handle(handle);
@@ -321,61 +426,208 @@ file_t open_file (const path_t& path, bool_t writing, err_t& err)
 	#endif
 }
 
-str_t read (file_t& file, nat8_t len, err_t& err)
+file_t create_scratch_file (const scratch_opts_t& opts, err_t& err)
 {
 	if (err) { return {}; }
 
-	str_t buf = create_str(len != max<decltype(len)>() ? len : 1024 * 4);
-	decltype(buf.len) i = 0;
-	while (i < buf.len) {
+	#ifdef __unix__
+	auto fd = -1;
+	#ifdef __linux__
+	if (!opts.on_disk) {
+		fd = memfd_create("scratch", MFD_CLOEXEC | (opts.sealable ? MFD_ALLOW_SEALING : 0u));
+	}
+	#ifdef O_TMPFILE
+	if (fd < 0 && !opts.sealable) { fd = open("/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR); }
+	#endif
+	#endif
+	if (fd < 0 && opts.sealable) {
+		err = create_err("Sealing needs memfd_create");
+		return {};
+	}
+	// older kernels and other unixes get a named file that's unlinked straight away
+	if (fd < 0) {
+		char buf[12];
+		copy_mem(buf, "/tmp/XXXXXX", sizeof(buf));
+		fd = mkstemp(buf);
+		if (fd >= 0) { unlink(buf); }
+	}
+	if (fd < 0) {
+		err = decode_os_err(errno);
+		return {};
+	}
+	file_t file;
+	file.opaq = create_opaque_fd(fd);
+	return file;
+	#endif
 
-		#ifdef __unix__
-		const auto stat = read(get_fd(file.opaq), &buf[i], buf.len - i);
-		if (stat < 0) {
-			err = decode_os_err(errno);
-			return {};
-		}
-		const auto red = static_cast<nat8_t>(stat);
-		#endif
+	#ifdef _WIN32
+	if (opts.sealable) {
+		err = create_err("Sealing needs memfd_create");
+		return {};
+	}
+	// a temporary file stays in the cache unless memory runs short, so it's only on disk when it has to be
+	WCHAR tmp_dir[MAX_PATH + 1] = {};
+	WCHAR tmp_path[MAX_PATH + 1] = {};
+	if (!GetTempPath(sizeof(tmp_dir), tmp_dir) || !GetTempFileName(tmp_dir, TEXT("TMP"), 0, tmp_path)) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	const DWORD flags = opts.on_disk ? FILE_FLAG_DELETE_ON_CLOSE
+	                                 : FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE;
+	const auto handle = CreateFile(tmp_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_DELETE, NULL, CREATE_ALWAYS,
+	                               flags, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		err = decode_os_err(GetLastError());
+		DeleteFile(tmp_path);
+		return {};
+	}
+	file_t file;
+	file.opaq = create_opaque_handle(handle);
+	return file;
+	#endif
+}
 
-		#ifdef _WIN32
-		const auto rd_len = static_cast<DWORD>(clamp(buf.len - i, 0, max<DWORD>()));
-		DWORD stat = 0;
-		if (!ReadFile(get_handle(file.opaq), &buf[i], rd_len, &stat, NULL)) {
-			err = decode_os_err(GetLastError());
-			return {};
+void_t seal (file_t& file, err_t& err)
+{
+	if (err) { return; }
+
+	#ifdef __linux__
+	const auto seals = F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+	if (fcntl(get_fd(file.opaq), F_ADD_SEALS, seals) == 0) { return; }
+	err = decode_os_err(errno);
+	#else
+	unused(file);
+	err = create_err("Sealing needs memfd_create");
+	#endif
+}
+
+nat8_t read_some (file_t& file, void_t* ptr, nat8_t len, err_t& err)
+{
+	if (err) { return {}; }
+
+	#ifdef __unix__
+	const auto stat = read(get_fd(file.opaq), ptr, len);
+	if (stat < 0) {
+		err = decode_os_err(errno);
+		return {};
+	}
+	const auto red = static_cast<nat8_t>(stat);
+	#endif
+
+	#ifdef _WIN32
+	const auto rd_len = static_cast<DWORD>(clamp(len, 0, max<DWORD>()));
+	DWORD stat = 0;
+	if (!ReadFile(get_handle(file.opaq), ptr, rd_len, &stat, NULL)) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	const auto red = static_cast<nat8_t>(stat);
+	#endif
+
+	assert_lteq(red, len);
+	return red;
+}
+
+nat8_t read_len (file_t& file, err_t& err)
+{
+	if (err) { return {}; }
+
+	#ifdef __unix__
+	struct stat st = {};
+	if (fstat(get_fd(file.opaq), &st) != 0) {
+		err = decode_os_err(errno);
+		return {};
+	}
+	// procfs and sysfs report their files as empty
+	if (!S_ISREG(st.st_mode) || st.st_size <= 0) { return max<nat8_t>(); }
+	const auto at = lseek(get_fd(file.opaq), 0, SEEK_CUR);
+	if (at < 0) { return max<nat8_t>(); }
+	return st.st_size > at ? static_cast<nat8_t>(st.st_size - at) : 0;
+	#endif
+
+	#ifdef _WIN32
+	if (GetFileType(get_handle(file.opaq)) != FILE_TYPE_DISK) { return max<nat8_t>(); }
+	LARGE_INTEGER size = {};
+	LARGE_INTEGER at = {};
+	if (!GetFileSizeEx(get_handle(file.opaq), &size) ||
+	    !SetFilePointerEx(get_handle(file.opaq), at, &at, FILE_CURRENT)) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	return size.QuadPart > at.QuadPart ? static_cast<nat8_t>(size.QuadPart - at.QuadPart) : 0;
+	#endif
+}
+
+str_t read_all (file_t& file, err_t& err)
+{
+	const auto known_len = read_len(file, err);
+	if (err) { return {}; }
+
+	str_t buf;
+	nat8_t i = 0;
+	if (known_len != max<nat8_t>()) {
+		buf = create_str(known_len);
+		while (i < buf.len) {
+			const auto red = read_some(file, &buf[i], buf.len - i, err);
+			if (err) { return {}; }
+			if (red == 0) { break; }
+			i += red;
 		}
-		const auto red = static_cast<nat8_t>(rd_len);
-		#endif
+		if (i < buf.len) {
+			shrink(buf, i, buf.len - i);
+			return buf;
+		}
+
+		// only growth since the file was measured could make this succeed
+		nat1_t probe = 0;
+		const auto red = read_some(file, &probe, 1, err);
+		if (err) { return {}; }
+		if (red == 0) { return buf; }
+		grow(buf, buf.len, 1);
+		buf[i++] = probe;
+	}
 
-		assert_lteq(red, buf.len - i);
+	if (buf.len < 1024 * 4) { grow(buf, buf.len, 1024 * 4 - buf.len); }
+	while (true) {
+		const auto red = read_some(file, &buf[i], buf.len - i, err);
+		if (err) { return {}; }
+		if (red == 0) { break; }
 		i += red;
+		if (i == buf.len) { grow(buf, buf.len, buf.len); }
+	}
+	shrink(buf, i, buf.len - i);
+	return buf;
+}
 
-		if (len != max<decltype(len)>()) {
-			if (red == 0) {
-				err = create_err("Unexpected end of file");
-				return {};
-			}
-		} else {
-			if (red == 0) {
-				shrink(buf, i, buf.len - i);
-			} else if (i == buf.len) {
-				grow(buf, buf.len, buf.len);
-			}
+str_t read (file_t& file, nat8_t len, err_t& err)
+{
+	if (len == max<decltype(len)>()) { return read_all(file, err); }
+	if (err) { return {}; }
+
+	str_t buf = create_str(len);
+	decltype(buf.len) i = 0;
+	while (i < buf.len) {
+		const auto red = read_some(file, &buf[i], buf.len - i, err);
+		if (err) { return {}; }
+		if (red == 0) {
+			err = create_err("Unexpected end of file");
+			return {};
 		}
+		i += red;
 	}
 	return buf;
 }
 
-void_t write (file_t& file, const str_t& data, err_t& err)
+void_t write (file_t& file, const void_t* ptr, nat8_t len, err_t& err)
 {
 	if (err) { return; }
 
-	decltype(data.len) i = 0;
-	while (i < data.len) {
+	const auto data = static_cast<const nat1_t*>(ptr);
+	decltype(len) i = 0;
+	while (i < len) {
 
 		#ifdef __unix__
-		const auto stat = write(get_fd(file.opaq), &data[i], data.len - i);
+		const auto stat = write(get_fd(file.opaq), &data[i], len - i);
 		if (stat < 0) {
 			err = decode_os_err(errno);
 			return;
@@ -384,16 +636,16 @@ void_t write (file_t& file, const str_t& data, err_t& err)
 		#endif
 
 		#ifdef _WIN32
-		const auto wr_len = static_cast<DWORD>(clamp(data.len - i, 0, max<DWORD>()));
+		const auto wr_len = static_cast<DWORD>(clamp(len - i, 0, max<DWORD>()));
 		DWORD stat = 0;
 		if (!WriteFile(get_handle(file.opaq), &data[i], wr_len, &stat, NULL)) {
 			err = decode_os_err(GetLastError());
 			return;
 		}
-		const auto written = static_cast<nat8_t>(wr_len);
+		const auto written = static_cast<nat8_t>(stat);
 		#endif
 
-		assert_lteq(written, data.len - i);
+		assert_lteq(written, len - i);
 		i += written;
 		assert_gt(written, 0);
 		if (written == 0) {
@@ -403,6 +655,11 @@ void_t write (file_t& file, const str_t& data, err_t& err)
 	}
 }
 
+void_t write (file_t& file, const str_t& data, err_t& err)
+{
+	write(file, data.ptr, data.len, err);
+}
+
 void_t set_cursor (file_t& file, nat8_t at, err_t& err)
 {
 	if (err) { return; }
@@ -422,91 +679,717 @@ void_t set_cursor (file_t& file, nat8_t at, err_t& err)
 	#endif
 }
 
-date_t read_last_mod (file_t& file, err_t& err)
+void_t sync (file_t& file, err_t& err)
 {
-	#ifdef __unix__
-	date_t create_date (const timespec& ts);
-
-	if (struct stat st = {}; fstat(get_fd(file.opaq), &st) == 0) { return create_date(st.st_mtim); }
+	if (err) { return; }
 
+	#ifdef __unix__
+	if (fsync(get_fd(file.opaq)) == 0) { return; }
 	err = decode_os_err(errno);
-	return {};
 	#endif
 
 	#ifdef _WIN32
-	date_t create_date (const FILETIME& file);
-
-	if (FILETIME ft = {}; GetFileTime(get_handle(file.opaq), NULL, NULL, &ft)) { return create_date(ft); }
-
+	if (FlushFileBuffers(get_handle(file.opaq))) { return; }
 	err = decode_os_err(GetLastError());
-	return {};
 	#endif
 }
 
-void_t write_last_mod (file_t& file, const date_t& date, err_t& err)
+void_t read_ahead (file_t& file, nat8_t at, nat8_t len, err_t& err)
 {
-	#ifdef __unix__
-	timespec as_timespec (date_t date);
-	timespec create_omission_timespec (void);
-
-	if (timespec times[2] = {create_omission_timespec(), as_timespec(date)};
-	    futimens(get_fd(file.opaq), times) == 0) { return; }
+	if (err) { return; }
 
+	#ifdef __unix__
+	assert_lteq(at, max<off_t>());
+	assert_lteq(len, max<off_t>());
+	#ifdef __linux__
+	// readahead starts the reads there and then, rather than whenever the hint gets looked at
+	if (readahead(get_fd(file.opaq), static_cast<off_t>(at), len) == 0) { return; }
 	err = decode_os_err(errno);
+	#else
+	if (const auto stat = posix_fadvise(get_fd(file.opaq), static_cast<off_t>(at), static_cast<off_t>(len),
+	                                    POSIX_FADV_WILLNEED); stat != 0) {
+		err = decode_os_err(stat);
+	}
+	#endif
 	#endif
 
 	#ifdef _WIN32
-	FILETIME as_filetime (date_t date);
+	unused(file);
+	unused(at);
+	unused(len);
+	#endif
+}
 
-	if (FILETIME fn = as_filetime(date); SetFileTime(get_handle(file.opaq), NULL, NULL, &fn)) { return; }
+void_t drop_cache (file_t& file, nat8_t at, nat8_t len, err_t& err)
+{
+	if (err) { return; }
 
-	err = decode_os_err(GetLastError());
+	#ifdef __unix__
+	assert_lteq(at, max<off_t>());
+	assert_lteq(len, max<off_t>());
+	if (const auto stat = posix_fadvise(get_fd(file.opaq), static_cast<off_t>(at), static_cast<off_t>(len),
+	                                    POSIX_FADV_DONTNEED); stat != 0) {
+		err = decode_os_err(stat);
+	}
+	#endif
+
+	#ifdef _WIN32
+	unused(file);
+	unused(at);
+	unused(len);
 	#endif
 }
 
-define_test(path, "text")
+nat8_t read_at (file_t& file, nat8_t at, void_t* ptr, nat8_t len, err_t& err)
 {
-	{ auto p = create_path("");
-		prove_eq(p.cos.len, 0);
-		prove_same(as_text(p), "");
+	if (err) { return {}; }
+
+	nat8_t i = 0;
+	while (i < len) {
+		auto dst = static_cast<nat1_t*>(ptr) + i;
+
+		#ifdef __unix__
+		assert_lteq(at + i, max<off_t>());
+		const auto stat = pread(get_fd(file.opaq), dst, len - i, static_cast<off_t>(at + i));
+		if (stat < 0) {
+			err = decode_os_err(errno);
+			return {};
+		}
+		const auto red = static_cast<nat8_t>(stat);
+		#endif
+
+		#ifdef _WIN32
+		OVERLAPPED ov = {};
+		ov.Offset     = static_cast<DWORD>(at + i);
+		ov.OffsetHigh = static_cast<DWORD>((at + i) >> 32);
+		DWORD red = 0;
+		if (!ReadFile(get_handle(file.opaq), dst, static_cast<DWORD>(clamp(len - i, 0, max<DWORD>())), &red, &ov)) {
+			if (GetLastError() != ERROR_HANDLE_EOF) {
+				err = decode_os_err(GetLastError());
+				return {};
+			}
+		}
+		#endif
+
+		if (red == 0) { break; }
+		i += red;
 	}
-	{ auto p = create_path("/");
-		prove_eq(p.cos.len, 1);
-		prove_same(p.cos[0], "");
-		prove_same(as_text(p, "/"), "/");
+	return i;
+}
+
+str_t read_at (file_t& file, nat8_t at, nat8_t len, err_t& err)
+{
+	if (err) { return {}; }
+
+	auto buf = create_str(len);
+	if (read_at(file, at, buf.ptr, buf.len, err) != len) {
+		if (!err) { err = create_err("Unexpected end of file"); }
+		return {};
+	}
+	return buf;
+}
+
+void_t write_at (file_t& file, nat8_t at, const void_t* ptr, nat8_t len, err_t& err)
+{
+	if (err) { return; }
+
+	nat8_t i = 0;
+	while (i < len) {
+		const auto src = static_cast<const nat1_t*>(ptr) + i;
+
+		#ifdef __unix__
+		assert_lteq(at + i, max<off_t>());
+		const auto stat = pwrite(get_fd(file.opaq), src, len - i, static_cast<off_t>(at + i));
+		if (stat < 0) {
+			err = decode_os_err(errno);
+			return;
+		}
+		const auto written = static_cast<nat8_t>(stat);
+		#endif
+
+		#ifdef _WIN32
+		OVERLAPPED ov = {};
+		ov.Offset     = static_cast<DWORD>(at + i);
+		ov.OffsetHigh = static_cast<DWORD>((at + i) >> 32);
+		DWORD written = 0;
+		if (!WriteFile(get_handle(file.opaq), src, static_cast<DWORD>(clamp(len - i, 0, max<DWORD>())), &written, &ov)) {
+			err = decode_os_err(GetLastError());
+			return;
+		}
+		#endif
+
+		if (written == 0) {
+			err = create_err("End of file");
+			return;
+		}
+		i += written;
+	}
+}
+
+void_t write_at (file_t& file, nat8_t at, const str_t& data, err_t& err)
+{
+	write_at(file, at, data.ptr, data.len, err);
+}
+
+// steps past len bytes of bufs, starting from byte buf_at of bufs[buf_i], and past any empty bufs after
+template<typename el_t> void_t skip_bufs (const view_t<view_t<el_t>>& bufs, nat8_t& buf_i, nat8_t& buf_at, nat8_t len)
+{
+	while (buf_i < bufs.len) {
+		const auto left = bufs[buf_i].len - buf_at;
+		if (len < left) {
+			buf_at += len;
+			return;
+		}
+		len -= left;
+		++buf_i;
+		buf_at = 0;
+	}
+	assert_eq(len, 0);
+}
+
+#ifdef __unix__
+const nat8_t iovs_cap = 64;
+
+template<typename el_t> int fill_iovs (iovec* iovs, const view_t<view_t<el_t>>& bufs, nat8_t buf_i, nat8_t buf_at)
+{
+	int iovs_n = 0;
+	for (auto i = buf_i; i < bufs.len && iovs_n < static_cast<int>(iovs_cap); ++i) {
+		const auto skip = i == buf_i ? buf_at : 0;
+		iovs[iovs_n].iov_base = const_cast<nat1_t*>(bufs[i].ptr + skip);
+		iovs[iovs_n].iov_len  = bufs[i].len - skip;
+		++iovs_n;
+	}
+	return iovs_n;
+}
+#endif
+
+nat8_t read_at (file_t& file, nat8_t at, const view_t<view_t<nat1_t>>& bufs, err_t& err)
+{
+	if (err) { return {}; }
+
+	nat8_t i = 0;
+	nat8_t buf_i = 0;
+	nat8_t buf_at = 0;
+	skip_bufs(bufs, buf_i, buf_at, 0);
+	while (buf_i < bufs.len) {
+
+		#ifdef __unix__
+		iovec iovs[iovs_cap];
+		const auto iovs_n = fill_iovs(iovs, bufs, buf_i, buf_at);
+		assert_lteq(at + i, max<off_t>());
+		const auto stat = preadv(get_fd(file.opaq), iovs, iovs_n, static_cast<off_t>(at + i));
+		if (stat < 0) {
+			err = decode_os_err(errno);
+			return {};
+		}
+		const auto red = static_cast<nat8_t>(stat);
+		#endif
+
+		#ifdef _WIN32
+		// ReadFileScatter only takes unbuffered handles and whole pages, so go a buffer at a time
+		const auto red = read_at(file, at + i, bufs[buf_i].ptr + buf_at, bufs[buf_i].len - buf_at, err);
+		if (err) { return {}; }
+		#endif
+
+		if (red == 0) { break; }
+		i += red;
+		skip_bufs(bufs, buf_i, buf_at, red);
+	}
+	return i;
+}
+
+void_t write_at (file_t& file, nat8_t at, const view_t<view_t<const nat1_t>>& bufs, err_t& err)
+{
+	if (err) { return; }
+
+	nat8_t i = 0;
+	nat8_t buf_i = 0;
+	nat8_t buf_at = 0;
+	skip_bufs(bufs, buf_i, buf_at, 0);
+	while (buf_i < bufs.len) {
+
+		#ifdef __unix__
+		iovec iovs[iovs_cap];
+		const auto iovs_n = fill_iovs(iovs, bufs, buf_i, buf_at);
+		assert_lteq(at + i, max<off_t>());
+		const auto stat = pwritev(get_fd(file.opaq), iovs, iovs_n, static_cast<off_t>(at + i));
+		if (stat < 0) {
+			err = decode_os_err(errno);
+			return;
+		}
+		const auto written = static_cast<nat8_t>(stat);
+		if (written == 0) {
+			err = create_err("End of file");
+			return;
+		}
+		#endif
+
+		#ifdef _WIN32
+		const auto written = bufs[buf_i].len - buf_at;
+		write_at(file, at + i, bufs[buf_i].ptr + buf_at, written, err);
+		if (err) { return; }
+		#endif
+
+		i += written;
+		skip_bufs(bufs, buf_i, buf_at, written);
+	}
+}
+
+#ifdef __linux__
+// struct file_clone_range and the FICLONERANGE ioctl, which older headers don't have
+struct clone_range_t
+{
+	int64_t src_fd      {};
+	nat8_t  src_offset  {};
+	nat8_t  src_length  {};
+	nat8_t  dest_offset {};
+};
+const unsigned long clone_range_ioctl = _IOW(0x94, 13, clone_range_t);
+#endif
+
+nat8_t copy_file (file_t& src, nat8_t src_at, file_t& dst, nat8_t dst_at, nat8_t len, err_t& err)
+{
+	if (err) { return {}; }
+
+	#ifdef __unix__
+	struct stat st = {};
+	if (fstat(get_fd(src.opaq), &st) != 0) {
+		err = decode_os_err(errno);
+		return {};
+	}
+	const auto src_len = static_cast<nat8_t>(st.st_size);
+	#endif
+
+	#ifdef _WIN32
+	LARGE_INTEGER size = {};
+	if (!GetFileSizeEx(get_handle(src.opaq), &size)) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	const auto src_len = static_cast<nat8_t>(size.QuadPart);
+	#endif
+
+	if (src_at >= src_len) { return 0; }
+	if (len > src_len - src_at) { len = src_len - src_at; }
+
+	nat8_t i = 0;
+
+	#ifdef __linux__
+	// sharing the extents is all that's needed on btrfs and xfs, when the range lines up with their blocks
+	clone_range_t range;
+	range.src_fd      = get_fd(src.opaq);
+	range.src_offset  = src_at;
+	range.src_length  = len;
+	range.dest_offset = dst_at;
+	if (ioctl(get_fd(dst.opaq), clone_range_ioctl, &range) == 0) { return len; }
+
+	// then the kernel copies, server side on nfs and smb
+	while (i < len) {
+		auto src_off = static_cast<loff_t>(src_at + i);
+		auto dst_off = static_cast<loff_t>(dst_at + i);
+		const auto stat = syscall(SYS_copy_file_range, get_fd(src.opaq), &src_off, get_fd(dst.opaq), &dst_off,
+		                          len - i, 0);
+		if (stat < 0) {
+			// across file systems before 5.3, or not at all before 4.5
+			if (i == 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) { break; }
+			err = decode_os_err(errno);
+			return i;
+		}
+		if (stat == 0) { return i; }
+		i += static_cast<nat8_t>(stat);
+	}
+	if (i == len) { return i; }
+	#endif
+
+	auto buf = create_str(len - i < 1024 * 1024 ? len - i : 1024 * 1024);
+	while (i < len) {
+		const auto chunk_len = len - i < buf.len ? len - i : buf.len;
+		const auto red = read_at(src, src_at + i, buf.ptr, chunk_len, err);
+		write_at(dst, dst_at + i, buf.ptr, red, err);
+		if (err || red == 0) { break; }
+		i += red;
+	}
+	return i;
+}
+
+#ifdef _WIN32
+void_t set_file_len (HANDLE handle, nat8_t len, err_t& err)
+{
+	FILE_END_OF_FILE_INFO info = {};
+	info.EndOfFile.QuadPart = static_cast<LONGLONG>(len);
+	if (SetFileInformationByHandle(handle, FileEndOfFileInfo, &info, sizeof(info))) { return; }
+	err = decode_os_err(GetLastError());
+}
+#endif
+
+void_t reserve_space (file_t& file, nat8_t at, nat8_t len, bool_t keep_len, err_t& err)
+{
+	if (err || !len) { return; }
+
+	#ifdef __unix__
+	assert_lteq(at + len, max<off_t>());
+	#ifdef __linux__
+	if (fallocate(get_fd(file.opaq), keep_len ? FALLOC_FL_KEEP_SIZE : 0, static_cast<off_t>(at),
+	              static_cast<off_t>(len)) == 0) { return; }
+	if (errno != EOPNOTSUPP || keep_len) {
+		err = decode_os_err(errno);
+		return;
+	}
+	#else
+	if (keep_len) {
+		err = create_err("Space can only be reserved past the end of a file on linux");
+		return;
+	}
+	#endif
+	// glibc writes zeros where the file system can't allocate
+	if (const auto stat = posix_fallocate(get_fd(file.opaq), static_cast<off_t>(at), static_cast<off_t>(len));
+	    stat != 0) {
+		err = decode_os_err(stat);
+	}
+	#endif
+
+	#ifdef _WIN32
+	LARGE_INTEGER size = {};
+	if (!GetFileSizeEx(get_handle(file.opaq), &size)) {
+		err = decode_os_err(GetLastError());
+		return;
+	}
+	// the allocation covers the whole file, so it can only ever grow it
+	const auto end = static_cast<LONGLONG>(at + len);
+	if (end <= size.QuadPart) { return; }
+	FILE_ALLOCATION_INFO info = {};
+	info.AllocationSize.QuadPart = end;
+	if (!SetFileInformationByHandle(get_handle(file.opaq), FileAllocationInfo, &info, sizeof(info))) {
+		err = decode_os_err(GetLastError());
+		return;
+	}
+	if (!keep_len) { set_file_len(get_handle(file.opaq), at + len, err); }
+	#endif
+}
+
+void_t punch_hole (file_t& file, nat8_t at, nat8_t len, err_t& err)
+{
+	if (err || !len) { return; }
+
+	#ifdef __unix__
+	assert_lteq(at + len, max<off_t>());
+	#ifdef __linux__
+	if (fallocate(get_fd(file.opaq), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(at),
+	              static_cast<off_t>(len)) == 0) { return; }
+	err = decode_os_err(errno);
+	#else
+	err = create_err("Holes can only be punched on linux");
+	#endif
+	#endif
+
+	#ifdef _WIN32
+	DWORD ret_len = 0;
+	FILE_SET_SPARSE_BUFFER sparse = {};
+	sparse.SetSparse = TRUE;
+	FILE_ZERO_DATA_INFORMATION zero = {};
+	zero.FileOffset.QuadPart      = static_cast<LONGLONG>(at);
+	zero.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(at + len);
+	if (DeviceIoControl(get_handle(file.opaq), FSCTL_SET_SPARSE, &sparse, sizeof(sparse), NULL, 0, &ret_len, NULL) &&
+	    DeviceIoControl(get_handle(file.opaq), FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), NULL, 0, &ret_len, NULL)) {
+		return;
+	}
+	err = decode_os_err(GetLastError());
+	#endif
+}
+
+void_t truncate (file_t& file, nat8_t len, err_t& err)
+{
+	if (err) { return; }
+
+	#ifdef __unix__
+	assert_lteq(len, max<off_t>());
+	if (ftruncate(get_fd(file.opaq), static_cast<off_t>(len)) == 0) { return; }
+	err = decode_os_err(errno);
+	#endif
+
+	#ifdef _WIN32
+	set_file_len(get_handle(file.opaq), len, err);
+	#endif
+}
+
+nat8_t copy_sparse (file_t& src, file_t& dst, err_t& err)
+{
+	if (err) { return {}; }
+
+	#ifdef __unix__
+	struct stat st = {};
+	if (fstat(get_fd(src.opaq), &st) != 0) {
+		err = decode_os_err(errno);
+		return {};
+	}
+	const auto src_len = static_cast<nat8_t>(st.st_size);
+	// emptied first, so whatever dst held reads as zeros where src has holes
+	truncate(dst, 0, err);
+	truncate(dst, src_len, err);
+
+	// seeking for data and holes moves the cursor, which the caller shouldn't see
+	const auto cursor = lseek(get_fd(src.opaq), 0, SEEK_CUR);
+	nat8_t copied = 0;
+	off_t at = 0;
+	while (!err && static_cast<nat8_t>(at) < src_len) {
+		const auto data_at = lseek(get_fd(src.opaq), at, SEEK_DATA);
+		if (data_at < 0) {
+			// nothing but a hole from here on
+			if (errno == ENXIO) { break; }
+			// and file systems that don't track holes count as all data
+			if (errno == EINVAL && at == 0) {
+				copied = copy_file(src, 0, dst, 0, max<nat8_t>(), err);
+				break;
+			}
+			err = decode_os_err(errno);
+			break;
+		}
+		auto hole_at = lseek(get_fd(src.opaq), data_at, SEEK_HOLE);
+		if (hole_at < 0) {
+			err = decode_os_err(errno);
+			break;
+		}
+		const auto run_len = static_cast<nat8_t>(hole_at - data_at);
+		copied += copy_file(src, static_cast<nat8_t>(data_at), dst, static_cast<nat8_t>(data_at), run_len, err);
+		at = hole_at;
+	}
+	lseek(get_fd(src.opaq), cursor, SEEK_SET);
+	return copied;
+	#endif
+
+	#ifdef _WIN32
+	// FSCTL_QUERY_ALLOCATED_RANGES would find the runs, but only on sparse files, which hardly any are
+	LARGE_INTEGER size = {};
+	if (!GetFileSizeEx(get_handle(src.opaq), &size)) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	truncate(dst, 0, err);
+	truncate(dst, static_cast<nat8_t>(size.QuadPart), err);
+	return copy_file(src, 0, dst, 0, max<nat8_t>(), err);
+	#endif
+}
+
+date_t read_last_mod (file_t& file, err_t& err)
+{
+	#ifdef __unix__
+	date_t create_date (const timespec& ts);
+
+	if (struct stat st = {}; fstat(get_fd(file.opaq), &st) == 0) { return create_date(st.st_mtim); }
+
+	err = decode_os_err(errno);
+	return {};
+	#endif
+
+	#ifdef _WIN32
+	date_t create_date (const FILETIME& file);
+
+	if (FILETIME ft = {}; GetFileTime(get_handle(file.opaq), NULL, NULL, &ft)) { return create_date(ft); }
+
+	err = decode_os_err(GetLastError());
+	return {};
+	#endif
+}
+
+void_t write_last_mod (file_t& file, const date_t& date, err_t& err)
+{
+	#ifdef __unix__
+	timespec as_timespec (date_t date);
+	timespec create_omission_timespec (void);
+
+	if (timespec times[2] = {create_omission_timespec(), as_timespec(date)};
+	    futimens(get_fd(file.opaq), times) == 0) { return; }
+
+	err = decode_os_err(errno);
+	#endif
+
+	#ifdef _WIN32
+	FILETIME as_filetime (date_t date);
+
+	if (FILETIME fn = as_filetime(date); SetFileTime(get_handle(file.opaq), NULL, NULL, &fn)) { return; }
+
+	err = decode_os_err(GetLastError());
+	#endif
+}
+
+file_map_t::file_map_t () { }
+file_map_t::~file_map_t ()
+{
+	#ifdef __unix__
+	if (ptr) { munmap(ptr, len); }
+	#endif
+	#ifdef _WIN32
+	if (ptr) { UnmapViewOfFile(ptr); }
+	if (opaq) { CloseHandle(get_handle(opaq)); }
+	#endif
+	ptr  = nullptr;
+	len  = 0;
+	opaq = {};
+}
+
+file_map_t::file_map_t (file_map_t&& ori) { *this = move(ori); }
+file_map_t& file_map_t::operator = (file_map_t&& ori)
+{
+	if (&ori != this) {
+		this->~file_map_t();
+		ptr  = ori.ptr;
+		len  = ori.len;
+		opaq = ori.opaq;
+		ori.ptr  = nullptr;
+		ori.len  = 0;
+		ori.opaq = {};
+	}
+	return *this;
+}
+
+file_map_t map_file (file_t& file, const map_opts_t& opts, err_t& err)
+{
+	if (err) { return {}; }
+
+	file_map_t map;
+
+	#ifdef __unix__
+	struct stat st = {};
+	if (fstat(get_fd(file.opaq), &st) != 0) {
+		err = decode_os_err(errno);
+		return {};
+	}
+	if (st.st_size <= 0) { return {}; }
+	map.len = static_cast<nat8_t>(st.st_size);
+
+	// read-only mappings are private as well, there being nothing to write back
+	auto flags = MAP_PRIVATE;
+	#ifdef __linux__
+	if (opts.populate) { flags |= MAP_POPULATE; }
+	#endif
+	const auto ptr = mmap(nullptr, map.len, opts.cow ? PROT_READ | PROT_WRITE : PROT_READ, flags, get_fd(file.opaq), 0);
+	if (ptr == MAP_FAILED) {
+		err = decode_os_err(errno);
+		return {};
+	}
+	map.ptr = static_cast<nat1_t*>(ptr);
+	#endif
+
+	#ifdef _WIN32
+	LARGE_INTEGER size = {};
+	if (!GetFileSizeEx(get_handle(file.opaq), &size)) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	if (size.QuadPart <= 0) { return {}; }
+	map.len = static_cast<nat8_t>(size.QuadPart);
+
+	const auto handle = CreateFileMapping(get_handle(file.opaq), NULL, opts.cow ? PAGE_WRITECOPY : PAGE_READONLY,
+	                                      0, 0, NULL);
+	if (!handle) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	map.opaq = create_opaque_handle(handle);
+	const auto ptr = MapViewOfFile(handle, opts.cow ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	if (!ptr) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	map.ptr = static_cast<nat1_t*>(ptr);
+	if (opts.populate) {
+		// touching a byte a page is the closest windows has to MAP_POPULATE
+		volatile nat1_t sink = 0;
+		for (nat8_t i = 0; i < map.len; i += 4096) { sink = sink ^ map.ptr[i]; }
+	}
+	#endif
+
+	if (opts.advice != map_advice_t::normal) {
+		advise(map, opts.advice, 0, map.len, err);
+	}
+	return map;
+}
+
+file_map_t map_file (const path_t& path, const map_opts_t& opts, err_t& err)
+{
+	auto file = open_file(path, false, err);
+	return map_file(file, opts, err);
+}
+
+view_t<const nat1_t> create_view (const file_map_t& map)
+{
+	return create_view(static_cast<const nat1_t*>(map.ptr), map.len);
+}
+
+void_t advise (file_map_t& map, map_advice_t advice, nat8_t at, nat8_t len, err_t& err)
+{
+	if (err) { return; }
+	assert_lteq(at, map.len);
+	assert_lteq(len, map.len - at);
+	if (!len) { return; }
+
+	#ifdef __unix__
+	// madvise wants a page aligned start
+	const auto page_len = static_cast<nat8_t>(sysconf(_SC_PAGESIZE));
+	const auto lead = at % page_len;
+
+	auto how = MADV_NORMAL;
+	switch (advice) {
+		case map_advice_t::normal:     how = MADV_NORMAL;     break;
+		case map_advice_t::sequential: how = MADV_SEQUENTIAL; break;
+		case map_advice_t::random:     how = MADV_RANDOM;     break;
+		case map_advice_t::willneed:   how = MADV_WILLNEED;   break;
+		case map_advice_t::dontneed:   how = MADV_DONTNEED;   break;
+	}
+	if (madvise(map.ptr + at - lead, len + lead, how) == 0) { return; }
+	err = decode_os_err(errno);
+	#endif
+
+	#ifdef _WIN32
+	// windows offers no equivalent for the access pattern hints
+	unused(map);
+	unused(advice);
+	#endif
+}
+
+define_test(path, "text")
+{
+	{ auto p = create_path("");
+		prove_eq(count_cos(p), 0);
+		prove_same(as_text(p), "");
+	}
+	{ auto p = create_path("/");
+		prove_eq(count_cos(p), 1);
+		prove_same(create_str(get_co(p, 0)), "");
+		prove_same(as_text(p, "/"), "/");
 	}
 	{ auto p = create_path("/etc/motd");
-		prove_eq(p.cos.len, 3);
-		prove_same(p.cos[0], "");
-		prove_same(p.cos[1], "etc");
-		prove_same(p.cos[2], "motd");
+		prove_eq(count_cos(p), 3);
+		prove_same(create_str(get_co(p, 0)), "");
+		prove_same(create_str(get_co(p, 1)), "etc");
+		prove_same(create_str(get_co(p, 2)), "motd");
 		prove_same(as_text(p, "+"), "+etc+motd");
 	}
 	{ auto p = create_path("./..");
-		prove_eq(p.cos.len, 2);
-		prove_same(p.cos[0], ".");
-		prove_same(p.cos[1], "..");
+		prove_eq(count_cos(p), 2);
+		prove_same(create_str(get_co(p, 0)), ".");
+		prove_same(create_str(get_co(p, 1)), "..");
 		prove_same(as_text(p, "/"), "./..");
 	}
 	{ auto p = create_path("C:\\Windows\\\\NSA_Backdoor\\");
-		prove_eq(p.cos.len, 3);
-		prove_same(p.cos[0], "C:");
-		prove_same(p.cos[1], "Windows");
-		prove_same(p.cos[2], "NSA_Backdoor");
+		prove_eq(count_cos(p), 3);
+		prove_same(create_str(get_co(p, 0)), "C:");
+		prove_same(create_str(get_co(p, 1)), "Windows");
+		prove_same(create_str(get_co(p, 2)), "NSA_Backdoor");
 		prove_same(as_text(p, "\\"), "C:\\Windows\\NSA_Backdoor");
 	}
 	{ auto p = create_path("But\\What/Am\\I");
-		prove_eq(p.cos.len, 2);
-		prove_same(p.cos[0], "But\\What");
-		prove_same(p.cos[1], "Am\\I");
+		prove_eq(count_cos(p), 2);
+		prove_same(create_str(get_co(p, 0)), "But\\What");
+		prove_same(create_str(get_co(p, 1)), "Am\\I");
 		prove_same(as_text(p, ""), "But\\WhatAm\\I");
 	}
 	{ auto p = create_path("/food/.cookies/raisin");
-		prove_eq(p.cos.len, 4);
-		prove_same(p.cos[0], "");
-		prove_same(p.cos[1], "food");
-		prove_same(p.cos[2], ".cookies");
-		prove_same(p.cos[3], "raisin");
+		prove_eq(count_cos(p), 4);
+		prove_same(create_str(get_co(p, 0)), "");
+		prove_same(create_str(get_co(p, 1)), "food");
+		prove_same(create_str(get_co(p, 2)), ".cookies");
+		prove_same(create_str(get_co(p, 3)), "raisin");
 		prove_same(as_text(p, "/"), "/food/.cookies/raisin");
 		prove_same(get_ext(p), "");
 		set_ext(p, "bits");
@@ -534,7 +1417,220 @@ define_test(path, "text")
 		prove_same(as_text(p, "/"), "");
 		prove_false(p);
 	}
+	{ auto p = create_path("/") + "usr";
+		prove_same(as_text(p, "/"), "/usr");
+		for (auto i : create_range(100)) {
+			append(p, "d" + as_text(i));
+		}
+		append(p, "");
+		prove_eq(count_cos(p), 102);
+		prove_same(create_str(get_co(p, 0)), "");
+		prove_same(create_str(get_co(p, 1)), "usr");
+		prove_same(create_str(get_leaf(p)), "d99");
+		prove_true(p == create_path(as_text(p)));
+		prove_true(get_dir(p) != p);
+		prove_true(get_dir(create_path("/usr")) == create_path("/"));
+	}
 
 	return {};
 }
 
+define_test(file, "path,error,raw")
+{
+	err_t err;
+
+	// map_file
+	{ const auto path = create_temp_path(err);
+		{ auto file = open_file(path, true, err);
+			write(file, "Hello, mapped world", err);
+		}
+		prove_same(as_text(err), "");
+
+		{ map_opts_t opts;
+			opts.populate = true;
+			opts.advice   = map_advice_t::sequential;
+			auto map = map_file(path, opts, err);
+			prove_same(as_text(err), "");
+			const auto view = create_view(map);
+			prove_eq(view.len, 19);
+			prove_same(create_str(create_view(view, 7, 6)), "mapped");
+			advise(map, map_advice_t::dontneed, 3, 10, err);
+			prove_same(as_text(err), "");
+		}
+		{ map_opts_t opts;
+			opts.cow = true;
+			auto map = map_file(path, opts, err);
+			map.ptr[0] = 'J';
+			prove_same(create_str(create_view(map)), "Jello, mapped world");
+			auto moved = move(map);
+			prove_true(moved.ptr);
+			prove_false(map.ptr);
+		}
+		{ auto file = open_file(path, false, err);
+			prove_same(read_all(file, err), "Hello, mapped world");
+		}
+
+		remove_file(path, err);
+		prove_same(as_text(err), "");
+		prove_false(map_file(path, {}, err).ptr);
+		prove_true(err);
+		err = {};
+	}
+
+	// read_all and read_len
+	{ const auto path = create_temp_path(err);
+		{ auto file = open_file(path, true, err);
+			write(file, "Hello, mapped world", err);
+		}
+		auto file = open_file(path, false, err);
+		prove_same(read(file, max<nat8_t>(), err), "Hello, mapped world");
+		set_cursor(file, 7, err);
+		prove_eq(read_len(file, err), 12);
+		prove_same(read_all(file, err), "mapped world");
+		prove_eq(read_len(file, err), 0);
+		prove_same(read_all(file, err), "");
+		remove_file(path, err);
+		prove_same(as_text(err), "");
+	}
+	#ifdef __linux__
+	{ auto file = open_file(create_path("/proc/self/status"), false, err);
+		prove_eq(read_len(file, err), max<nat8_t>());
+		prove_gt(read_all(file, err).len, 0);
+		prove_same(as_text(err), "");
+	}
+	#endif
+
+	// read_at and write_at, plain and vectored
+	{ const auto path = create_temp_path(err);
+		auto file = open_file(path, true, err);
+		const str_t head = "HEAD";
+		const str_t body = "-payload-";
+		view_t<const nat1_t> out[] = { create_view(head), {}, create_view(body) };
+		write_at(file, 100, create_view(out, 3), err);
+		prove_same(read_at(file, 104, 9, err), "-payload-");
+
+		auto got_head = create_str(4);
+		auto got_body = create_str(16);
+		view_t<nat1_t> in[] = { {}, create_view(got_head), create_view(got_body) };
+		prove_eq(read_at(file, 100, create_view(in, 3), err), 13);
+		prove_same(got_head, "HEAD");
+		prove_same(create_str(got_body.ptr, 9), "-payload-");
+		prove_eq(read_at(file, 200, got_body.ptr, got_body.len, err), 0);
+		prove_same(as_text(err), "");
+		prove_false(read_at(file, 110, 9, err));
+		prove_true(err);
+		err = {};
+		remove_file(path, err);
+		prove_same(as_text(err), "");
+	}
+
+	// copy_file
+	{ const auto path = create_temp_path(err);
+		{ auto file = open_file(path, true, err);
+			write_at(file, 0, "He", err);
+			write_at(file, 100, "HEAD-payload-", err);
+		}
+		auto src = open_file(path, false, err);
+		const auto copy_path = create_temp_path(err);
+		auto dst = open_file(copy_path, true, err);
+		prove_eq(copy_file(src, 104, dst, 2, max<nat8_t>(), err), 9);
+		prove_eq(copy_file(src, 0, dst, 0, 2, err), 2);
+		prove_eq(copy_file(src, 1000, dst, 0, 2, err), 0);
+		prove_same(read_all(dst, err), "He-payload-");
+		remove_file(copy_path, err);
+		remove_file(path, err);
+		prove_same(as_text(err), "");
+	}
+
+	// hinted and direct opens
+	{ const auto path = create_temp_path(err);
+		{ auto file = open_file(path, true, err);
+			write(file, "Hello, hinted world", err);
+		}
+		open_opts_t opts;
+		opts.access = access_t::sequential;
+		auto file = open_file(path, opts, err);
+		read_ahead(file, 0, 4096, err);
+		prove_same(read_all(file, err), "Hello, hinted world");
+		drop_cache(file, 0, 0, err);
+		prove_same(as_text(err), "");
+
+		// not every file system takes direct i/o, tmpfs for one
+		opts.direct = true;
+		auto direct = open_file(path, opts, err);
+		if (!err) {
+			auto buf = create_aligned_buf(4096, 0);
+			prove_eq(read_at(direct, 0, buf.ptr, buf.len, err), 19);
+			prove_same(create_str(buf.ptr, 5), "Hello");
+			prove_same(as_text(err), "");
+		}
+		err = {};
+		remove_file(path, err);
+		prove_same(as_text(err), "");
+	}
+
+	// reserve_space, punch_hole and copy_sparse
+	{ const auto sparse_path = create_temp_path(err);
+		auto file = open_file(sparse_path, true, err);
+		reserve_space(file, 0, 1024 * 64, true, err);
+		prove_eq(read_all(file, err).len, 0);
+		reserve_space(file, 0, 1024 * 64, false, err);
+		prove_eq(read_len(file, err), 1024 * 64);
+
+		auto data = create_str(1024 * 64);
+		for (auto i : create_range(data.len)) { data[i] = static_cast<nat1_t>(i % 251 + 1); }
+		write_at(file, 0, data, err);
+		punch_hole(file, 1024 * 16, 1024 * 16, err);
+		truncate(file, 1024 * 128, err);
+		prove_eq(read_len(file, err), 1024 * 128);
+		const auto punched = read_at(file, 1024 * 16, 1024 * 16, err);
+		prove_eq(punched[0], 0);
+		prove_eq(punched[punched.len - 1], 0);
+
+		const auto copy_path = create_temp_path(err);
+		auto copy = open_file(copy_path, true, err);
+		auto stale = create_str(1024 * 192);
+		for (auto i : create_range(stale.len)) { stale[i] = 0xFF; }
+		write_at(copy, 0, stale, err);
+		const auto copied = copy_sparse(file, copy, err);
+		prove_gteq(copied, 1024 * 48);
+		prove_lteq(copied, 1024 * 128);
+		prove_true(read_all(copy, err) == read_at(file, 0, 1024 * 128, err));
+		truncate(file, 10, err);
+		prove_eq(read_len(file, err), 10);
+		remove_file(copy_path, err);
+		remove_file(sparse_path, err);
+		prove_same(as_text(err), "");
+	}
+
+	// scratch files
+	{ auto file = create_scratch_file({}, err);
+		write(file, "kept in memory", err);
+		set_cursor(file, 0, err);
+		prove_same(read_all(file, err), "kept in memory");
+		prove_same(as_text(err), "");
+	}
+	{ scratch_opts_t opts;
+		opts.on_disk = true;
+		auto file = create_scratch_file(opts, err);
+		write_at(file, 4096, "far in", err);
+		prove_same(read_at(file, 4096, 6, err), "far in");
+		prove_same(as_text(err), "");
+	}
+	#ifdef __linux__
+	{ scratch_opts_t opts;
+		opts.sealable = true;
+		auto file = create_scratch_file(opts, err);
+		write(file, "frozen", err);
+		seal(file, err);
+		prove_same(as_text(err), "");
+		write(file, "thawed", err);
+		prove_true(err);
+		err = {};
+		prove_same(read_at(file, 0, 6, err), "frozen");
+		prove_same(as_text(err), "");
+	}
+	#endif
+
+	return {};
+}
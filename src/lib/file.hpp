@@ -2,9 +2,14 @@
 #define libcx3_file_hpp
 #include "prelude.hpp"
 
+// The components joined by the native delimiter in one buffer, with where each ends. Both seqs keep spare room past
+// len and cos_n so appending is amortized. A root is one empty component, held as the lone delimiter.
 struct path_t
 {
-	seq_t<str_t> cos {};
+	str_t         buf   {};
+	seq_t<nat4_t> ends  {};
+	nat4_t        len   {};
+	nat4_t        cos_n {};
 
 	explicit operator bool_t () const;
 };
@@ -12,6 +17,14 @@ struct path_t
 path_t create_path (const str_t& text);
 path_t clone (const path_t& path);
 path_t operator + (const path_t& path, const str_t& right);
+void_t append (path_t& path, const str_t& co); // empty components are skipped, as with +
+bool_t operator == (const path_t& left, const path_t& right);
+bool_t operator != (const path_t& left, const path_t& right);
+
+nat8_t count_cos (const path_t& path);
+view_t<const nat1_t> get_co (const path_t& path, nat8_t i);
+view_t<const nat1_t> get_leaf (const path_t& path);
+view_t<const nat1_t> get_text (const path_t& path); // with the native delimiter, and without copying
 str_t as_text (const path_t& path);
 str_t as_text (const path_t& path, const str_t& delim);
 path_t get_dir (const path_t& path);
@@ -22,6 +35,7 @@ struct err_t;
 path_t get_working_dir (err_t& err);
 void_t set_working_dir (const path_t& path, err_t& err);
 path_t create_temp_path (err_t& err);
+void_t remove_file (const path_t& path, err_t& err);
 
 struct file_t
 {
@@ -37,14 +51,105 @@ struct file_t
 	explicit operator bool_t () const;
 };
 
+enum class access_t : nat1_t
+{
+	normal     = 0,
+	sequential = 1, // reads ahead harder and drops pages behind sooner
+	random     = 2, // doesn't read ahead at all
+};
+
+struct open_opts_t
+{
+	bool_t   writing {};
+	bool_t   direct  {}; // skips the page cache, so buffers, offsets and lengths must be block aligned (aligned_buf_t)
+	access_t access  {};
+};
+
 file_t open_file (const path_t& path, bool_t writing, err_t& err);
-str_t read (file_t& file, nat8_t len, err_t& err);
+file_t open_file (const path_t& path, const open_opts_t& opts, err_t& err);
+
+struct scratch_opts_t
+{
+	bool_t on_disk  {}; // for data that might not fit in memory, though it's still never named in a directory
+	bool_t sealable {};
+};
+
+// An open file with no name that's gone once closed, in memory unless asked otherwise. Reads and writes share the
+// cursor, so set_cursor back to 0 to read what was written.
+file_t create_scratch_file (const scratch_opts_t& opts, err_t& err);
+void_t seal (file_t& file, err_t& err); // freezes a sealable scratch file's contents and length, for sharing safely
+str_t read (file_t& file, nat8_t len, err_t& err); // a len of max reads to the end, as read_all does
+str_t read_all (file_t& file, err_t& err);
+nat8_t read_len (file_t& file, err_t& err); // bytes from the cursor to the end, or max for pipes and procfs
+nat8_t read_some (file_t& file, void_t* ptr, nat8_t len, err_t& err); // one call to the os, zero at the end
+void_t write (file_t& file, const void_t* ptr, nat8_t len, err_t& err);
 void_t write (file_t& file, const str_t& data, err_t& err);
 void_t set_cursor (file_t& file, nat8_t at, err_t& err);
+void_t sync (file_t& file, err_t& err); // waits for the data to reach the disk
+
+// Hints for the page cache, which do nothing on windows. Only clean pages are dropped, so sync written ones first.
+void_t read_ahead (file_t& file, nat8_t at, nat8_t len, err_t& err);
+void_t drop_cache (file_t& file, nat8_t at, nat8_t len, err_t& err);
+
+// Positional reads and writes leave the cursor alone on unix, so threads can share one file_t. Windows does
+// move it. Reads come up short only at the end of the file.
+nat8_t read_at (file_t& file, nat8_t at, void_t* ptr, nat8_t len, err_t& err);
+str_t read_at (file_t& file, nat8_t at, nat8_t len, err_t& err);
+nat8_t read_at (file_t& file, nat8_t at, const view_t<view_t<nat1_t>>& bufs, err_t& err);
+void_t write_at (file_t& file, nat8_t at, const void_t* ptr, nat8_t len, err_t& err);
+void_t write_at (file_t& file, nat8_t at, const str_t& data, err_t& err);
+void_t write_at (file_t& file, nat8_t at, const view_t<view_t<const nat1_t>>& bufs, err_t& err);
+
+// Copies up to len bytes (max for the rest of src) between positions, as read_at and write_at do, returning how
+// many. Reflinks where the file system shares extents, then tries copy_file_range, then bounces through a buffer.
+nat8_t copy_file (file_t& src, nat8_t src_at, file_t& dst, nat8_t dst_at, nat8_t len, err_t& err);
+
+// Claims the blocks for a range up front, so big outputs don't fragment as they grow. With keep_len the file's
+// length stays as it is, and blocks past the end wait there for later writes.
+void_t reserve_space (file_t& file, nat8_t at, nat8_t len, bool_t keep_len, err_t& err);
+void_t punch_hole (file_t& file, nat8_t at, nat8_t len, err_t& err); // frees the blocks, which then read as zeros
+void_t truncate (file_t& file, nat8_t len, err_t& err); // lengthening leaves a hole
+nat8_t copy_sparse (file_t& src, file_t& dst, err_t& err); // holes stay holes, and only the data counts as copied
 
 struct date_t;
 date_t read_last_mod (file_t& file, err_t& err);
 void_t write_last_mod (file_t& file, const date_t& date, err_t& err);
 
+enum class map_advice_t : nat1_t
+{
+	normal     = 0,
+	sequential = 1,
+	random     = 2,
+	willneed   = 3,
+	dontneed   = 4,
+};
+
+struct map_opts_t
+{
+	bool_t       cow      {}; // pages are writable but changes stay private to the mapping
+	bool_t       populate {}; // fault every page in before returning
+	map_advice_t advice   {};
+};
+
+struct file_map_t
+{
+	nat1_t*  ptr  {};
+	nat8_t   len  {};
+	opaque_t opaq {};
+
+	file_map_t ();
+	~file_map_t ();
+	file_map_t (const file_map_t& ori) = delete;
+	file_map_t& operator = (const file_map_t& ori) = delete;
+	file_map_t (file_map_t&& ori);
+	file_map_t& operator = (file_map_t&& ori);
+};
+
+// The mapping stays valid after the file is closed. Empty files map to an empty view.
+file_map_t map_file (file_t& file, const map_opts_t& opts, err_t& err);
+file_map_t map_file (const path_t& path, const map_opts_t& opts, err_t& err);
+view_t<const nat1_t> create_view (const file_map_t& map); // cow mappings can also be written through ptr
+void_t advise (file_map_t& map, map_advice_t advice, nat8_t at, nat8_t len, err_t& err);
+
 #endif
 
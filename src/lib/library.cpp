@@ -30,7 +30,7 @@ void_t open (lib_t& lib, const str_t& lib_name,
 	}
 
 	#ifdef __unix__
-	if (path.cos.len == 1 && !get_ext(path)) {
+	if (count_cos(path) == 1 && !get_ext(path)) {
 		set_ext(path, "so");
 	}
 	if (auto h = dlopen(as_strz(as_text(path)).ptr, RTLD_LAZY); h) {
@@ -516,6 +516,11 @@ bool_t lzma_dec (void_t* buf_ptr, nat8_t buf_len,
 }
 
 str_t lzma_dec (const str_t& src, nat8_t dst_len)
+{
+	return lzma_dec(create_view(src), dst_len);
+}
+
+str_t lzma_dec (const view_t<const nat1_t>& src, nat8_t dst_len)
 {
 	auto buf = create_str(lzma_dec_buf_len(src.ptr, src.len));
 	if (!buf) { return {}; }
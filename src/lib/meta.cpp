@@ -0,0 +1,550 @@
+#include "meta.hpp"
+#include "file.hpp"
+#include "error.hpp"
+#include "text.hpp"
+#include "raw.hpp"
+#include "thread.hpp"
+#include "platform.hpp"
+#include "watch.hpp"
+#include "box.hpp"
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+void_t* get_ptr (opaque_t opaq);
+opaque_t create_opaque_ptr (void_t* ptr);
+nat8_t add_atomic (nat8_t& datum, nat8_t val);
+
+#ifdef __unix__
+entry_kind_t get_kind (nat8_t mode)
+{
+	if (S_ISREG(mode)) { return entry_kind_t::file; }
+	if (S_ISDIR(mode)) { return entry_kind_t::dir; }
+	if (S_ISLNK(mode)) { return entry_kind_t::link; }
+	return entry_kind_t::other;
+}
+#endif
+
+// The strz is the caller's to reuse, so a batch doesn't allocate one per path
+meta_t query_one (const path_t& path, const meta_opts_t& opts, seq_t<char>& strz, err_t& err)
+{
+	if (err) { return {}; }
+
+	meta_t meta;
+
+	#ifdef __unix__
+	date_t create_date (const timespec& ts);
+
+	const auto text = get_text(path);
+	if (strz.len < text.len + 1) { grow(strz, strz.len, text.len + 1 - strz.len); }
+	copy_mem(strz.ptr, text.ptr, text.len);
+	strz[text.len] = '\0';
+
+	const auto flags = opts.no_follow ? AT_SYMLINK_NOFOLLOW : 0;
+	#ifdef STATX_TYPE
+	unsigned int mask = STATX_TYPE;
+	if (opts.want_len) { mask |= STATX_SIZE; }
+	if (opts.want_last_mod) { mask |= STATX_MTIME; }
+	struct statx stx = {};
+	if (statx(AT_FDCWD, strz.ptr, flags, mask, &stx) != 0) {
+		if (errno != ENOENT && errno != ENOTDIR) { err = decode_os_err(errno); }
+		return meta;
+	}
+	meta.kind = get_kind(stx.stx_mode);
+	if (opts.want_len) { meta.len = stx.stx_size; }
+	if (opts.want_last_mod) {
+		timespec ts = {};
+		ts.tv_sec  = static_cast<time_t>(stx.stx_mtime.tv_sec);
+		ts.tv_nsec = static_cast<long>(stx.stx_mtime.tv_nsec);
+		meta.last_mod = create_date(ts);
+	}
+	#else
+	struct stat st = {};
+	if (fstatat(AT_FDCWD, strz.ptr, &st, flags) != 0) {
+		if (errno != ENOENT && errno != ENOTDIR) { err = decode_os_err(errno); }
+		return meta;
+	}
+	meta.kind = get_kind(st.st_mode);
+	if (opts.want_len) { meta.len = static_cast<nat8_t>(st.st_size); }
+	if (opts.want_last_mod) { meta.last_mod = create_date(st.st_mtim); }
+	#endif
+	#endif
+
+	#ifdef _WIN32
+	date_t create_date (const FILETIME& file);
+
+	// this always describes links themselves, since following them takes opening the file
+	unused(strz);
+	WIN32_FILE_ATTRIBUTE_DATA data = {};
+	if (!GetFileAttributesEx(as_wstr(as_text(path)).ptr, GetFileExInfoStandard, &data)) {
+		const auto code = GetLastError();
+		if (code != ERROR_FILE_NOT_FOUND && code != ERROR_PATH_NOT_FOUND) { err = decode_os_err(code); }
+		return meta;
+	}
+	if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+		meta.kind = entry_kind_t::link;
+	} else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+		meta.kind = entry_kind_t::dir;
+	} else {
+		meta.kind = entry_kind_t::file;
+	}
+	if (opts.want_len) { meta.len = (static_cast<nat8_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow; }
+	if (opts.want_last_mod) { meta.last_mod = create_date(data.ftLastWriteTime); }
+	#endif
+
+	meta.found = true;
+	return meta;
+}
+
+meta_t query_meta (const path_t& path, const meta_opts_t& opts, err_t& err)
+{
+	seq_t<char> strz;
+	return query_one(path, opts, strz, err);
+}
+
+struct meta_batch_t
+{
+	const seq_t<path_t>* paths    {};
+	const meta_opts_t*   opts     {};
+	seq_t<meta_t>*       metas    {};
+	nat8_t               next     {}; // the next chunk to claim
+	nat8_t               failed   {};
+	mutex_t              mutex    {};
+	sem_t                exit_sem {};
+	err_t                err      {};
+};
+
+const nat8_t meta_chunk_len = 64;
+
+void_t run_meta_worker (meta_batch_t& batch)
+{
+	seq_t<char> strz;
+	err_t err;
+	while (!add_atomic(batch.failed, 0)) {
+		const auto at = add_atomic(batch.next, meta_chunk_len) - meta_chunk_len;
+		if (at >= batch.paths->len) { break; }
+		const auto end = at + meta_chunk_len < batch.paths->len ? at + meta_chunk_len : batch.paths->len;
+		for (auto i = at; i < end && !err; ++i) {
+			(*batch.metas)[i] = query_one((*batch.paths)[i], *batch.opts, strz, err);
+		}
+		if (err) {
+			add_atomic(batch.failed, 1);
+			auto lock = acquire(batch.mutex);
+			if (!batch.err) { batch.err = move(err); }
+		}
+	}
+}
+
+void_t run_spawned_meta_worker (meta_batch_t& batch)
+{
+	run_meta_worker(batch);
+	signal(batch.exit_sem);
+}
+
+seq_t<meta_t> query_meta (const seq_t<path_t>& paths, const meta_opts_t& opts, err_t& err)
+{
+	if (err) { return {}; }
+
+	auto metas = create_seq<meta_t>(paths.len);
+	meta_batch_t batch;
+	batch.paths = &paths;
+	batch.opts  = &opts;
+	batch.metas = &metas;
+
+	// a thread costs about as much as a few hundred cached stats, so small batches stay on this one
+	nat8_t workers_n = opts.workers_n;
+	if (!workers_n) {
+		const nat8_t cpus_n = get_topology().logical_n;
+		workers_n = clamp(cpus_n, 1, 16);
+		workers_n = clamp(paths.len / 256, 1, workers_n);
+	}
+
+	nat8_t spawned_n = 0;
+	for (auto i : create_range(workers_n - 1)) {
+		unused(i);
+		err_t spawn_err;
+		spawn_thread(&run_spawned_meta_worker, batch, spawn_err);
+		if (spawn_err) { break; }
+		++spawned_n;
+	}
+	run_meta_worker(batch);
+	for (auto i : create_range(spawned_n)) {
+		unused(i);
+		wait(batch.exit_sem);
+	}
+
+	if (batch.err) {
+		err = move(batch.err);
+		return {};
+	}
+	return metas;
+}
+
+struct meta_slot_t
+{
+	path_t   path      {}; // empty when the slot is
+	meta_t   meta      {};
+	inter_t  fetched   {};
+	bool_t   fresh     {}; // meta holds an answer, and no change has been seen since
+	bool_t   covered   {}; // its directory was watched when it was fetched, so the ttl doesn't apply
+	bool_t   watched   {}; // a directory with a watch on it
+	bool_t   unwatched {}; // a directory that couldn't be watched
+	pad_t<4> padding   {};
+};
+
+struct meta_cache_state_t
+{
+	mutex_t            mutex   {};
+	meta_cache_opts_t  opts    {};
+	watcher_t          watcher {};
+	seq_t<meta_slot_t> slots   {}; // open addressing, with a power of two of them
+	nat8_t             used_n  {};
+};
+
+meta_cache_state_t& get_state (const meta_cache_t& cache)
+{
+	assert_true(cache.opaq);
+	return *static_cast<meta_cache_state_t*>(get_ptr(cache.opaq));
+}
+
+meta_cache_t::meta_cache_t () { }
+meta_cache_t::~meta_cache_t ()
+{
+	if (!opaq) { return; }
+
+	box_t<meta_cache_state_t> box;
+	acquire(box, &get_state(*this));
+	opaq = {};
+}
+
+meta_cache_t::meta_cache_t (meta_cache_t&& ori) { *this = move(ori); }
+meta_cache_t& meta_cache_t::operator = (meta_cache_t&& ori)
+{
+	if (&ori != this) {
+		this->~meta_cache_t();
+		opaq = ori.opaq;
+		ori.opaq = {};
+	}
+	return *this;
+}
+
+meta_cache_t::operator bool_t () const
+{
+	return bool_t(opaq);
+}
+
+meta_cache_t create_meta_cache (const meta_cache_opts_t& opts, err_t& err)
+{
+	if (err) { return {}; }
+
+	box_t<meta_cache_state_t> box;
+	auto& st = **box;
+	st.opts = opts;
+	if (opts.watched) {
+		st.watcher = create_watcher({}, err);
+		if (err) { return {}; }
+	}
+
+	meta_cache_t cache;
+	cache.opaq = create_opaque_ptr(release(box));
+	return cache;
+}
+
+nat8_t hash_path (const path_t& path)
+{
+	nat8_t hash = 0xCBF29CE484222325;
+	for (auto g : get_text(path)) {
+		hash = (hash ^ g) * 0x100000001B3;
+	}
+	return hash;
+}
+
+meta_slot_t* find_slot (meta_cache_state_t& st, const path_t& path)
+{
+	if (!st.slots) { return nullptr; }
+
+	const auto mask = st.slots.len - 1;
+	for (auto i = hash_path(path) & mask; st.slots[i].path; i = (i + 1) & mask) {
+		if (st.slots[i].path == path) { return &st.slots[i]; }
+	}
+	return nullptr;
+}
+
+meta_slot_t& add_slot (meta_cache_state_t& st, const path_t& path)
+{
+	if (auto slot = find_slot(st, path); slot) { return *slot; }
+
+	// kept under three quarters full, so probes stay short
+	if ((st.used_n + 1) * 4 > st.slots.len * 3) {
+		auto old = move(st.slots);
+		st.slots = create_seq<meta_slot_t>(old.len ? old.len * 2 : 64);
+		const auto mask = st.slots.len - 1;
+		for (auto& slot : old) {
+			if (!slot.path) { continue; }
+			auto i = hash_path(slot.path) & mask;
+			while (st.slots[i].path) { i = (i + 1) & mask; }
+			st.slots[i] = move(slot);
+		}
+	}
+
+	const auto mask = st.slots.len - 1;
+	auto i = hash_path(path) & mask;
+	while (st.slots[i].path) { i = (i + 1) & mask; }
+	st.slots[i].path = clone(path);
+	++st.used_n;
+	return st.slots[i];
+}
+
+void_t mark_stale (meta_cache_state_t& st, const path_t& path)
+{
+	if (auto slot = find_slot(st, path); slot) { slot->fresh = false; }
+}
+
+void_t mark_all_stale (meta_cache_state_t& st)
+{
+	for (auto& slot : st.slots) {
+		slot.fresh = false;
+	}
+}
+
+// A watched directory that's been removed has lost its watch, and one that's been moved has a watch that follows it
+// somewhere else, so it's watched afresh next time, and what's under it can't count on the old one meanwhile. The
+// watcher merges a removal and a recreation into a modification, so any change to the directory itself counts.
+void_t drop_watch (meta_cache_state_t& st, const path_t& dir)
+{
+	auto dir_slot = find_slot(st, dir);
+	if (!dir_slot || (!dir_slot->watched && !dir_slot->unwatched)) { return; }
+
+	dir_slot->watched   = false;
+	dir_slot->unwatched = false;
+	for (auto& slot : st.slots) {
+		if (!slot.path || count_cos(slot.path) < 2 || get_dir(slot.path) != dir) { continue; }
+		slot.fresh   = false;
+		slot.covered = false;
+	}
+}
+
+// A change to an entry touches its directory too, whose own meta then goes stale
+void_t take_changes (meta_cache_state_t& st)
+{
+	if (!st.watcher) { return; }
+
+	err_t err;
+	const auto changes = recv(st.watcher, err);
+	if (err) {
+		mark_all_stale(st);
+		return;
+	}
+	for (const auto& change : changes) {
+		if (change.kind == change_kind_t::overflow) {
+			mark_all_stale(st);
+			return;
+		}
+		mark_stale(st, change.path);
+		mark_stale(st, get_dir(change.path));
+		drop_watch(st, change.path);
+	}
+}
+
+// Relative leaves have no directory of their own to watch, so they're left to the ttl
+bool_t cover (meta_cache_state_t& st, const path_t& path)
+{
+	if (!st.watcher || count_cos(path) < 2) { return false; }
+
+	const auto dir = get_dir(path);
+	auto& slot = add_slot(st, dir);
+	if (!slot.watched && !slot.unwatched) {
+		err_t err;
+		watch(st.watcher, dir, false, err);
+		slot.watched   = !err;
+		slot.unwatched = bool_t(err);
+	}
+	return slot.watched;
+}
+
+bool_t is_hit (const meta_cache_state_t& st, const meta_slot_t& slot, inter_t now)
+{
+	if (!slot.fresh) { return false; }
+	if (slot.covered || st.opts.ttl == inter_t()) { return true; }
+	return now - slot.fetched < st.opts.ttl;
+}
+
+meta_t query_meta (meta_cache_t& cache, const path_t& path, err_t& err)
+{
+	if (err) { return {}; }
+
+	seq_t<path_t> paths;
+	grow(paths, 0, 1);
+	paths[0] = clone(path);
+	auto metas = query_meta(cache, paths, err);
+	if (err) { return {}; }
+	return metas[0];
+}
+
+seq_t<meta_t> query_meta (meta_cache_t& cache, const seq_t<path_t>& paths, err_t& err)
+{
+	if (err) { return {}; }
+
+	auto& st = get_state(cache);
+	auto metas = create_seq<meta_t>(paths.len);
+	seq_t<nat8_t> miss_is;
+	seq_t<path_t> misses;
+	seq_t<bool_t> covered;
+
+	// watches go on before the queries, so no change can slip in between
+	{ auto lock = acquire(st.mutex);
+		take_changes(st);
+		const auto now = get_current_inter();
+		for (auto i : create_range(paths.len)) {
+			if (!paths[i]) { continue; }
+			if (auto slot = find_slot(st, paths[i]); slot && is_hit(st, *slot, now)) {
+				metas[i] = slot->meta;
+				continue;
+			}
+			grow(miss_is, miss_is.len, 1);
+			miss_is[miss_is.len - 1] = i;
+			grow(covered, covered.len, 1);
+			covered[covered.len - 1] = cover(st, paths[i]);
+		}
+	}
+	if (!miss_is) { return metas; }
+
+	misses = create_seq<path_t>(miss_is.len);
+	for (auto i : create_range(miss_is.len)) {
+		misses[i] = clone(paths[miss_is[i]]);
+	}
+	const auto fetched = get_current_inter();
+	auto found = query_meta(misses, st.opts.opts, err);
+	if (err) { return {}; }
+
+	{ auto lock = acquire(st.mutex);
+		for (auto i : create_range(miss_is.len)) {
+			metas[miss_is[i]] = found[i];
+			auto& slot = add_slot(st, misses[i]);
+			slot.meta    = found[i];
+			slot.fetched = fetched;
+			slot.fresh   = true;
+			slot.covered = covered[i];
+		}
+		// anything that changed while the queries ran may have been missed by them
+		take_changes(st);
+	}
+	return metas;
+}
+
+void_t forget (meta_cache_t& cache, const path_t& path)
+{
+	auto& st = get_state(cache);
+	auto lock = acquire(st.mutex);
+	mark_stale(st, path);
+}
+
+void_t forget_all (meta_cache_t& cache)
+{
+	auto& st = get_state(cache);
+	auto lock = acquire(st.mutex);
+	mark_all_stale(st);
+}
+
+define_test(meta, "path,dir,watch,thread")
+{
+	err_t err;
+	auto dir = create_temp_path(err);
+	remove_file(dir, err);
+	create_dir(dir, err);
+
+	seq_t<path_t> paths;
+	for (auto i : create_range(600)) {
+		grow(paths, paths.len, 1);
+		paths[paths.len - 1] = dir + ("f" + as_text(i));
+		auto file = open_file(paths[paths.len - 1], true, err);
+		write(file, create_str(i % 7), err);
+	}
+	grow(paths, paths.len, 1);
+	paths[paths.len - 1] = dir + "missing";
+	prove_same(as_text(err), "");
+
+	meta_opts_t opts;
+	opts.want_len = true;
+	opts.want_last_mod = true;
+	for (nat4_t workers_n = 1; workers_n <= 4; workers_n += 3) {
+		opts.workers_n = workers_n;
+		const auto metas = query_meta(paths, opts, err);
+		prove_same(as_text(err), "");
+		prove_eq(metas.len, paths.len);
+		for (auto i : create_range(600)) {
+			prove_true(metas[i].found);
+			prove_eq(static_cast<nat8_t>(metas[i].kind), static_cast<nat8_t>(entry_kind_t::file));
+			prove_eq(metas[i].len, i % 7);
+			prove_true(metas[i].last_mod > date_t());
+		}
+		prove_false(metas[600].found);
+	}
+	{ const auto meta = query_meta(dir, {}, err);
+		prove_eq(static_cast<nat8_t>(meta.kind), static_cast<nat8_t>(entry_kind_t::dir));
+		prove_eq(meta.len, 0);
+	}
+	query_meta(dir + "f1" + "under", {}, err);
+	prove_same(as_text(err), "");
+
+	// the unwatched cache keeps its answer until told to forget it
+	meta_cache_opts_t cache_opts;
+	cache_opts.opts.want_len = true;
+	{ auto cache = create_meta_cache(cache_opts, err);
+		prove_eq(query_meta(cache, paths, err).len, paths.len);
+		{ auto file = open_file(paths[3], true, err);
+			write(file, "grown", err);
+		}
+		prove_eq(query_meta(cache, paths[3], err).len, 3);
+		forget(cache, paths[3]);
+		prove_eq(query_meta(cache, paths[3], err).len, 5);
+	}
+	prove_same(as_text(err), "");
+
+	cache_opts.watched = true;
+	{ auto cache = create_meta_cache(cache_opts, err);
+		prove_false(query_meta(cache, paths[600], err).found);
+		prove_eq(query_meta(cache, paths[4], err).len, 4);
+		{ auto file = open_file(paths[600], true, err); }
+		{ auto file = open_file(paths[4], true, err);
+			write(file, "longer", err);
+		}
+		prove_true(query_meta(cache, paths[600], err).found);
+		prove_eq(query_meta(cache, paths[4], err).len, 6);
+
+		// a directory that's gone and come back is watched again, rather than trusted on the strength of its old watch
+		const auto sub = dir + "sub";
+		create_dir(sub, err);
+		{ auto file = open_file(sub + "x", true, err);
+			write(file, "abc", err);
+		}
+		prove_eq(query_meta(cache, sub + "x", err).len, 3);
+		remove_file(sub + "x", err);
+		remove_dir(sub, err);
+		create_dir(sub, err);
+		{ auto file = open_file(sub + "x", true, err);
+			write(file, "abc", err);
+		}
+		prove_eq(query_meta(cache, sub + "x", err).len, 3);
+		{ auto file = open_file(sub + "x", true, err);
+			write(file, "abcdef", err);
+		}
+		prove_eq(query_meta(cache, sub + "x", err).len, 6);
+		remove_file(sub + "x", err);
+		remove_dir(sub, err);
+	}
+	prove_same(as_text(err), "");
+
+	for (const auto& path : paths) {
+		remove_file(path, err);
+	}
+	remove_dir(dir, err);
+	prove_same(as_text(err), "");
+	return {};
+}
@@ -0,0 +1,62 @@
+#ifndef libcx3_meta_hpp
+#define libcx3_meta_hpp
+#include "prelude.hpp"
+#include "time.hpp"
+#include "dir.hpp"
+
+struct path_t;
+struct err_t;
+
+struct meta_t
+{
+	date_t       last_mod {};
+	nat8_t       len      {};
+	entry_kind_t kind     {};
+	bool_t       found    {}; // nothing at the path isn't an error, just a meta_t without this
+	pad_t<6>     padding  {};
+};
+
+// Fields left unwanted read as zero, and asking for fewer lets network file systems skip a round trip
+struct meta_opts_t
+{
+	bool_t   want_len      {};
+	bool_t   want_last_mod {};
+	bool_t   no_follow     {}; // describes links themselves, rather than what they point to
+	pad_t<1> padding       {};
+	nat4_t   workers_n     {}; // picked from the topology and the batch's size when zero
+};
+
+// One statx per path, with the batch shared out across threads. Stops at the first error other than a missing file.
+meta_t query_meta (const path_t& path, const meta_opts_t& opts, err_t& err);
+seq_t<meta_t> query_meta (const seq_t<path_t>& paths, const meta_opts_t& opts, err_t& err);
+
+struct meta_cache_opts_t
+{
+	meta_opts_t opts    {}; // for every query through the cache
+	inter_t     ttl     {}; // entries older than this are queried again, and zero keeps them until they're forgotten
+	bool_t      watched {}; // drops entries as soon as their directory reports a change, for which ttl can stay zero
+	pad_t<7>    padding {};
+};
+
+// Safe to share between threads. Watched caches fall back on the ttl for directories that can't be watched.
+struct meta_cache_t
+{
+	opaque_t opaq {};
+
+	meta_cache_t ();
+	~meta_cache_t ();
+	meta_cache_t (const meta_cache_t& ori) = delete;
+	meta_cache_t& operator = (const meta_cache_t& ori) = delete;
+	meta_cache_t (meta_cache_t&& ori);
+	meta_cache_t& operator = (meta_cache_t&& ori);
+
+	explicit operator bool_t () const;
+};
+
+meta_cache_t create_meta_cache (const meta_cache_opts_t& opts, err_t& err);
+meta_t query_meta (meta_cache_t& cache, const path_t& path, err_t& err);
+seq_t<meta_t> query_meta (meta_cache_t& cache, const seq_t<path_t>& paths, err_t& err); // misses go as one batch
+void_t forget (meta_cache_t& cache, const path_t& path);
+void_t forget_all (meta_cache_t& cache);
+
+#endif
@@ -1,11 +1,19 @@
 #include "pipe.hpp"
 #include "error.hpp"
 #include "text.hpp"
+#include "file.hpp"
+#include "raw.hpp"
 #ifdef __unix__
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <errno.h>
 #endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -120,7 +128,7 @@ nat8_t recv (pipe_t& pipe, void_t* buf_ptr, nat8_t buf_len, err_t& err)
 
 	#ifdef _WIN32
 	DWORD red = 0;
-	if (!ReadFile(get_handle(pipe.h_out), buf_ptr, static_cast<DWORD>(buf_len), &red, NULL)) {
+	if (!ReadFile(get_handle(pipe.h_in), buf_ptr, static_cast<DWORD>(buf_len), &red, NULL)) {
 		err = decode_os_err(GetLastError());
 		return 0;
 	}
@@ -164,22 +172,437 @@ nat8_t send (pipe_t& pipe, const void_t* data_ptr, nat8_t data_len, err_t& err)
 str_t recv (pipe_t& pipe, err_t& err)
 {
 	if (err) { return {}; }
-	str_t buf = create_str(65536);
+
+	// blocking ends, like std streams, have to wait for what's coming rather than return nothing, and some of those
+	// (terminals, devices) can't say how much is waiting, so they read into a bounded buffer instead
+	#ifdef __unix__
+	int waiting = 0;
+	if (ioctl(get_fd(pipe.h_in), FIONREAD, &waiting) != 0) {
+		if (errno != ENOTTY && errno != EINVAL) {
+			err = decode_os_err(errno);
+			return {};
+		}
+		waiting = 0;
+	}
+	if (waiting <= 0 && (fcntl(get_fd(pipe.h_in), F_GETFL) & O_NONBLOCK)) { return {}; }
+	str_t buf = create_str(waiting > 0 ? static_cast<nat8_t>(waiting) : 65536);
+	#endif
+
+	#ifdef _WIN32
+	DWORD waiting = 0;
+	if (!PeekNamedPipe(get_handle(pipe.h_in), NULL, 0, NULL, &waiting, NULL)) { waiting = 0; }
+	str_t buf = create_str(waiting ? waiting : 65536);
+	#endif
+
 	const auto red = recv(pipe, buf.ptr, buf.len, err);
-	shrink(buf, red, buf.len - red);
+	if (red < buf.len) { shrink(buf, red, buf.len - red); }
 	return buf;
 }
 
 void_t send (pipe_t& pipe, const str_t& data, err_t& err)
 {
+	send_all(pipe, data.ptr, data.len, err);
+}
+
+ring_t create_ring (nat8_t len)
+{
+	nat8_t ring_len = 1;
+	while (ring_len < (len ? len : 64 * 1024)) { ring_len <<= 1; }
+
+	ring_t ring;
+	ring.buf = create_str(ring_len);
+	return ring;
+}
+
+ring_views_t get_views (const ring_t& ring)
+{
+	ring_views_t views;
+	if (!ring.len) { return views; }
+
+	const auto first_len = ring.at + ring.len <= ring.buf.len ? ring.len : ring.buf.len - ring.at;
+	views.first  = create_view(&ring.buf[ring.at], first_len);
+	views.second = create_view(static_cast<const nat1_t*>(ring.buf.ptr), ring.len - first_len);
+	return views;
+}
+
+void_t consume (ring_t& ring, nat8_t len)
+{
+	assert_lteq(len, ring.len);
+	ring.len -= len;
+	// back to the start once it's empty, which keeps the next read in one piece
+	ring.at = ring.len ? (ring.at + len) & (ring.buf.len - 1) : 0;
+}
+
+nat8_t take (ring_t& ring, void_t* ptr, nat8_t len)
+{
+	const auto views = get_views(ring);
+	const auto first_len = len < views.first.len ? len : views.first.len;
+	const auto second_len = len - first_len < views.second.len ? len - first_len : views.second.len;
+	copy_mem(ptr, views.first.ptr, first_len);
+	copy_mem(static_cast<nat1_t*>(ptr) + first_len, views.second.ptr, second_len);
+	consume(ring, first_len + second_len);
+	return first_len + second_len;
+}
+
+nat8_t recv (pipe_t& pipe, ring_t& ring, err_t& err)
+{
+	if (err) { return 0; }
+
+	const auto free_len = ring.buf.len - ring.len;
+	if (!free_len) { return 0; }
+	const auto end = (ring.at + ring.len) & (ring.buf.len - 1);
+	const auto first_len = end + free_len <= ring.buf.len ? free_len : ring.buf.len - end;
+
+	#ifdef __unix__
+	iovec iovs[2] = {};
+	iovs[0].iov_base = &ring.buf[end];
+	iovs[0].iov_len  = first_len;
+	iovs[1].iov_base = ring.buf.ptr;
+	iovs[1].iov_len  = free_len - first_len;
+	const auto stat = readv(get_fd(pipe.h_in), iovs, first_len < free_len ? 2 : 1);
+	if (stat < 0) {
+		static_assert(EAGAIN == EWOULDBLOCK);
+		if (errno != EAGAIN) { err = decode_os_err(errno); }
+		return 0;
+	}
+	const auto red = static_cast<nat8_t>(stat);
+	#endif
+
+	#ifdef _WIN32
+	// there's no readv for pipes, so the part past the wrap is only read if more is already waiting
+	auto red = recv(pipe, &ring.buf[end], first_len, err);
+	DWORD waiting = 0;
+	if (red == first_len && first_len < free_len &&
+		PeekNamedPipe(get_handle(pipe.h_in), NULL, 0, NULL, &waiting, NULL) && waiting) {
+		red += recv(pipe, ring.buf.ptr, waiting < free_len - first_len ? waiting : free_len - first_len, err);
+	}
+	#endif
+
+	ring.len += red;
+	return red;
+}
+
+#ifdef __unix__
+// pipes from pipe_create don't block, so they're polled before each call, for up to wait_ms (-1 for no limit)
+void_t wait_for_fd (opaque_t opaq, short events, int wait_ms, err_t& err)
+{
+	if (err) { return; }
+
+	pollfd pfd = {};
+	pfd.fd = get_fd(opaq);
+	pfd.events = events;
+	while (poll(&pfd, 1, wait_ms) < 0) {
+		if (errno == EINTR) { continue; }
+		err = decode_os_err(errno);
+		return;
+	}
+}
+
+void_t wait_for_fd (opaque_t opaq, short events, err_t& err)
+{
+	wait_for_fd(opaq, events, -1, err);
+}
+#endif
+
+nat8_t send_until (pipe_t& pipe, const void_t* data_ptr, nat8_t data_len, bool_t timed, inter_t deadline,
+	err_t& err)
+{
+	if (err) { return 0; }
+
+	const auto ptr = static_cast<const nat1_t*>(data_ptr);
+	nat8_t i = 0;
+	while (i < data_len) {
+		const auto sent = send(pipe, &ptr[i], data_len - i, err);
+		if (err) { return i; }
+		i += sent;
+		if (sent) { continue; }
+
+		#ifdef __unix__
+		auto wait_ms = -1;
+		if (timed) {
+			const auto now = get_current_inter();
+			if (now >= deadline) {
+				err = create_err("Timed out waiting for room in the pipe");
+				return i;
+			}
+			wait_ms = static_cast<int>(clamp(get_millisecs(deadline - now) + 1, 0, max<int>()));
+		}
+		wait_for_fd(pipe.h_out, POLLOUT, wait_ms, err);
+		#endif
+
+		#ifdef _WIN32
+		// windows pipes block, so nothing sent means nothing ever will be
+		unused(timed);
+		unused(deadline);
+		err = create_err("Couldn't send message before connection was closed");
+		return i;
+		#endif
+	}
+	return i;
+}
+
+void_t send_all (pipe_t& pipe, const void_t* data_ptr, nat8_t data_len, err_t& err)
+{
+	send_until(pipe, data_ptr, data_len, false, {}, err);
+}
+
+nat8_t send_waited (pipe_t& pipe, const void_t* data_ptr, nat8_t data_len, inter_t timeout, err_t& err)
+{
+	return send_until(pipe, data_ptr, data_len, true, get_current_inter() + timeout, err);
+}
+
+nat8_t set_pipe_capacity (pipe_t& pipe, nat8_t len, err_t& err)
+{
+	if (err) { return 0; }
+
+	#ifdef __linux__
+	const auto stat = fcntl(get_fd(pipe.h_out), F_SETPIPE_SZ, static_cast<int>(clamp(len, 0, max<int>())));
+	if (stat < 0) {
+		err = decode_os_err(errno);
+		return 0;
+	}
+	return static_cast<nat8_t>(stat);
+	#else
+	unused(pipe);
+	unused(len);
+	err = create_err("Resizing a pipe needs F_SETPIPE_SZ");
+	return 0;
+	#endif
+}
+
+void_t push (ring_t& ring, const void_t* ptr, nat8_t len)
+{
+	if (!len) { return; }
+
+	if (ring.len + len > ring.buf.len) {
+		auto neo = create_ring(ring.len + len);
+		neo.len = take(ring, neo.buf.ptr, ring.len);
+		ring = move(neo);
+	}
+	const auto end = (ring.at + ring.len) & (ring.buf.len - 1);
+	const auto first_len = end + len <= ring.buf.len ? len : ring.buf.len - end;
+	copy_mem(&ring.buf[end], ptr, first_len);
+	copy_mem(ring.buf.ptr, static_cast<const nat1_t*>(ptr) + first_len, len - first_len);
+	ring.len += len;
+}
+
+void_t send (pipe_t& pipe, ring_t& queue, const void_t* data_ptr, nat8_t data_len, err_t& err)
+{
+	if (err || !data_len) { return; }
+
+	// anything already queued has to go first, or the bytes would arrive out of order
+	if (queue.len && !flush(pipe, queue, err)) {
+		push(queue, data_ptr, data_len);
+		return;
+	}
+	const auto sent = send(pipe, data_ptr, data_len, err);
 	if (err) { return; }
-	for (nat8_t i = 0; i < data.len; ) {
-		const auto written = send(pipe, &static_cast<const nat1_t*>(data.ptr)[i], data.len - i, err);
-		if (written == 0) {
-			if (!err) { err = create_err("Couldn't send message before connection was closed"); }
-			return;
+	push(queue, static_cast<const nat1_t*>(data_ptr) + sent, data_len - sent);
+}
+
+bool_t flush (pipe_t& pipe, ring_t& queue, err_t& err)
+{
+	if (err) { return false; }
+	if (!queue.len) { return true; }
+
+	const auto views = get_views(queue);
+
+	#ifdef __unix__
+	iovec iovs[2] = {};
+	iovs[0].iov_base = const_cast<nat1_t*>(views.first.ptr);
+	iovs[0].iov_len  = views.first.len;
+	iovs[1].iov_base = const_cast<nat1_t*>(views.second.ptr);
+	iovs[1].iov_len  = views.second.len;
+	const auto stat = writev(get_fd(pipe.h_out), iovs, views.second.len ? 2 : 1);
+	if (stat < 0) {
+		static_assert(EAGAIN == EWOULDBLOCK);
+		if (errno != EAGAIN) { err = decode_os_err(errno); }
+		return false;
+	}
+	consume(queue, static_cast<nat8_t>(stat));
+	#endif
+
+	#ifdef _WIN32
+	auto sent = send(pipe, views.first.ptr, views.first.len, err);
+	if (sent == views.first.len) { sent += send(pipe, views.second.ptr, views.second.len, err); }
+	consume(queue, sent);
+	#endif
+
+	return queue.len == 0;
+}
+
+const nat8_t transfer_buf_len = 64 * 1024;
+
+nat8_t transfer (file_t& src, pipe_t& dst, nat8_t len, err_t& err)
+{
+	if (err) { return {}; }
+
+	nat8_t i = 0;
+
+	#ifdef __linux__
+	while (i < len) {
+		const auto chunk_len = len - i < 1024 * 1024 * 1024 ? len - i : 1024 * 1024 * 1024;
+		const auto stat = sendfile(get_fd(dst.h_out), get_fd(src.opaq), nullptr, chunk_len);
+		if (stat < 0) {
+			if (errno == EAGAIN) {
+				wait_for_fd(dst.h_out, POLLOUT, err);
+				if (err) { return i; }
+				continue;
+			}
+			if (i == 0 && (errno == EINVAL || errno == ENOSYS)) { break; }
+			err = decode_os_err(errno);
+			return i;
+		}
+		if (stat == 0) { return i; }
+		i += static_cast<nat8_t>(stat);
+	}
+	if (i == len) { return i; }
+	#endif
+
+	auto buf = create_str(len - i < transfer_buf_len ? len - i : transfer_buf_len);
+	while (i < len) {
+		const auto red = read_some(src, buf.ptr, len - i < buf.len ? len - i : buf.len, err);
+		if (err || red == 0) { break; }
+		for (nat8_t j = 0; j < red; ) {
+			#ifdef __unix__
+			wait_for_fd(dst.h_out, POLLOUT, err);
+			#endif
+			const auto sent = send(dst, &buf[j], red - j, err);
+			if (err) { return i + j; }
+			#ifdef _WIN32
+			if (sent == 0) {
+				err = create_err("Couldn't send message before connection was closed");
+				return i + j;
+			}
+			#endif
+			j += sent;
 		}
-		i += written;
+		i += red;
 	}
+	return i;
 }
 
+nat8_t transfer (pipe_t& src, file_t& dst, nat8_t len, err_t& err)
+{
+	if (err) { return {}; }
+
+	nat8_t i = 0;
+
+	#ifdef __linux__
+	while (i < len) {
+		const auto chunk_len = len - i < 1024 * 1024 * 1024 ? len - i : 1024 * 1024 * 1024;
+		const auto stat = splice(get_fd(src.h_in), nullptr, get_fd(dst.opaq), nullptr, chunk_len, SPLICE_F_MOVE);
+		if (stat < 0) {
+			if (errno == EAGAIN) {
+				wait_for_fd(src.h_in, POLLIN, err);
+				if (err) { return i; }
+				continue;
+			}
+			// files opened for appending, among others
+			if (i == 0 && (errno == EINVAL || errno == ENOSYS)) { break; }
+			err = decode_os_err(errno);
+			return i;
+		}
+		if (stat == 0) { return i; }
+		i += static_cast<nat8_t>(stat);
+	}
+	if (i == len) { return i; }
+	#endif
+
+	auto buf = create_str(len - i < transfer_buf_len ? len - i : transfer_buf_len);
+	while (i < len) {
+		#ifdef __unix__
+		wait_for_fd(src.h_in, POLLIN, err);
+		#endif
+		const auto red = recv(src, buf.ptr, len - i < buf.len ? len - i : buf.len, err);
+		if (err || red == 0) { break; }
+		write(dst, buf.ptr, red, err);
+		if (err) { break; }
+		i += red;
+	}
+	return i;
+}
+
+define_test(pipe, "path,error")
+{
+	err_t err;
+	const auto path = create_temp_path(err);
+	auto pipes = pipe_create(err);
+	{ auto file = open_file(path, true, err);
+		write(file, "0123456789", err);
+		set_cursor(file, 2, err);
+		prove_eq(transfer(file, pipes.left, 5, err), 5);
+		prove_eq(transfer(file, pipes.left, max<nat8_t>(), err), 3);
+		prove_same(as_text(err), "");
+	}
+	{ auto file = open_file(path, true, err);
+		set_cursor(file, 10, err);
+		prove_eq(transfer(pipes.right, file, 8, err), 8);
+		set_cursor(file, 0, err);
+		prove_same(read_all(file, err), "012345678923456789");
+		prove_same(as_text(err), "");
+	}
+	remove_file(path, err);
+
+	prove_same(recv(pipes.right, err), "");
+	send(pipes.left, "message", err);
+	prove_same(recv(pipes.right, err), "message");
+
+	#ifdef __unix__
+	// a blocking end that can't say how much is waiting, like a std stream from /dev/null, still gets read
+	{ pipe_t null_pipe;
+		null_pipe.h_in  = create_opaque_fd(open("/dev/null", O_RDONLY | O_CLOEXEC));
+		null_pipe.h_out = create_opaque_fd(open("/dev/null", O_WRONLY | O_CLOEXEC));
+		prove_same(recv(null_pipe, err), "");
+		prove_same(as_text(err), "");
+	}
+	#endif
+
+	// a ring takes what's waiting in one go, wrapping once the front's been consumed
+	auto ring = create_ring(12);
+	prove_eq(ring.buf.len, 16);
+	prove_eq(recv(pipes.right, ring, err), 0);
+	send(pipes.left, "0123456789ab", err);
+	prove_eq(recv(pipes.right, ring, err), 12);
+	nat1_t out[16] = {};
+	prove_eq(take(ring, out, 10), 10);
+	prove_eq(out[9], '9');
+	send(pipes.left, "cdefghijklmnopq", err);
+	prove_eq(recv(pipes.right, ring, err), 14);
+	const auto views = get_views(ring);
+	prove_same(create_str(views.first), "abcdef");
+	prove_same(create_str(views.second), "ghijklmnop");
+	prove_eq(recv(pipes.right, ring, err), 0);
+	consume(ring, 16);
+	prove_eq(recv(pipes.right, ring, err), 1);
+	prove_eq(ring.at, 0);
+	prove_same(create_str(get_views(ring).first), "q");
+	consume(ring, 1);
+	prove_same(as_text(err), "");
+
+	// a burst bigger than the pipe waits for room, and gives up at the timeout with what it got through
+	const auto cap = set_pipe_capacity(pipes.left, 4096, err);
+	prove_gteq(cap, 4096);
+	auto burst = create_str(cap * 3);
+	for (auto i : create_range(burst.len)) { burst[i] = static_cast<nat1_t>(i % 251); }
+	prove_eq(send_waited(pipes.left, burst.ptr, burst.len, create_inter_of_millisecs(10), err), cap);
+	prove_same(as_text(err), "Timed out waiting for room in the pipe");
+	err = {};
+	prove_eq(recv(pipes.right, burst.ptr, cap, err), cap);
+
+	// whereas a queued send never waits, keeping what doesn't fit for flush
+	ring_t queue;
+	send(pipes.left, queue, burst.ptr, burst.len, err);
+	prove_eq(queue.len, cap * 2);
+	prove_false(flush(pipes.left, queue, err));
+	auto got = create_str(burst.len);
+	nat8_t got_len = 0;
+	while (got_len < burst.len && !err) {
+		got_len += recv(pipes.right, &got[got_len], burst.len - got_len, err);
+		flush(pipes.left, queue, err);
+	}
+	prove_same(as_text(err), "");
+	prove_same(got, burst);
+	prove_eq(queue.len, 0);
+	return {};
+}
@@ -1,6 +1,7 @@
 #ifndef libcx3_pipe_hpp
 #define libcx3_pipe_hpp
 #include "prelude.hpp"
+#include "time.hpp"
 
 struct pipe_t
 {
@@ -28,9 +29,54 @@ struct pipe_pair_t
 struct err_t;
 pipe_pair_t pipe_create (err_t& e);
 nat8_t recv (pipe_t& pipe, void_t* buf_ptr, nat8_t buf_len, err_t& err);
-nat8_t send (pipe_t& pipe, const void_t* data_ptr, nat8_t data_len, err_t& err);
-str_t recv (pipe_t& pipe, err_t& e);
+nat8_t send (pipe_t& pipe, const void_t* data_ptr, nat8_t data_len, err_t& err); // short, maybe 0, when it's full
+str_t recv (pipe_t& pipe, err_t& e); // sized to what's waiting, without allocating when a non-blocking end has nothing
 void_t send (pipe_t& pipe, const str_t& data, err_t& e);
 
+// Send all of it, waiting whenever the pipe's full. The timed one gives up with an error once the timeout's passed,
+// returning how much went. Windows pipes block, so there the timeout can't cut a write short.
+void_t send_all (pipe_t& pipe, const void_t* data_ptr, nat8_t data_len, err_t& err);
+nat8_t send_waited (pipe_t& pipe, const void_t* data_ptr, nat8_t data_len, inter_t timeout, err_t& err);
+
+// Resizes the kernel's buffer for what this end sends, so bursts up to that size don't have to wait. Linux rounds
+// it up to a power of two pages, and the result is what it actually got. Other systems can't resize a pipe.
+nat8_t set_pipe_capacity (pipe_t& pipe, nat8_t len, err_t& err);
+
+// A byte ring for pipes to read into, which its owner keeps between calls so a steady stream allocates nothing
+struct ring_t
+{
+	str_t  buf {}; // its length is a power of two
+	nat8_t at  {}; // where the unconsumed bytes start
+	nat8_t len {}; // and how many there are
+};
+
+// The unconsumed bytes, in order. They only go into the second view when they wrap around the end of the buffer.
+struct ring_views_t
+{
+	view_t<const nat1_t> first  {};
+	view_t<const nat1_t> second {};
+};
+
+ring_t create_ring (nat8_t len); // rounded up to a power of two, and zero picks 64 KiB
+ring_views_t get_views (const ring_t& ring);
+void_t consume (ring_t& ring, nat8_t len);
+nat8_t take (ring_t& ring, void_t* ptr, nat8_t len); // copies out and consumes up to len bytes
+
+void_t push (ring_t& ring, const void_t* ptr, nat8_t len); // grows it when there isn't room
+
+// Fills the free space in one readv, across the wrap. Doesn't block on unix, returning 0 when nothing's waiting.
+nat8_t recv (pipe_t& pipe, ring_t& ring, err_t& err);
+
+// Sends what it can straight away and queues the rest, so nothing blocks and nothing's dropped. While the queue has
+// anything in it, watch the pipe for writability and flush each time it's reported.
+void_t send (pipe_t& pipe, ring_t& queue, const void_t* data_ptr, nat8_t data_len, err_t& err);
+bool_t flush (pipe_t& pipe, ring_t& queue, err_t& err); // one writev across the wrap, true once the queue's empty
+
+// Moves up to len bytes (max for all there is) between a file's cursor and a pipe, waiting on the pipe when it's
+// not ready. On linux the data stays in the kernel, going through sendfile and splice. Returns how many moved.
+struct file_t;
+nat8_t transfer (file_t& src, pipe_t& dst, nat8_t len, err_t& err);
+nat8_t transfer (pipe_t& src, file_t& dst, nat8_t len, err_t& err);
+
 #endif
 
@@ -1,12 +1,26 @@
 #include "platform.hpp"
 #include "text.hpp"
+#include "file.hpp"
+#include "error.hpp"
+#include "raw.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#ifdef __unix__
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <errno.h>
+#endif
 #ifdef __linux__
 #include <sys/utsname.h>
+#include <dirent.h>
 #endif
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <versionhelpers.h>
+#include <psapi.h>
 #ifndef _WIN32_WINNT_WIN10
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wreserved-id-macro"
@@ -112,3 +126,500 @@ str_t as_text (const plat_t& plat)
 	return str;
 }
 
+
+cpu_t get_cpu ()
+{
+	cpu_t cpu;
+	#if defined(__x86_64__) || defined(__i386__)
+	nat4_t a = 0, b = 0, c = 0, d = 0;
+	__cpuid(0, a, b, c, d);
+	const auto max_leaf = a;
+
+	nat8_t xcr0 = 0;
+	if (max_leaf >= 1) {
+		__cpuid_count(1, 0, a, b, c, d);
+		cpu.sse2   = d & bit_SSE2;
+		cpu.ssse3  = c & bit_SSSE3;
+		cpu.sse41  = c & bit_SSE4_1;
+		cpu.sse42  = c & bit_SSE4_2;
+		cpu.popcnt = c & bit_POPCNT;
+		cpu.clmul  = c & bit_PCLMUL;
+		if (c & bit_OSXSAVE) {
+			nat4_t xcr0_lo = 0, xcr0_hi = 0;
+			__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+			xcr0 = (static_cast<nat8_t>(xcr0_hi) << 32) | xcr0_lo;
+		}
+		// xmm and ymm state, then opmask and both halves of the zmm state
+		const auto os_ymm = (xcr0 & 0x06) == 0x06;
+		const auto os_zmm = (xcr0 & 0xE6) == 0xE6;
+		cpu.avx = os_ymm && (c & bit_AVX);
+		cpu.fma = os_ymm && (c & bit_FMA);
+
+		if (max_leaf >= 7) {
+			__cpuid_count(7, 0, a, b, c, d);
+			cpu.avx2       = os_ymm && (b & bit_AVX2);
+			cpu.bmi2       = b & bit_BMI2;
+			cpu.avx512f    = os_zmm && (b & bit_AVX512F);
+			cpu.avx512bw   = os_zmm && (b & (1U << 30));
+			cpu.avx512dq   = os_zmm && (b & (1U << 17));
+			cpu.avx512vl   = os_zmm && (b & (1U << 31));
+			cpu.clflushopt = b & (1U << 23);
+			cpu.clwb       = b & (1U << 24);
+			cpu.movdiri    = c & (1U << 27);
+			cpu.movdir64b  = c & (1U << 28);
+		}
+	}
+	#endif
+	return cpu;
+}
+
+void_t append_cpu_feat (str_t& str, bool_t has, const char* name)
+{
+	if (!has) { return; }
+	str = str.len ? str + " " + name : name;
+}
+
+str_t as_text (const cpu_t& cpu)
+{
+	str_t str;
+	append_cpu_feat(str, cpu.sse2,       "sse2");
+	append_cpu_feat(str, cpu.ssse3,      "ssse3");
+	append_cpu_feat(str, cpu.sse41,      "sse4.1");
+	append_cpu_feat(str, cpu.sse42,      "sse4.2");
+	append_cpu_feat(str, cpu.popcnt,     "popcnt");
+	append_cpu_feat(str, cpu.clmul,      "clmul");
+	append_cpu_feat(str, cpu.avx,        "avx");
+	append_cpu_feat(str, cpu.avx2,       "avx2");
+	append_cpu_feat(str, cpu.bmi2,       "bmi2");
+	append_cpu_feat(str, cpu.fma,        "fma");
+	append_cpu_feat(str, cpu.avx512f,    "avx512f");
+	append_cpu_feat(str, cpu.avx512bw,   "avx512bw");
+	append_cpu_feat(str, cpu.avx512dq,   "avx512dq");
+	append_cpu_feat(str, cpu.avx512vl,   "avx512vl");
+	append_cpu_feat(str, cpu.clflushopt, "clflushopt");
+	append_cpu_feat(str, cpu.clwb,       "clwb");
+	append_cpu_feat(str, cpu.movdiri,    "movdiri");
+	append_cpu_feat(str, cpu.movdir64b,  "movdir64b");
+	return str;
+}
+
+isa_t get_isa (const cpu_t& cpu)
+{
+	if (!(cpu.ssse3 && cpu.sse41 && cpu.sse42 && cpu.popcnt)) { return isa_t::base; }
+	if (!(cpu.avx && cpu.avx2 && cpu.bmi2 && cpu.fma))        { return isa_t::sse42; }
+	if (!(cpu.avx512f && cpu.avx512bw && cpu.avx512dq && cpu.avx512vl)) { return isa_t::avx2; }
+	return isa_t::avx512;
+}
+
+str_t as_text (const isa_t& isa)
+{
+	switch (isa) {
+		case isa_t::base:   return "base";
+		case isa_t::sse42:  return "sse4.2";
+		case isa_t::avx2:   return "avx2";
+		case isa_t::avx512: return "avx512";
+	}
+	return "base";
+}
+
+kernel_slot_t* kernels;
+nat1_t         kernel_isa_cap = static_cast<nat1_t>(isa_t::avx512);
+
+void_t install_kernel (kernel_slot_t& slot)
+{
+	slot.next = kernels;
+	kernels = &slot;
+}
+
+void_t resolve (kernel_slot_t& slot)
+{
+	auto isa = static_cast<nat1_t>(get_isa(get_cpu()));
+	isa = isa < kernel_isa_cap ? isa : kernel_isa_cap;
+	while (!slot.impls[isa]) {
+		assert_gt(isa, 0);
+		--isa;
+	}
+	slot.func = slot.impls[isa];
+}
+
+void_t resolve_kernels ()
+{
+	for (auto slot = kernels; slot; slot = slot->next) {
+		resolve(*slot);
+	}
+}
+
+void_t cap_isa (isa_t isa)
+{
+	kernel_isa_cap = static_cast<nat1_t>(isa);
+	resolve_kernels();
+}
+
+#ifdef __linux__
+str_t read_sys_text (const str_t& path)
+{
+	err_t err;
+	auto file = open_file(create_path(path), false, err);
+	auto text = read(file, max<nat8_t>(), err);
+	return err ? str_t() : move(text);
+}
+
+nat8_t read_sys_nat (const str_t& path, nat8_t fallback)
+{
+	const auto text = read_sys_text(path);
+	nat8_t at = 0;
+	const auto val = decode_nat(text, &at);
+	return at > 0 ? val : fallback;
+}
+
+// lists look like "0-3,8,10-11"
+seq_t<nat4_t> decode_cpu_list (const str_t& text)
+{
+	seq_t<nat4_t> cpus;
+	nat8_t at = 0;
+	while (at < text.len) {
+		const auto first_at = at;
+		const auto first = decode_nat(text, &at);
+		if (at == first_at) { break; }
+		auto last = first;
+		if (at < text.len && text[at] == '-') {
+			++at;
+			last = decode_nat(text, &at);
+		}
+		for (auto cpu = first; cpu <= last; ++cpu) {
+			grow(cpus, cpus.len, 1);
+			cpus[cpus.len - 1] = static_cast<nat4_t>(cpu);
+		}
+		if (at >= text.len || text[at] != ',') { break; }
+		++at;
+	}
+	return cpus;
+}
+
+void_t read_sys_topology (topo_t& topo)
+{
+	const str_t cpu_dir = "/sys/devices/system/cpu/";
+	const auto cpus = decode_cpu_list(read_sys_text(cpu_dir + "online"));
+	if (!cpus) { return; }
+	topo.logical_n = static_cast<nat4_t>(cpus.len);
+
+	seq_t<nat8_t> cores;
+	seq_t<nat8_t> packages;
+	for (auto cpu : cpus) {
+		const auto topo_dir = cpu_dir + "cpu" + as_text(cpu) + "/topology/";
+		const auto package = read_sys_nat(topo_dir + "physical_package_id", 0);
+		const auto core = (package << 32) | read_sys_nat(topo_dir + "core_id", cpu);
+
+		auto core_known = false;
+		for (auto known : cores) { core_known = core_known || known == core; }
+		if (!core_known) {
+			grow(cores, cores.len, 1);
+			cores[cores.len - 1] = core;
+		}
+		auto package_known = false;
+		for (auto known : packages) { package_known = package_known || known == package; }
+		if (!package_known) {
+			grow(packages, packages.len, 1);
+			packages[packages.len - 1] = package;
+		}
+	}
+	topo.physical_n = static_cast<nat4_t>(cores.len);
+	topo.package_n  = static_cast<nat4_t>(packages.len);
+
+	for (nat8_t i = 0; ; ++i) {
+		const auto index_dir = cpu_dir + "cpu" + as_text(cpus[0]) + "/cache/index" + as_text(i) + "/";
+		const auto level = read_sys_nat(index_dir + "level", 0);
+		if (!level) { break; }
+		if (read_sys_text(index_dir + "type") == "Instruction\n") { continue; }
+
+		// sizes are written like "32K"
+		const auto size_text = read_sys_text(index_dir + "size");
+		nat8_t at = 0;
+		auto len = decode_nat(size_text, &at);
+		if (at < size_text.len && size_text[at] == 'K') { len *= 1024; }
+		if (at < size_text.len && size_text[at] == 'M') { len *= 1024 * 1024; }
+
+		if (level == 1) { topo.l1d_len = len; }
+		if (level == 2) { topo.l2_len  = len; }
+		if (level == 3) { topo.l3_len  = len; }
+		if (level == 1) { topo.line_len = static_cast<nat4_t>(read_sys_nat(index_dir + "coherency_line_size", 0)); }
+	}
+
+	const str_t node_dir = "/sys/devices/system/node/";
+	const auto nodes = decode_cpu_list(read_sys_text(node_dir + "online"));
+	if (!nodes) { return; }
+	topo.node_n = static_cast<nat4_t>(nodes.len);
+	topo.cpu_nodes = create_seq<nat4_t>(cpus[cpus.len - 1] + 1);
+	for (auto node : nodes) {
+		for (auto cpu : decode_cpu_list(read_sys_text(node_dir + "node" + as_text(node) + "/cpulist"))) {
+			if (cpu < topo.cpu_nodes.len) { topo.cpu_nodes[cpu] = node; }
+		}
+	}
+}
+#endif
+
+#ifdef _WIN32
+void_t read_win_topology (topo_t& topo)
+{
+	DWORD buf_len = 0;
+	GetLogicalProcessorInformation(NULL, &buf_len);
+	auto buf = create_seq<SYSTEM_LOGICAL_PROCESSOR_INFORMATION>(buf_len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	buf_len = static_cast<DWORD>(buf.len * sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (!buf || !GetLogicalProcessorInformation(buf.ptr, &buf_len)) { return; }
+
+	for (const auto& info : buf) {
+		const auto mask = static_cast<nat8_t>(info.ProcessorMask);
+		if (info.Relationship == RelationProcessorCore) {
+			topo.logical_n += static_cast<nat4_t>(__builtin_popcountll(mask));
+			++topo.physical_n;
+		} else if (info.Relationship == RelationProcessorPackage) {
+			++topo.package_n;
+		} else if (info.Relationship == RelationNumaNode) {
+			++topo.node_n;
+			for (auto cpu : create_range(64)) {
+				if (!(mask & (1ULL << cpu))) { continue; }
+				if (topo.cpu_nodes.len <= cpu) { grow(topo.cpu_nodes, topo.cpu_nodes.len, cpu + 1 - topo.cpu_nodes.len); }
+				topo.cpu_nodes[cpu] = static_cast<nat4_t>(info.NumaNode.NodeNumber);
+			}
+		} else if (info.Relationship == RelationCache && info.Cache.Type != CacheInstruction && (mask & 1)) {
+			if (info.Cache.Level == 1) { topo.l1d_len = info.Cache.Size; topo.line_len = info.Cache.LineSize; }
+			if (info.Cache.Level == 2) { topo.l2_len  = info.Cache.Size; }
+			if (info.Cache.Level == 3) { topo.l3_len  = info.Cache.Size; }
+		}
+	}
+}
+#endif
+
+void_t read_cpuid_topology (topo_t& topo)
+{
+	#if defined(__x86_64__) || defined(__i386__)
+	nat4_t a = 0, b = 0, c = 0, d = 0;
+	if (!topo.line_len && __get_cpuid(1, &a, &b, &c, &d)) {
+		topo.line_len = ((b >> 8) & 0xFF) * 8;
+	}
+	if (topo.l1d_len || topo.l2_len || topo.l3_len) { return; }
+
+	// intel describes its caches in leaf 4, amd in 0x8000001D, both in the same layout
+	nat4_t leaf = 4;
+	__cpuid(0, a, b, c, d);
+	if (a < 4) { leaf = 0x8000001D; }
+	__cpuid_count(leaf, 0, a, b, c, d);
+	if (!(a & 0x1F)) { leaf = 0x8000001D; }
+	if (leaf == 0x8000001D) {
+		__cpuid(0x80000000, a, b, c, d);
+		if (a < leaf) { return; }
+	}
+	for (nat4_t i = 0; i < 16; ++i) {
+		__cpuid_count(leaf, i, a, b, c, d);
+		const auto type = a & 0x1F;
+		if (type == 0) { break; }
+		if (type == 2) { continue; }
+		const auto level = (a >> 5) & 0x7;
+		const auto len = static_cast<nat8_t>((b >> 22) + 1) * (((b >> 12) & 0x3FF) + 1) * ((b & 0xFFF) + 1) * (c + 1);
+		if (level == 1) { topo.l1d_len = len; }
+		if (level == 2) { topo.l2_len  = len; }
+		if (level == 3) { topo.l3_len  = len; }
+	}
+	#endif
+	unused(topo);
+}
+
+topo_t get_topology ()
+{
+	topo_t topo;
+	#ifdef __linux__
+	read_sys_topology(topo);
+	#endif
+	#ifdef _WIN32
+	read_win_topology(topo);
+	#endif
+	read_cpuid_topology(topo);
+
+	#ifdef __unix__
+	if (!topo.logical_n) {
+		const auto online = sysconf(_SC_NPROCESSORS_ONLN);
+		topo.logical_n = online > 0 ? static_cast<nat4_t>(online) : 1;
+	}
+	#endif
+	if (!topo.logical_n)  { topo.logical_n  = 1; }
+	if (!topo.physical_n) { topo.physical_n = topo.logical_n; }
+	if (!topo.package_n)  { topo.package_n  = 1; }
+	if (!topo.node_n)     { topo.node_n     = 1; }
+	if (!topo.cpu_nodes)  { topo.cpu_nodes  = create_seq<nat4_t>(topo.logical_n); }
+	return topo;
+}
+
+#ifdef __unix__
+inter_t create_inter (const timespec& ts);
+
+inter_t create_inter (const timeval& tv)
+{
+	if (tv.tv_sec < 0 || tv.tv_usec < 0) { return {}; }
+	return create_inter_of_secs(static_cast<nat8_t>(tv.tv_sec)) +
+	       create_inter_of_nanosecs(static_cast<nat8_t>(tv.tv_usec) * 1000);
+}
+#endif
+#ifdef _WIN32
+inter_t create_inter (const FILETIME& file);
+#endif
+
+proc_stats_t get_proc_stats (err_t& err)
+{
+	if (err) { return {}; }
+
+	proc_stats_t stats;
+
+	#ifdef __unix__
+	rusage usage = {};
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		err = decode_os_err(errno);
+		return {};
+	}
+	stats.peak_rss_len   = static_cast<nat8_t>(usage.ru_maxrss) * 1024;
+	stats.minor_faults   = static_cast<nat8_t>(usage.ru_minflt);
+	stats.major_faults   = static_cast<nat8_t>(usage.ru_majflt);
+	stats.vol_switches   = static_cast<nat8_t>(usage.ru_nvcsw);
+	stats.invol_switches = static_cast<nat8_t>(usage.ru_nivcsw);
+	stats.user_time      = create_inter(usage.ru_utime);
+	stats.sys_time       = create_inter(usage.ru_stime);
+
+	timespec ts = {};
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+		err = decode_os_err(errno);
+		return {};
+	}
+	stats.thread_time = create_inter(ts);
+	#endif
+
+	#ifdef __linux__
+	// statm counts pages, the second figure being those resident
+	const auto statm = read_sys_text("/proc/self/statm");
+	nat8_t at = 0;
+	decode_nat(statm, &at);
+	stats.rss_len = decode_nat(statm, &at) * static_cast<nat8_t>(sysconf(_SC_PAGESIZE));
+
+	if (auto dir = opendir("/proc/self/fd"); dir) {
+		while (const auto ent = readdir(dir)) {
+			if (ent->d_name[0] != '.') { ++stats.fds_n; }
+		}
+		closedir(dir);
+		// less the one reading the directory
+		--stats.fds_n;
+	}
+	#endif
+
+	#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = {};
+	counters.cb = sizeof(counters);
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	// windows doesn't separate soft faults from hard ones
+	stats.rss_len      = counters.WorkingSetSize;
+	stats.peak_rss_len = counters.PeakWorkingSetSize;
+	stats.minor_faults = counters.PageFaultCount;
+
+	DWORD handles_n = 0;
+	if (GetProcessHandleCount(GetCurrentProcess(), &handles_n)) {
+		stats.fds_n = handles_n;
+	}
+
+	FILETIME created = {}, exited = {}, kernel = {}, user = {};
+	if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	stats.user_time = create_inter(user);
+	stats.sys_time  = create_inter(kernel);
+	if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	stats.thread_time = create_inter(kernel) + create_inter(user);
+	#endif
+
+	return stats;
+}
+
+nat8_t diff_counter (nat8_t counter, nat8_t earlier)
+{
+	return counter > earlier ? counter - earlier : 0;
+}
+
+inter_t diff_counter (inter_t counter, inter_t earlier)
+{
+	return counter > earlier ? counter - earlier : inter_t();
+}
+
+proc_stats_t operator - (const proc_stats_t& stats, const proc_stats_t& earlier)
+{
+	proc_stats_t prod;
+	prod.rss_len        = stats.rss_len;
+	prod.peak_rss_len   = stats.peak_rss_len;
+	prod.fds_n          = stats.fds_n;
+	prod.minor_faults   = diff_counter(stats.minor_faults,   earlier.minor_faults);
+	prod.major_faults   = diff_counter(stats.major_faults,   earlier.major_faults);
+	prod.vol_switches   = diff_counter(stats.vol_switches,   earlier.vol_switches);
+	prod.invol_switches = diff_counter(stats.invol_switches, earlier.invol_switches);
+	prod.user_time      = diff_counter(stats.user_time,      earlier.user_time);
+	prod.sys_time       = diff_counter(stats.sys_time,       earlier.sys_time);
+	prod.thread_time    = diff_counter(stats.thread_time,    earlier.thread_time);
+	return prod;
+}
+
+nat8_t test_platform_kernel_base  (nat8_t val) { return val + 1; }
+nat8_t test_platform_kernel_sse42 (nat8_t val) { return val + 2; }
+nat8_t test_platform_kernel_avx2  (nat8_t val) { return val + 3; }
+
+kernel_t<nat8_t (*) (nat8_t)> test_platform_kernel (&test_platform_kernel_base, &test_platform_kernel_sse42,
+                                                    &test_platform_kernel_avx2);
+
+define_test(platform, "text,path,error")
+{
+	const auto plat = get_plat();
+	prove_true(plat);
+
+	const auto cpu = get_cpu();
+	#ifdef __x86_64__
+	prove_true(cpu.sse2);
+	#endif
+	if (cpu.avx2) { prove_true(cpu.avx); }
+	if (cpu.avx512bw) { prove_true(cpu.avx512f); }
+
+	const auto topo = get_topology();
+	prove_gteq(topo.logical_n, topo.physical_n);
+	prove_gteq(topo.physical_n, topo.package_n);
+	prove_gteq(topo.package_n, 1);
+	prove_gteq(topo.node_n, 1);
+	prove_gteq(topo.cpu_nodes.len, topo.logical_n);
+	if (topo.l2_len && topo.l1d_len) { prove_gt(topo.l2_len, topo.l1d_len); }
+	#ifdef __x86_64__
+	prove_gt(topo.line_len, 0);
+	#endif
+
+	err_t err;
+	const auto before = get_proc_stats(err);
+	const nat8_t touch_len = 8 * 1024 * 1024;
+	auto touch = static_cast<nat1_t*>(alloc_mem(touch_len));
+	for (nat8_t i = 0; i < touch_len; i += 4096) { touch[i] = 1; }
+	free_mem(touch, touch_len);
+	const auto delta = get_proc_stats(err) - before;
+	prove_same(as_text(err), "");
+	prove_gt(delta.rss_len, 0);
+	prove_gteq(delta.peak_rss_len, touch_len);
+	prove_gt(delta.fds_n, 0);
+	prove_gt(delta.minor_faults, 0);
+	prove_true(before.thread_time > inter_t());
+
+	const auto isa = get_isa(cpu);
+	const nat8_t want = isa == isa_t::base ? 1 : isa == isa_t::sse42 ? 2 : 3;
+	prove_eq(resolve(test_platform_kernel)(10), 10 + want);
+
+	cap_isa(isa_t::base);
+	prove_eq(resolve(test_platform_kernel)(10), 11);
+	cap_isa(isa_t::avx512);
+	prove_eq(resolve(test_platform_kernel)(10), 10 + want);
+
+	return {};
+}
@@ -1,4 +1,7 @@
+#ifndef libcx3_platform_hpp
+#define libcx3_platform_hpp
 #include "prelude.hpp"
+#include "time.hpp"
 
 enum class plat_kernel_t : nat2_t
 {
@@ -21,3 +24,121 @@ plat_t get_plat ();
 str_t as_text (const plat_kernel_t& kernel);
 str_t as_text (const plat_t& plat);
 
+// Features are only reported when both the processor and the OS (for the wider register files) support them
+struct cpu_t
+{
+	bool_t sse2       {};
+	bool_t ssse3      {};
+	bool_t sse41      {};
+	bool_t sse42      {};
+	bool_t popcnt     {};
+	bool_t clmul      {};
+	bool_t avx        {};
+	bool_t avx2       {};
+	bool_t bmi2       {};
+	bool_t fma        {};
+	bool_t avx512f    {};
+	bool_t avx512bw   {};
+	bool_t avx512dq   {};
+	bool_t avx512vl   {};
+	bool_t clflushopt {};
+	bool_t clwb       {};
+	bool_t movdiri    {};
+	bool_t movdir64b  {};
+	pad_t<6> padding  {};
+};
+
+cpu_t get_cpu ();
+str_t as_text (const cpu_t& cpu);
+
+// Cache lengths are those seen by the first cpu, a zero meaning the level is absent or unknown
+struct topo_t
+{
+	nat4_t        logical_n  {}; // online cpus
+	nat4_t        physical_n {}; // cores, each running one or more logical cpus
+	nat4_t        package_n  {};
+	nat4_t        node_n     {};
+	nat8_t        l1d_len    {};
+	nat8_t        l2_len     {};
+	nat8_t        l3_len     {};
+	nat4_t        line_len   {};
+	pad_t<4>      padding    {};
+	seq_t<nat4_t> cpu_nodes  {}; // numa node of each cpu, indexed by cpu number
+};
+
+topo_t get_topology ();
+
+// Counters accumulate over the life of the process (or thread, for thread_time), and subtracting an earlier
+// snapshot gives their change in between. The rest are gauges which a difference leaves as they were.
+struct proc_stats_t
+{
+	nat8_t  rss_len        {};
+	nat8_t  peak_rss_len   {};
+	nat8_t  fds_n          {};
+	nat8_t  minor_faults   {};
+	nat8_t  major_faults   {};
+	nat8_t  vol_switches   {};
+	nat8_t  invol_switches {};
+	inter_t user_time      {};
+	inter_t sys_time       {};
+	inter_t thread_time    {};
+};
+
+struct err_t;
+proc_stats_t get_proc_stats (err_t& err);
+proc_stats_t operator - (const proc_stats_t& stats, const proc_stats_t& earlier);
+
+// Tiers follow the x86-64 micro-architecture levels
+enum class isa_t : nat1_t
+{
+	base   = 0, // sse2
+	sse42  = 1, // + ssse3 sse4.1 sse4.2 popcnt
+	avx2   = 2, // + avx avx2 bmi2 fma
+	avx512 = 3, // + avx512f avx512bw avx512dq avx512vl
+};
+
+isa_t get_isa (const cpu_t& cpu);
+str_t as_text (const isa_t& isa);
+
+typedef void_t (*kernel_func_t) ();
+
+struct kernel_slot_t
+{
+	kernel_func_t  impls[4] {};
+	kernel_func_t  func     {};
+	kernel_slot_t* next     {};
+};
+
+void_t install_kernel (kernel_slot_t& slot);
+void_t resolve (kernel_slot_t& slot);
+void_t resolve_kernels ();
+void_t cap_isa (isa_t isa); // for comparing impls against each other, re-resolves every kernel
+
+// A function compiled once per isa_t (with __attribute__((target("..."))) on the faster impls), of which
+// begin_main picks the best one this host can run. Impls may be null except for the base one.
+template<typename func_t> struct kernel_t
+{
+	kernel_slot_t slot;
+
+	kernel_t (func_t base, func_t sse42 = nullptr, func_t avx2 = nullptr, func_t avx512 = nullptr)
+	{
+		assert_true(base);
+		slot.impls[0] = reinterpret_cast<kernel_func_t>(base);
+		slot.impls[1] = reinterpret_cast<kernel_func_t>(sse42);
+		slot.impls[2] = reinterpret_cast<kernel_func_t>(avx2);
+		slot.impls[3] = reinterpret_cast<kernel_func_t>(avx512);
+		install_kernel(slot);
+	}
+
+	kernel_t (const kernel_t<func_t>& ori) = delete;
+	kernel_t<func_t>& operator = (const kernel_t<func_t>& ori) = delete;
+};
+
+template<typename func_t> func_t resolve (kernel_t<func_t>& kernel)
+{
+	// kernels called during static initialisation haven't been through begin_main yet
+	if (!kernel.slot.func) { resolve(kernel.slot); }
+	return reinterpret_cast<func_t>(kernel.slot.func);
+}
+
+#endif
@@ -0,0 +1,585 @@
+#include "poll.hpp"
+#include "pipe.hpp"
+#include "thread.hpp"
+#include "watch.hpp"
+#include "aio.hpp"
+#include "error.hpp"
+#include "text.hpp"
+#include "box.hpp"
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#ifdef __unix__
+int get_fd (opaque_t opaq);
+opaque_t create_opaque_fd (int fd);
+#endif
+#ifdef _WIN32
+HANDLE get_handle (opaque_t opaq);
+opaque_t create_opaque_handle (HANDLE h);
+#endif
+void_t* get_ptr (opaque_t opaq);
+opaque_t create_opaque_ptr (void_t* ptr);
+void_t init (sem_t& sem);
+
+const nat8_t wake_token = max<nat8_t>();
+
+#ifdef _WIN32
+const nat8_t max_entries_n = MAXIMUM_WAIT_OBJECTS - 1; // the waker takes the last slot
+
+struct poll_entry_t
+{
+	opaque_t handle  {};
+	nat8_t   token   {};
+	bool_t   once    {};
+	pad_t<7> padding {};
+};
+#endif
+
+struct poller_state_t
+{
+	#ifdef __linux__
+	opaque_t            epoll   {};
+	opaque_t            waker   {}; // an eventfd that wake writes to
+	seq_t<epoll_event>  buf     {}; // only touched by the waiting thread
+	#endif
+	#ifdef _WIN32
+	opaque_t            waker   {}; // an auto reset event, also set whenever the entries change
+	mutex_t             mutex   {};
+	seq_t<poll_entry_t> entries {};
+	bool_t              woken   {}; // tells a wake from a change in the entries
+	pad_t<7>            padding {};
+	#endif
+};
+
+poller_state_t& get_state (const poller_t& poller)
+{
+	assert_true(poller.opaq);
+	return *static_cast<poller_state_t*>(get_ptr(poller.opaq));
+}
+
+poller_t::poller_t () { }
+poller_t::~poller_t ()
+{
+	if (!opaq) { return; }
+
+	box_t<poller_state_t> box;
+	acquire(box, &get_state(*this));
+	opaq = {};
+
+	auto& st = **box;
+	#ifdef __linux__
+	close(get_fd(st.waker));
+	close(get_fd(st.epoll));
+	#endif
+	#ifdef _WIN32
+	CloseHandle(get_handle(st.waker));
+	#endif
+}
+
+poller_t::poller_t (poller_t&& ori) { *this = move(ori); }
+poller_t& poller_t::operator = (poller_t&& ori)
+{
+	if (&ori != this) {
+		this->~poller_t();
+		opaq = ori.opaq;
+		ori.opaq = {};
+	}
+	return *this;
+}
+
+poller_t::operator bool_t () const
+{
+	return bool_t(opaq);
+}
+
+poller_t create_poller (err_t& err)
+{
+	if (err) { return {}; }
+
+	box_t<poller_state_t> box;
+	auto& st = **box;
+
+	#ifdef __linux__
+	const auto epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	const auto waker_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (epoll_fd < 0 || waker_fd < 0) {
+		err = decode_os_err(errno);
+		if (epoll_fd >= 0) { close(epoll_fd); }
+		if (waker_fd >= 0) { close(waker_fd); }
+		return {};
+	}
+	st.epoll = create_opaque_fd(epoll_fd);
+	st.waker = create_opaque_fd(waker_fd);
+
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.u64 = wake_token;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, waker_fd, &event) != 0) {
+		err = decode_os_err(errno);
+		close(waker_fd);
+		close(epoll_fd);
+		return {};
+	}
+	#endif
+
+	#ifdef _WIN32
+	const auto event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (!event) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	st.waker = create_opaque_handle(event);
+	#endif
+
+	poller_t poller;
+	poller.opaq = create_opaque_ptr(release(box));
+	return poller;
+}
+
+void_t watch_handle (poller_t& poller, opaque_t handle, const poll_opts_t& opts, nat8_t token, err_t& err)
+{
+	if (err) { return; }
+	assert_uneq(token, wake_token);
+
+	auto& st = get_state(poller);
+
+	#ifdef __linux__
+	epoll_event event = {};
+	if (opts.readable) { event.events |= EPOLLIN | EPOLLRDHUP; }
+	if (opts.writable) { event.events |= EPOLLOUT; }
+	if (opts.edge)     { event.events |= EPOLLET; }
+	if (opts.once)     { event.events |= EPOLLONESHOT; }
+	event.data.u64 = token;
+	if (epoll_ctl(get_fd(st.epoll), EPOLL_CTL_ADD, get_fd(handle), &event) == 0) { return; }
+	if (errno == EEXIST && epoll_ctl(get_fd(st.epoll), EPOLL_CTL_MOD, get_fd(handle), &event) == 0) { return; }
+	err = decode_os_err(errno);
+	#endif
+
+	#ifdef _WIN32
+	// handles are only ever signalled, and waiting on them is what resets them, so every watch is level and readable
+	if (opts.writable) {
+		err = create_err("Windows can only wait for handles to become readable");
+		return;
+	}
+
+	{ auto lock = acquire(st.mutex);
+		nat8_t at = 0;
+		while (at < st.entries.len && st.entries[at].handle != handle) { at += 1; }
+		if (at == st.entries.len) {
+			if (st.entries.len == max_entries_n) {
+				err = create_err("Windows can't wait on more than " + as_text(max_entries_n) + " handles at once");
+				return;
+			}
+			grow(st.entries, at, 1);
+			st.entries[at].handle = handle;
+		}
+		st.entries[at].token = token;
+		st.entries[at].once  = opts.once;
+	}
+	SetEvent(get_handle(st.waker)); // so a wait that's under way picks the change up
+	#endif
+}
+
+// Handles that weren't being watched are left alone
+void_t unwatch_handle (poller_t& poller, opaque_t handle, err_t& err)
+{
+	if (err) { return; }
+
+	auto& st = get_state(poller);
+
+	#ifdef __linux__
+	if (epoll_ctl(get_fd(st.epoll), EPOLL_CTL_DEL, get_fd(handle), nullptr) != 0 && errno != ENOENT) {
+		err = decode_os_err(errno);
+	}
+	#endif
+
+	#ifdef _WIN32
+	{ auto lock = acquire(st.mutex);
+		for (auto i : create_range(st.entries.len)) {
+			if (st.entries[i].handle != handle) { continue; }
+			shrink(st.entries, i, 1);
+			break;
+		}
+	}
+	SetEvent(get_handle(st.waker));
+	#endif
+}
+
+void_t watch (poller_t& poller, pipe_t& pipe, const poll_opts_t& opts, nat8_t token, err_t& err)
+{
+	if (err) { return; }
+
+	#ifdef __linux__
+	// the two directions are separate fds, so each is watched on its own, under the same token
+	poll_opts_t in_opts = opts;
+	in_opts.writable = false;
+	poll_opts_t out_opts = opts;
+	out_opts.readable = false;
+	if (opts.readable) {
+		watch_handle(poller, pipe.h_in, in_opts, token, err);
+	} else {
+		unwatch_handle(poller, pipe.h_in, err);
+	}
+	if (opts.writable) {
+		watch_handle(poller, pipe.h_out, out_opts, token, err);
+	} else {
+		unwatch_handle(poller, pipe.h_out, err);
+	}
+	#endif
+
+	#ifdef _WIN32
+	unused(poller);
+	unused(pipe);
+	unused(opts);
+	unused(token);
+	err = create_err("Windows can't wait on anonymous pipes");
+	#endif
+}
+
+void_t watch (poller_t& poller, metronome_t& met, nat8_t token, err_t& err)
+{
+	poll_opts_t opts;
+	opts.readable = true;
+	watch_handle(poller, met.opaq, opts, token, err);
+}
+
+void_t watch (poller_t& poller, sem_t& sem, nat8_t token, err_t& err)
+{
+	if (!sem.opaq) { init(sem); }
+
+	poll_opts_t opts;
+	opts.readable = true;
+	watch_handle(poller, sem.opaq, opts, token, err);
+}
+
+void_t watch (poller_t& poller, watcher_t& watcher, nat8_t token, err_t& err)
+{
+	poll_opts_t opts;
+	opts.readable = true;
+	watch_handle(poller, get_ready_handle(watcher), opts, token, err);
+}
+
+void_t watch (poller_t& poller, io_ring_t& ring, nat8_t token, err_t& err)
+{
+	poll_opts_t opts;
+	opts.readable = true;
+	watch_handle(poller, get_done_handle(ring), opts, token, err);
+}
+
+void_t unwatch (poller_t& poller, pipe_t& pipe, err_t& err)
+{
+	#ifdef __linux__
+	unwatch_handle(poller, pipe.h_in, err);
+	unwatch_handle(poller, pipe.h_out, err);
+	#endif
+
+	#ifdef _WIN32
+	unused(poller);
+	unused(pipe);
+	unused(err);
+	#endif
+}
+
+void_t unwatch (poller_t& poller, metronome_t& met, err_t& err)
+{
+	unwatch_handle(poller, met.opaq, err);
+}
+
+void_t unwatch (poller_t& poller, sem_t& sem, err_t& err)
+{
+	if (!sem.opaq) { return; }
+	unwatch_handle(poller, sem.opaq, err);
+}
+
+void_t unwatch (poller_t& poller, watcher_t& watcher, err_t& err)
+{
+	unwatch_handle(poller, get_ready_handle(watcher), err);
+}
+
+void_t unwatch (poller_t& poller, io_ring_t& ring, err_t& err)
+{
+	unwatch_handle(poller, get_done_handle(ring), err);
+}
+
+// One go at the kernel, for wait_ms milliseconds (or -1 for as long as it takes). Sets woken if a wake was among
+// what came back, and returns how many of the rest there were.
+nat8_t wait_once (poller_state_t& st, poll_event_t* events_ptr, nat8_t events_len, int wait_ms, bool_t& woken,
+	err_t& err)
+{
+	if (err) { return 0; }
+	assert_gt(events_len, 0);
+
+	#ifdef __linux__
+	const auto buf_len = clamp(events_len, 1, max<int>());
+	if (st.buf.len < buf_len) { grow(st.buf, st.buf.len, buf_len - st.buf.len); }
+	const auto stat = epoll_wait(get_fd(st.epoll), st.buf.ptr, static_cast<int>(buf_len), wait_ms);
+	if (stat < 0) {
+		if (errno != EINTR) { err = decode_os_err(errno); }
+		return 0;
+	}
+
+	nat8_t events_n = 0;
+	for (auto i : create_range(static_cast<nat8_t>(stat))) {
+		const epoll_event event = st.buf[i];
+		if (event.data.u64 == wake_token) {
+			nat8_t count = 0;
+			const auto red = read(get_fd(st.waker), &count, sizeof(count));
+			unused(red);
+			woken = true;
+			continue;
+		}
+		auto& out = events_ptr[events_n++];
+		out = {};
+		out.token    = event.data.u64;
+		out.readable = (event.events & EPOLLIN) != 0;
+		out.writable = (event.events & EPOLLOUT) != 0;
+		out.hung_up  = (event.events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) != 0;
+	}
+	return events_n;
+	#endif
+
+	#ifdef _WIN32
+	// the waker goes first, so a wake isn't starved by a handle that's always signalled
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS] = {};
+	seq_t<poll_entry_t> entries;
+	{ auto lock = acquire(st.mutex);
+		entries = clone(st.entries);
+	}
+	handles[0] = get_handle(st.waker);
+	for (auto i : create_range(entries.len)) { handles[i + 1] = get_handle(entries[i].handle); }
+
+	const auto handles_n = static_cast<DWORD>(entries.len + 1);
+	const auto timeout = wait_ms < 0 ? INFINITE : static_cast<DWORD>(wait_ms);
+	const auto stat = WaitForMultipleObjects(handles_n, handles, FALSE, timeout);
+	if (stat == WAIT_TIMEOUT) { return 0; }
+	if (stat == WAIT_FAILED) {
+		err = decode_os_err(GetLastError());
+		return 0;
+	}
+	if (stat < WAIT_OBJECT_0 || stat >= WAIT_OBJECT_0 + handles_n) {
+		err = create_err("Unexpected result from WaitForMultipleObjects");
+		return 0;
+	}
+
+	// only the first signalled handle is reported, so the rest are checked without blocking to fill the batch
+	const nat8_t first = stat - WAIT_OBJECT_0;
+	nat8_t events_n = 0;
+	for (auto i = first; i < handles_n && events_n < events_len; i += 1) {
+		if (i > first && WaitForSingleObject(handles[i], 0) != WAIT_OBJECT_0) { continue; }
+		if (i == 0) {
+			auto lock = acquire(st.mutex);
+			woken = st.woken;
+			st.woken = false;
+			continue;
+		}
+		const auto& entry = entries[i - 1];
+		auto& out = events_ptr[events_n++];
+		out = {};
+		out.token    = entry.token;
+		out.readable = true;
+		if (!entry.once) { continue; }
+
+		auto lock = acquire(st.mutex);
+		for (auto j : create_range(st.entries.len)) {
+			if (st.entries[j].handle != entry.handle) { continue; }
+			shrink(st.entries, j, 1);
+			break;
+		}
+	}
+	return events_n;
+	#endif
+}
+
+nat8_t wait (poller_t& poller, poll_event_t* events_ptr, nat8_t events_len, err_t& err)
+{
+	if (err) { return 0; }
+
+	auto& st = get_state(poller);
+	while (true) {
+		bool_t woken = false;
+		const auto events_n = wait_once(st, events_ptr, events_len, -1, woken, err);
+		if (err || events_n || woken) { return events_n; }
+	}
+}
+
+nat8_t wait (poller_t& poller, poll_event_t* events_ptr, nat8_t events_len, inter_t timeout, err_t& err)
+{
+	if (err) { return 0; }
+
+	auto& st = get_state(poller);
+	const auto deadline = get_current_inter() + timeout;
+	while (true) {
+		const auto now = get_current_inter();
+		const auto wait_ms = now >= deadline ? 0 : clamp(get_millisecs(deadline - now) + 1, 0, max<int>());
+
+		bool_t woken = false;
+		const auto events_n = wait_once(st, events_ptr, events_len, static_cast<int>(wait_ms), woken, err);
+		if (err || events_n || woken || wait_ms == 0) { return events_n; }
+	}
+}
+
+void_t wake (poller_t& poller, err_t& err)
+{
+	if (err) { return; }
+
+	auto& st = get_state(poller);
+
+	#ifdef __linux__
+	const nat8_t step = 1;
+	if (write(get_fd(st.waker), &step, sizeof(step)) < 0 && errno != EAGAIN) {
+		err = decode_os_err(errno);
+	}
+	#endif
+
+	#ifdef _WIN32
+	{ auto lock = acquire(st.mutex);
+		st.woken = true;
+	}
+	if (!SetEvent(get_handle(st.waker))) {
+		err = decode_os_err(GetLastError());
+	}
+	#endif
+}
+
+struct poll_waker_t
+{
+	poller_t* poller  {};
+	sem_t     started {};
+};
+
+void_t run_poll_waker (poll_waker_t& waker)
+{
+	err_t err;
+	signal(waker.started);
+	wake(*waker.poller, err);
+}
+
+define_test(poll, "pipe,thread,time,watch")
+{
+	err_t err;
+	auto poller = create_poller(err);
+	prove_same(as_text(err), "");
+
+	poll_event_t events[8];
+	prove_eq(wait(poller, events, 8, {}, err), 0);
+
+	// a pipe's readable end turns up once something's sent into the other
+	auto pp = pipe_create(err);
+	poll_opts_t opts;
+	opts.readable = true;
+	watch(poller, pp.right, opts, 1, err);
+	prove_same(as_text(err), "");
+	prove_eq(wait(poller, events, 8, {}, err), 0);
+	send(pp.left, "ping", err);
+	prove_eq(wait(poller, events, 8, create_inter_of_secs(1), err), 1);
+	prove_eq(events[0].token, 1);
+	prove_true(events[0].readable);
+	prove_false(events[0].hung_up);
+
+	// level triggered goes on reporting it until it's read, edge triggered just the once
+	prove_eq(wait(poller, events, 8, {}, err), 1);
+	opts.edge = true;
+	watch(poller, pp.right, opts, 2, err);
+	prove_eq(wait(poller, events, 8, {}, err), 1);
+	prove_eq(events[0].token, 2);
+	prove_eq(wait(poller, events, 8, {}, err), 0);
+	prove_same(recv(pp.right, err), "ping");
+
+	// several handles come back in one batch
+	sem_t sem;
+	signal(sem);
+	watch(poller, sem, 3, err);
+	auto met = create_metronome(err);
+	set_freq(met, create_inter_of_millisecs(1), err);
+	watch(poller, met, 4, err);
+	send(pp.left, "pong", err);
+	prove_same(as_text(err), "");
+
+	// each is drained as it turns up, so only what's still pending comes back next time
+	bool_t seen[5] = {};
+	nat8_t most_n = 0;
+	for (auto i : create_range(100)) {
+		unused(i);
+		const auto events_n = wait(poller, events, 8, create_inter_of_secs(1), err);
+		if (events_n > most_n) { most_n = events_n; }
+		for (auto j : create_range(events_n)) {
+			const auto token = events[j].token;
+			if (token >= 5 || seen[token]) { continue; }
+			seen[token] = true;
+			if (token == 2) { prove_same(recv(pp.right, err), "pong"); }
+			if (token == 3) { wait(sem); }
+			if (token == 4) { recv(met, err); }
+		}
+		if (seen[2] && seen[3] && seen[4]) { break; }
+	}
+	prove_true(seen[2]);
+	prove_true(seen[3]);
+	prove_true(seen[4]);
+	prove_gteq(most_n, 2);
+
+	unwatch(poller, met, err);
+	unwatch(poller, sem, err);
+	prove_eq(wait(poller, events, 8, {}, err), 0);
+
+	// a hang up counts as an event, even without data
+	{ auto gone = move(pp.left); }
+	prove_eq(wait(poller, events, 8, create_inter_of_secs(1), err), 1);
+	prove_true(events[0].hung_up);
+	unwatch(poller, pp.right, err);
+
+	// a burst bigger than the pipe goes through without blocking, queued until the loop finds room for it
+	auto flow = pipe_create(err);
+	auto data = create_str(256 * 1024);
+	for (auto i : create_range(data.len)) { data[i] = static_cast<nat1_t>(i % 251); }
+	ring_t queue;
+	send(flow.left, queue, data.ptr, data.len, err);
+	prove_gt(queue.len, 0);
+
+	poll_opts_t out_opts;
+	out_opts.writable = true;
+	watch(poller, flow.left, out_opts, 5, err);
+	poll_opts_t in_opts;
+	in_opts.readable = true;
+	watch(poller, flow.right, in_opts, 6, err);
+
+	auto inbox = create_ring(0);
+	nat8_t got_len = 0;
+	bool_t same = true;
+	while (got_len < data.len && !err) {
+		const auto events_n = wait(poller, events, 8, create_inter_of_secs(1), err);
+		if (!events_n) { break; }
+		for (auto i : create_range(events_n)) {
+			if (events[i].token == 5 && flush(flow.left, queue, err)) { unwatch(poller, flow.left, err); }
+			if (events[i].token != 6) { continue; }
+			recv(flow.right, inbox, err);
+			const auto views = get_views(inbox);
+			for (auto byte : views.first) { same = same && byte == data[got_len++]; }
+			for (auto byte : views.second) { same = same && byte == data[got_len++]; }
+			consume(inbox, inbox.len);
+		}
+	}
+	prove_same(as_text(err), "");
+	prove_eq(got_len, data.len);
+	prove_true(same);
+	prove_eq(queue.len, 0);
+	unwatch(poller, flow.right, err);
+
+	// and a wake from another thread ends a wait with nothing to report
+	poll_waker_t waker;
+	waker.poller = &poller;
+	spawn_thread(&run_poll_waker, waker, err);
+	wait(waker.started);
+	prove_eq(wait(poller, events, 8, err), 0);
+	wait_for_threads();
+
+	prove_same(as_text(err), "");
+	return {};
+}
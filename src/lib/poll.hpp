@@ -0,0 +1,67 @@
+#ifndef libcx3_poll_hpp
+#define libcx3_poll_hpp
+#include "prelude.hpp"
+#include "time.hpp"
+
+struct pipe_t;
+struct sem_t;
+struct watcher_t;
+struct io_ring_t;
+struct err_t;
+
+struct poll_opts_t
+{
+	bool_t   readable {};
+	bool_t   writable {};
+	bool_t   edge     {}; // reports each change once rather than for as long as it lasts, so drain until it'd block
+	bool_t   once     {}; // goes quiet after the first event until it's watched again
+	pad_t<4> padding  {};
+};
+
+struct poll_event_t
+{
+	nat8_t   token    {};
+	bool_t   readable {};
+	bool_t   writable {};
+	bool_t   hung_up  {}; // the other end's gone, or the handle's failed, so the next recv or send will say which
+	pad_t<5> padding  {};
+};
+
+// Safe to wake from any thread, but only one should wait on it at a time
+struct poller_t
+{
+	opaque_t opaq {};
+
+	poller_t ();
+	~poller_t ();
+	poller_t (const poller_t& ori) = delete;
+	poller_t& operator = (const poller_t& ori) = delete;
+	poller_t (poller_t&& ori);
+	poller_t& operator = (poller_t&& ori);
+
+	explicit operator bool_t () const;
+};
+
+poller_t create_poller (err_t& err);
+
+// Tokens come back with their handle's events, and can be anything but max<nat8_t>(). Watching a handle again
+// swaps its options and token, and re-arms it after a once. Windows waits on at most 63 handles, and can't wait on
+// anonymous pipes at all. Waiting there also takes a sem's count or a ring's completion signal, as wait would.
+void_t watch (poller_t& poller, pipe_t& pipe, const poll_opts_t& opts, nat8_t token, err_t& err);
+void_t watch (poller_t& poller, metronome_t& met, nat8_t token, err_t& err); // readable once it's ticked
+void_t watch (poller_t& poller, sem_t& sem, nat8_t token, err_t& err); // readable while it has a count
+void_t watch (poller_t& poller, watcher_t& watcher, nat8_t token, err_t& err); // readable when a batch is ready
+void_t watch (poller_t& poller, io_ring_t& ring, nat8_t token, err_t& err); // readable when it may have dones
+void_t unwatch (poller_t& poller, pipe_t& pipe, err_t& err);
+void_t unwatch (poller_t& poller, metronome_t& met, err_t& err);
+void_t unwatch (poller_t& poller, sem_t& sem, err_t& err);
+void_t unwatch (poller_t& poller, watcher_t& watcher, err_t& err);
+void_t unwatch (poller_t& poller, io_ring_t& ring, err_t& err);
+
+// Blocks until something's ready or it's woken, then takes up to events_len events in one go. Returns how many,
+// which is zero after a wake or the timeout, and a zero timeout just looks without blocking.
+nat8_t wait (poller_t& poller, poll_event_t* events_ptr, nat8_t events_len, err_t& err);
+nat8_t wait (poller_t& poller, poll_event_t* events_ptr, nat8_t events_len, inter_t timeout, err_t& err);
+void_t wake (poller_t& poller, err_t& err);
+
+#endif
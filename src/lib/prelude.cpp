@@ -91,6 +91,9 @@ void_t begin_main (const char* name, int argc, const char** argv,
 	args_n    = static_cast<nat8_t>(argc);
 	args_ptr  = argv;
 
+	void_t resolve_kernels ();
+	resolve_kernels();
+
 	#ifndef NTEST
 	void_t run_tests ();
 	run_tests();
@@ -129,6 +132,11 @@ void_t end_main ()
 {
 	wait_for_threads();
 
+	#ifdef TRACK_ALLOC
+	str_t report_mem (nat8_t sites_len);
+	fputs(as_strz(report_mem(16)).ptr, stderr);
+	#endif
+
 	void_t log_close ();
 	log_close();
 }
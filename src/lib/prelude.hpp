@@ -52,6 +52,14 @@ template<typename val_t> void_t unused (const val_t& val)
 	static_cast<void_t>(val);
 }
 
+// TRACK_ALLOC credits each allocation to alloc_mem's return address, so the templates that allocate for their
+// callers are forced inline, leaving that address in the caller rather than in the template
+#ifdef TRACK_ALLOC
+#define alloc_inline __attribute__((always_inline)) inline
+#else
+#define alloc_inline
+#endif
+
 struct opaque_t
 {
 	nat8_t val {};
@@ -149,14 +157,65 @@ template<typename el_t>       el_t* end   (      seq_t<el_t>& seq) { return &seq
 template<typename el_t> const el_t* begin (const seq_t<el_t>& seq) { return  seq.ptr;      }
 template<typename el_t> const el_t* end   (const seq_t<el_t>& seq) { return &seq[seq.len]; }
 
-template<typename el_t> void_t grow (seq_t<el_t>& seq, nat8_t ins_at, nat8_t ins_len)
+// Borrows elements owned elsewhere (a seq_t, a mapping, a buffer), so must not outlive them
+template<typename el_t> struct view_t
+{
+	el_t*  ptr {};
+	nat8_t len {};
+
+	el_t& operator [] (decltype(len) i) const
+	{
+		assert_lt(i, len);
+		return ptr[i];
+	}
+
+	explicit operator bool () const
+	{
+		return len > 0;
+	}
+};
+
+template<typename el_t> el_t* begin (const view_t<el_t>& view) { return view.ptr;            }
+template<typename el_t> el_t* end   (const view_t<el_t>& view) { return view.ptr + view.len; }
+
+template<typename el_t> view_t<el_t> create_view (el_t* ptr, nat8_t len)
+{
+	view_t<el_t> view;
+	view.ptr = ptr;
+	view.len = len;
+	return view;
+}
+
+template<typename el_t> view_t<      el_t> create_view (      seq_t<el_t>& seq) { return create_view(seq.ptr, seq.len); }
+template<typename el_t> view_t<const el_t> create_view (const seq_t<el_t>& seq)
+{
+	return create_view(static_cast<const el_t*>(seq.ptr), seq.len);
+}
+
+template<typename el_t> view_t<el_t> create_view (const view_t<el_t>& view, nat8_t at, nat8_t len)
+{
+	assert_lteq(at, view.len);
+	assert_lteq(len, view.len - at);
+	return create_view(view.ptr + at, len);
+}
+
+template<typename el_t> alloc_inline void_t grow (seq_t<el_t>& seq, nat8_t ins_at, nat8_t ins_len)
 {
 	void_t* alloc_mem (nat8_t len);
+	void_t* resize_mem (void_t* ptr, nat8_t old_len, nat8_t new_len);
 
 	assert_lteq(ins_at, seq.len);
 	if (!ins_len) { return; }
 
 	assert_init_zero<el_t>();
+	if constexpr (__is_trivially_copyable(el_t)) {
+		if (seq.ptr && ins_at == seq.len) {
+			const auto new_len = seq.len + ins_len;
+			seq.ptr = static_cast<el_t*>(resize_mem(seq.ptr, seq.len * sizeof(el_t), new_len * sizeof(el_t)));
+			seq.len = new_len;
+			return;
+		}
+	}
 	auto old = move(seq);
 
 	seq.len = old.len + ins_len;
@@ -170,14 +229,22 @@ template<typename el_t> void_t grow (seq_t<el_t>& seq, nat8_t ins_at, nat8_t ins
 	}
 }
 
-template<typename el_t> void_t shrink (seq_t<el_t>& seq, nat8_t rm_at, nat8_t rm_len)
+template<typename el_t> alloc_inline void_t shrink (seq_t<el_t>& seq, nat8_t rm_at, nat8_t rm_len)
 {
 	assert_lteq(rm_at, seq.len);
 	assert_lteq(rm_at + rm_len, seq.len);
 	if (!rm_len) { return; }
 
 	void_t* alloc_mem (nat8_t len);
+	void_t* resize_mem (void_t* ptr, nat8_t old_len, nat8_t new_len);
 
+	if constexpr (__is_trivially_copyable(el_t)) {
+		if (rm_at + rm_len == seq.len && rm_at > 0) {
+			seq.ptr = static_cast<el_t*>(resize_mem(seq.ptr, seq.len * sizeof(el_t), rm_at * sizeof(el_t)));
+			seq.len = rm_at;
+			return;
+		}
+	}
 	auto old = move(seq);
 
 	seq.len = old.len - rm_len;
@@ -191,14 +258,14 @@ template<typename el_t> void_t shrink (seq_t<el_t>& seq, nat8_t rm_at, nat8_t rm
 	}
 }
 
-template<typename el_t> seq_t<el_t> create_seq (nat8_t len)
+template<typename el_t> alloc_inline seq_t<el_t> create_seq (nat8_t len)
 {
 	seq_t<el_t> seq;
 	grow(seq, 0, len);
 	return seq;
 }
 
-template<typename el_t> seq_t<el_t> create_seq (const el_t* ptr, nat8_t len)
+template<typename el_t> alloc_inline seq_t<el_t> create_seq (const el_t* ptr, nat8_t len)
 {
 	seq_t<el_t> seq;
 	grow(seq, 0, len);
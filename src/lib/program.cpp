@@ -1,9 +1,11 @@
 #include "program.hpp"
 #include "text.hpp"
 #include "error.hpp"
+#include "file.hpp"
 #ifdef __unix__
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/wait.h>
 #include <errno.h>
 #endif
@@ -12,6 +14,13 @@
 #include <windows.h>
 #endif
 
+#ifdef __unix__
+int get_fd (opaque_t opaq);
+#endif
+#ifdef _WIN32
+HANDLE get_handle (opaque_t opaq);
+#endif
+
 str_t env_var (const str_t& key)
 {
 	if (!key) { return {}; }
@@ -30,6 +39,11 @@ str_t env_var (const str_t& key)
 }
 
 void_t run_program (const seq_t<str_t>& args, err_t& err)
+{
+	run_program(args, {}, err);
+}
+
+void_t run_program (const seq_t<str_t>& args, const view_t<file_t*>& files, err_t& err)
 {
 	if (err) { return; }
 	if (!args) {
@@ -47,8 +61,22 @@ void_t run_program (const seq_t<str_t>& args, err_t& err)
 		c_buf[i] = buf[i].ptr;
 	}
 
+	auto fds = create_seq<int>(files.len);
+	for (auto i : create_range(files.len)) {
+		fds[i] = get_fd(files[i]->opaq);
+	}
+
 	pid_t pid = fork();
 	if (pid == 0) {
+		// parked above the targets first, so no file lands on one that's still to be moved
+		const auto base = static_cast<int>(3 + fds.len);
+		for (auto& fd : fds) {
+			fd = fcntl(fd, F_DUPFD_CLOEXEC, base);
+			if (fd < 0) { abort(); }
+		}
+		for (auto i : create_range(fds.len)) {
+			if (dup2(fds[i], static_cast<int>(3 + i)) < 0) { abort(); }
+		}
 		execvp(c_buf[0], c_buf.ptr);
 		abort();
 	}
@@ -95,9 +123,17 @@ void_t run_program (const seq_t<str_t>& args, err_t& err)
 	STARTUPINFO start_info = {};
 	start_info.cb = sizeof(start_info);
 	PROCESS_INFORMATION proc_info = {};
-	if (!CreateProcess(as_wstr(args[0]).ptr, as_wstr(cmd).ptr, NULL, NULL, FALSE,
-	                   0, NULL, NULL, &start_info, &proc_info)) {
-		err = create_err("Couldn't create process") + decode_os_err(GetLastError());
+	for (auto file : files) {
+		SetHandleInformation(get_handle(file->opaq), HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+	}
+	const auto created = CreateProcess(as_wstr(args[0]).ptr, as_wstr(cmd).ptr, NULL, NULL, files ? TRUE : FALSE,
+	                                   0, NULL, NULL, &start_info, &proc_info);
+	const auto create_code = GetLastError();
+	for (auto file : files) {
+		SetHandleInformation(get_handle(file->opaq), HANDLE_FLAG_INHERIT, 0);
+	}
+	if (!created) {
+		err = create_err("Couldn't create process") + decode_os_err(create_code);
 		return;
 	}
 	if (WaitForSingleObject(proc_info.hProcess, INFINITE) != WAIT_OBJECT_0) {
@@ -108,3 +144,25 @@ void_t run_program (const seq_t<str_t>& args, err_t& err)
 	#endif
 }
 
+
+define_test(program, "path")
+{
+	#ifdef __unix__
+	err_t err;
+	auto scratch = create_scratch_file({}, err);
+	auto other = create_scratch_file({}, err);
+	file_t* files[] = { &other, &scratch };
+	seq_t<str_t> args;
+	grow(args, 0, 3);
+	args[0] = "sh";
+	args[1] = "-c";
+	args[2] = "printf from-child >&4";
+	run_program(args, create_view(files, 2), err);
+	prove_same(as_text(err), "");
+	set_cursor(scratch, 0, err);
+	prove_same(read_all(scratch, err), "from-child");
+	prove_eq(read_all(other, err).len, 0);
+	prove_same(as_text(err), "");
+	#endif
+	return {};
+}
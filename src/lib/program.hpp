@@ -7,5 +7,10 @@ str_t env_var (const str_t& key);
 struct err_t;
 void_t run_program (const seq_t<str_t>& args, err_t& e);
 
+// The files become descriptors 3 and up in the child, in order, as scratch files or pipes to share. Windows has no
+// numbering to hand them on by, so there the child inherits the handles as they are and has to be told their values.
+struct file_t;
+void_t run_program (const seq_t<str_t>& args, const view_t<file_t*>& files, err_t& err);
+
 #endif
 
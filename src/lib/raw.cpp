@@ -1,23 +1,272 @@
 #include "raw.hpp"
+#include "text.hpp"
+#include "error.hpp"
+#include "pipe.hpp"
+#include "file.hpp"
+#include "thread.hpp"
+#include "time.hpp"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#ifdef __unix__
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#ifdef TRACK_ALLOC
+#ifdef __unix__
+#include <execinfo.h>
+#include <dlfcn.h>
+#endif
+#endif
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-void_t* alloc_mem (nat8_t len)
+// big buffers get their own mappings, so they can use huge pages and be resized without copying
+const nat8_t map_min_len   = 1024 * 1024;
+const nat8_t huge_page_len = 1024 * 1024 * 2;
+
+[[noreturn]] void_t fail_alloc (nat8_t len)
 {
-	assert_gt(len, 0);
+	fprintf(stderr, "Couldn't allocate %llu bytes on the heap\n",
+			static_cast<unsigned long long int>(len));
+	abort();
+}
+
+#ifdef __unix__
+nat8_t round_to_page (nat8_t len)
+{
+	const auto page_len = static_cast<nat8_t>(sysconf(_SC_PAGESIZE));
+	return (len + page_len - 1) / page_len * page_len;
+}
+#endif
+
+void_t* alloc_raw_mem (nat8_t len)
+{
+	if (len >= map_min_len) {
+		#ifdef __unix__
+		const auto map_len = round_to_page(len);
+		if (auto ptr = mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		    ptr != MAP_FAILED) {
+			#ifdef MADV_HUGEPAGE
+			if (len >= huge_page_len) { madvise(ptr, map_len, MADV_HUGEPAGE); }
+			#endif
+			return ptr;
+		}
+		#endif
+		#ifdef _WIN32
+		if (auto ptr = VirtualAlloc(NULL, len, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE); ptr) {
+			return ptr;
+		}
+		#endif
+		fail_alloc(len);
+	}
 
 	if (auto ptr = calloc(len, 1); ptr) {
 		return ptr;
-	} else {
-		fprintf(stderr, "Couldn't allocate %llu bytes on the heap\n",
-				static_cast<unsigned long long int>(len));
-		abort();
 	}
+	fail_alloc(len);
+}
+
+void_t free_raw_mem (void_t* ptr, nat8_t len)
+{
+	if (len >= map_min_len) {
+		#ifdef __unix__
+		const auto stat = munmap(ptr, round_to_page(len));
+		assert_eq(stat, 0);
+		unused(stat);
+		#endif
+		#ifdef _WIN32
+		const auto succ = VirtualFree(ptr, 0, MEM_RELEASE);
+		assert_true(succ);
+		unused(succ);
+		#endif
+		return;
+	}
+	free(ptr);
+}
+
+void_t* resize_raw_mem (void_t* ptr, nat8_t old_len, nat8_t new_len)
+{
+	const auto old_mapped = old_len >= map_min_len;
+	const auto new_mapped = new_len >= map_min_len;
+
+	#ifdef __linux__
+	if (old_mapped && new_mapped) {
+		const auto old_map_len = round_to_page(old_len);
+		const auto new_map_len = round_to_page(new_len);
+		auto neo = ptr;
+		if (new_map_len != old_map_len) {
+			neo = mremap(ptr, old_map_len, new_map_len, MREMAP_MAYMOVE);
+			if (neo == MAP_FAILED) { fail_alloc(new_len); }
+			#ifdef MADV_HUGEPAGE
+			if (new_len >= huge_page_len) { madvise(neo, new_map_len, MADV_HUGEPAGE); }
+			#endif
+		}
+		// fresh pages are zeroed, but the slack in the old last page might not be
+		if (new_len > old_len) {
+			memset(static_cast<nat1_t*>(neo) + old_len, 0, (new_len < old_map_len ? new_len : old_map_len) - old_len);
+		}
+		return neo;
+	}
+	#endif
+
+	if (!old_mapped && !new_mapped) {
+		auto neo = realloc(ptr, new_len);
+		if (!neo) { fail_alloc(new_len); }
+		if (new_len > old_len) {
+			memset(static_cast<nat1_t*>(neo) + old_len, 0, new_len - old_len);
+		}
+		return neo;
+	}
+
+	auto neo = alloc_raw_mem(new_len);
+	memcpy(neo, ptr, old_len < new_len ? old_len : new_len);
+	free_raw_mem(ptr, old_len);
+	return neo;
+}
+
+#ifdef TRACK_ALLOC
+
+#ifdef TRACK_ALLOC_STACKS
+const nat8_t mem_site_depth = 8;
+#else
+const nat8_t mem_site_depth = 1;
+#endif
+const nat8_t mem_sites_len  = 1024;
+const nat8_t mem_probes_len = 16;
+
+struct mem_site_t
+{
+	nat8_t frames[mem_site_depth] {};
+	nat8_t allocs {}; // only touched by the owning thread
+	nat8_t bytes  {}; // ditto
+	nat8_t frees  {}; // atomic, any thread may free
+	nat8_t freed  {}; // ditto
+};
+
+struct mem_tally_t
+{
+	mem_tally_t* next        {};
+	nat8_t       allocs      {};
+	nat8_t       frees       {};
+	nat8_t       classes[64] {};
+	mem_site_t   sites[mem_sites_len] {};
+};
+
+struct mem_head_t
+{
+	mem_site_t* site {};
+	nat8_t      len  {};
+};
+static_assert(sizeof(mem_head_t) == 16);
+
+bool_t set_atomic_cmp (nat8_t& datum, nat8_t cond, nat8_t val);
+nat8_t add_atomic (nat8_t& datum, nat8_t val);
+nat8_t sub_atomic (nat8_t& datum, nat8_t val);
+
+nat8_t mem_tallies;
+nat8_t mem_live;
+nat8_t mem_peak;
+thread_local mem_tally_t* mem_tally;
+
+mem_tally_t& get_mem_tally ()
+{
+	if (mem_tally) { return *mem_tally; }
+
+	// the tallies outlive their threads so that late frees and reports can still reach them
+	auto tally = static_cast<mem_tally_t*>(alloc_raw_mem(sizeof(mem_tally_t)));
+	for (auto head = mem_tallies; ; head = mem_tallies) {
+		tally->next = reinterpret_cast<mem_tally_t*>(head);
+		if (set_atomic_cmp(mem_tallies, head, reinterpret_cast<nat8_t>(tally))) { break; }
+	}
+	mem_tally = tally;
+	return *tally;
+}
+
+nat8_t get_mem_class (nat8_t len)
+{
+	assert_gt(len, 0);
+	if (len == 1) { return 0; }
+	return clamp(64 - static_cast<nat8_t>(__builtin_clzll(len - 1)), 0, 63);
+}
+
+mem_site_t* find_mem_site (mem_tally_t& tally, const nat8_t (&frames)[mem_site_depth])
+{
+	nat8_t hash = 14695981039346656037ULL;
+	for (auto frame : frames) {
+		hash = (hash ^ frame) * 1099511628211ULL;
+	}
+
+	mem_site_t* site = nullptr;
+	for (auto i : create_range(mem_probes_len)) {
+		site = &tally.sites[(hash + i) % mem_sites_len];
+		if (!site->allocs) {
+			// not copy_mem, whose tuning may hand the copy to other threads, which would allocate in turn
+			memcpy(site->frames, frames, sizeof(frames));
+			return site;
+		}
+		if (is_mem_eq(site->frames, sizeof(site->frames), frames, sizeof(frames))) {
+			return site;
+		}
+	}
+	return site; // the table's crowded, so share the last probed site
+}
+
+mem_site_t* tally_alloc (nat8_t len, nat8_t ret_addr)
+{
+	nat8_t frames[mem_site_depth] = {};
+	#ifdef TRACK_ALLOC_STACKS
+	unused(ret_addr);
+	void_t* trace[mem_site_depth + 2] = {};
+	#ifdef __unix__
+	const auto trace_len = static_cast<nat8_t>(backtrace(trace, static_cast<int>(mem_site_depth + 2)));
+	#endif
+	#ifdef _WIN32
+	const auto trace_len = static_cast<nat8_t>(CaptureStackBackTrace(0, mem_site_depth + 2, trace, NULL));
+	#endif
+	for (auto i : create_range(trace_len > 2 ? trace_len - 2 : 0)) {
+		frames[i] = reinterpret_cast<nat8_t>(trace[i + 2]);
+	}
+	#else
+	frames[0] = ret_addr;
+	#endif
+
+	auto& tally = get_mem_tally();
+	auto site = find_mem_site(tally, frames);
+	++site->allocs;
+	site->bytes += len;
+	++tally.allocs;
+	++tally.classes[get_mem_class(len)];
+
+	const auto live = add_atomic(mem_live, len);
+	for (auto peak = mem_peak; live > peak; peak = mem_peak) {
+		if (set_atomic_cmp(mem_peak, peak, live)) { break; }
+	}
+	return site;
+}
+
+void_t tally_free (mem_head_t& head)
+{
+	add_atomic(head.site->frees, 1);
+	add_atomic(head.site->freed, head.len);
+	++get_mem_tally().frees;
+	sub_atomic(mem_live, head.len);
+}
+
+void_t* alloc_mem (nat8_t len)
+{
+	assert_gt(len, 0);
+
+	auto site = tally_alloc(len, reinterpret_cast<nat8_t>(__builtin_return_address(0)));
+	auto head = static_cast<mem_head_t*>(alloc_raw_mem(sizeof(mem_head_t) + len));
+	head->site = site;
+	head->len  = len;
+	return head + 1;
 }
 
 void_t free_mem (void_t* ptr, nat8_t len)
@@ -25,8 +274,227 @@ void_t free_mem (void_t* ptr, nat8_t len)
 	assert_true(ptr);
 	assert_gt(len, 0);
 
-	unused(len);
-	free(ptr);
+	auto head = static_cast<mem_head_t*>(ptr) - 1;
+	assert_eq(head->len, len);
+	tally_free(*head);
+	free_raw_mem(head, sizeof(mem_head_t) + len);
+}
+
+void_t* resize_mem (void_t* ptr, nat8_t old_len, nat8_t new_len)
+{
+	assert_true(ptr);
+	assert_gt(old_len, 0);
+	assert_gt(new_len, 0);
+
+	auto head = static_cast<mem_head_t*>(ptr) - 1;
+	assert_eq(head->len, old_len);
+	tally_free(*head);
+	auto site = tally_alloc(new_len, reinterpret_cast<nat8_t>(__builtin_return_address(0)));
+	head = static_cast<mem_head_t*>(resize_raw_mem(head, sizeof(mem_head_t) + old_len, sizeof(mem_head_t) + new_len));
+	head->site = site;
+	head->len  = new_len;
+	return head + 1;
+}
+
+#else
+
+void_t* alloc_mem (nat8_t len)
+{
+	assert_gt(len, 0);
+
+	return alloc_raw_mem(len);
+}
+
+void_t free_mem (void_t* ptr, nat8_t len)
+{
+	assert_true(ptr);
+	assert_gt(len, 0);
+
+	free_raw_mem(ptr, len);
+}
+
+void_t* resize_mem (void_t* ptr, nat8_t old_len, nat8_t new_len)
+{
+	assert_true(ptr);
+	assert_gt(old_len, 0);
+	assert_gt(new_len, 0);
+
+	return resize_raw_mem(ptr, old_len, new_len);
+}
+
+#endif
+
+// The offset back to the start of the allocation sits just before the aligned pointer
+void_t* alloc_aligned_mem (nat8_t len, nat8_t align)
+{
+	assert_gt(len, 0);
+	assert_eq(align & (align - 1), 0);
+	assert_gteq(align, sizeof(nat8_t));
+
+	const auto raw = static_cast<nat1_t*>(alloc_mem(len + align + sizeof(nat8_t)));
+	const auto raw_at = reinterpret_cast<nat8_t>(raw) + sizeof(nat8_t);
+	const auto ptr = raw + sizeof(nat8_t) + ((align - raw_at % align) % align);
+	const nat8_t back = static_cast<nat8_t>(ptr - raw);
+	copy_mem(ptr - sizeof(back), &back, sizeof(back));
+	return ptr;
+}
+
+void_t free_aligned_mem (void_t* ptr, nat8_t len, nat8_t align)
+{
+	assert_true(ptr);
+	nat8_t back = 0;
+	copy_mem(&back, static_cast<nat1_t*>(ptr) - sizeof(back), sizeof(back));
+	free_mem(static_cast<nat1_t*>(ptr) - back, len + align + sizeof(nat8_t));
+}
+
+aligned_buf_t::aligned_buf_t () { }
+aligned_buf_t::~aligned_buf_t ()
+{
+	if (!ptr) { return; }
+	free_aligned_mem(ptr, len, align);
+}
+
+aligned_buf_t::aligned_buf_t (aligned_buf_t&& ori) { *this = move(ori); }
+aligned_buf_t& aligned_buf_t::operator = (aligned_buf_t&& ori)
+{
+	if (&ori != this) {
+		this->~aligned_buf_t();
+		ptr   = ori.ptr;
+		len   = ori.len;
+		align = ori.align;
+		ori.ptr   = {};
+		ori.len   = {};
+		ori.align = {};
+	}
+	return *this;
+}
+
+aligned_buf_t create_aligned_buf (nat8_t len, nat8_t align)
+{
+	aligned_buf_t buf;
+	if (!len) { return buf; }
+	buf.align = align ? align : 4096;
+	buf.len   = len;
+	buf.ptr   = static_cast<nat1_t*>(alloc_aligned_mem(len, buf.align));
+	return buf;
+}
+
+view_t<nat1_t> create_view (aligned_buf_t& buf)
+{
+	return create_view(buf.ptr, buf.len);
+}
+
+copy_tuning_t copy_tuning = {1024 * 1024 * 8, max<nat8_t>(), 1};
+
+copy_tuning_t get_copy_tuning ()
+{
+	return copy_tuning;
+}
+
+void_t set_copy_tuning (const copy_tuning_t& tuning)
+{
+	copy_tuning = tuning;
+}
+
+void_t copy_streamed (nat1_t* dst, const nat1_t* src, nat8_t len)
+{
+	#ifdef __SSE2__
+	// the stores bypass the cache, so a huge copy doesn't evict everything else
+	const auto head_len = clamp((16 - reinterpret_cast<nat8_t>(dst) % 16) % 16, 0, len);
+	memcpy(dst, src, head_len);
+	dst += head_len;
+	src += head_len;
+	len -= head_len;
+
+	for (; len >= 64; dst += 64, src += 64, len -= 64) {
+		const auto src_vec = static_cast<const __m128i*>(static_cast<const void_t*>(src));
+		const auto dst_vec = static_cast<__m128i*>(static_cast<void_t*>(dst));
+		const auto a = _mm_loadu_si128(&src_vec[0]);
+		const auto b = _mm_loadu_si128(&src_vec[1]);
+		const auto c = _mm_loadu_si128(&src_vec[2]);
+		const auto d = _mm_loadu_si128(&src_vec[3]);
+		_mm_stream_si128(&dst_vec[0], a);
+		_mm_stream_si128(&dst_vec[1], b);
+		_mm_stream_si128(&dst_vec[2], c);
+		_mm_stream_si128(&dst_vec[3], d);
+	}
+	_mm_sfence();
+	#endif
+	memcpy(dst, src, len);
+}
+
+struct copy_job_t
+{
+	nat1_t*       dst    {};
+	const nat1_t* src    {};
+	nat8_t        len    {};
+	sem_t*        done   {};
+	bool_t        stream {};
+	pad_t<7>      padding {};
+};
+
+void_t run_copy_job (copy_job_t& job)
+{
+	if (job.stream) {
+		copy_streamed(job.dst, job.src, job.len);
+	} else {
+		memcpy(job.dst, job.src, job.len);
+	}
+	if (job.done) { signal(*job.done); }
+}
+
+void_t copy_split (nat1_t* dst, const nat1_t* src, nat8_t len, const copy_tuning_t& tuning)
+{
+	const auto jobs_n   = clamp(tuning.split_n, 1, 64);
+	const auto chunk_len = ((len + jobs_n - 1) / jobs_n + 4095) / 4096 * 4096;
+
+	sem_t done;
+	copy_job_t jobs[64];
+	nat8_t spawned_n = 0;
+	for (auto i : create_range(jobs_n)) {
+		auto& job = jobs[i];
+		const auto at = clamp(i * chunk_len, 0, len);
+		job.dst    = dst + at;
+		job.src    = src + at;
+		job.len    = i + 1 == jobs_n ? len - at : clamp(len - at, 0, chunk_len); // the last takes any remainder
+		job.stream = job.len >= tuning.stream_min_len;
+		if (i + 1 == jobs_n || !job.len) {
+			run_copy_job(job);
+			continue;
+		}
+
+		// any chunk that can't get its own thread is copied by this one instead
+		err_t err;
+		job.done = &done;
+		spawn_thread(&run_copy_job, job, err);
+		if (err) {
+			job.done = nullptr;
+			run_copy_job(job);
+		} else {
+			++spawned_n;
+		}
+	}
+	for (auto i : create_range(spawned_n)) {
+		unused(i);
+		wait(done);
+	}
+}
+
+void_t copy_tuned (void_t* dst, const void_t* src, nat8_t len, const copy_tuning_t& tuning)
+{
+	if (len >= tuning.stream_min_len || len >= tuning.split_min_len) {
+		const auto dst_at = reinterpret_cast<nat8_t>(dst);
+		const auto src_at = reinterpret_cast<nat8_t>(src);
+		if (dst_at + len <= src_at || src_at + len <= dst_at) {
+			if (len >= tuning.split_min_len && tuning.split_n > 1) {
+				copy_split(static_cast<nat1_t*>(dst), static_cast<const nat1_t*>(src), len, tuning);
+			} else {
+				copy_streamed(static_cast<nat1_t*>(dst), static_cast<const nat1_t*>(src), len);
+			}
+			return;
+		}
+	}
+	memmove(dst, src, len);
 }
 
 void_t copy_mem (void_t* dst, const void_t* src, nat8_t len)
@@ -36,7 +504,55 @@ void_t copy_mem (void_t* dst, const void_t* src, nat8_t len)
 	}
 	assert_true(dst);
 	assert_true(src);
-	memmove(dst, src, len);
+	copy_tuned(dst, src, len, copy_tuning);
+}
+
+inter_t time_copy (nat1_t* dst, const nat1_t* src, nat8_t len, const copy_tuning_t& tuning)
+{
+	inter_t best = {max<nat8_t>(), 0};
+	for (auto i : create_range(3)) {
+		unused(i);
+		const auto begin = get_current_inter();
+		copy_tuned(dst, src, len, tuning);
+		if (const auto spent = get_current_inter() - begin; spent < best) {
+			best = spent;
+		}
+	}
+	return best;
+}
+
+copy_tuning_t tune_copy_mem (nat8_t max_len, nat8_t split_n)
+{
+	const nat8_t min_len = 1024 * 256;
+	max_len = clamp(max_len, min_len, max<nat8_t>() / 2);
+
+	// copies can't overlap, so one allocation serves as both ends
+	auto buf = create_seq<nat1_t>(max_len * 2);
+	for (auto i : create_range(buf.len)) {
+		buf[i] = static_cast<nat1_t>(i);
+	}
+	const auto dst = &buf[0];
+	const auto src = &buf[max_len];
+
+	// a crossover is the shortest length past which a strategy always wins
+	copy_tuning_t plain  = {max<nat8_t>(), max<nat8_t>(), 1};
+	copy_tuning_t stream = {0,             max<nat8_t>(), 1};
+	copy_tuning_t prod   = plain;
+	for (auto len = max_len; len >= min_len; len /= 2) {
+		if (time_copy(dst, src, len, stream) >= time_copy(dst, src, len, plain)) { break; }
+		prod.stream_min_len = len;
+	}
+
+	prod.split_n = clamp(split_n, 1, 64);
+	if (prod.split_n > 1) {
+		copy_tuning_t split = prod;
+		split.split_min_len = 0;
+		for (auto len = max_len; len >= min_len; len /= 2) {
+			if (time_copy(dst, src, len, split) >= time_copy(dst, src, len, prod)) { break; }
+			prod.split_min_len = len;
+		}
+	}
+	return prod;
 }
 
 bool_t is_mem_eq (const void_t* left_ptr, nat8_t left_len, const void_t* right_ptr, nat8_t right_len)
@@ -45,3 +561,242 @@ bool_t is_mem_eq (const void_t* left_ptr, nat8_t left_len, const void_t* right_p
 	return memcmp(left_ptr, right_ptr, left_len) == 0;
 }
 
+mem_stats_t get_mem_stats ()
+{
+	mem_stats_t stats;
+	#ifdef TRACK_ALLOC
+	stats.live = mem_live;
+	stats.peak = mem_peak;
+	for (auto tally = reinterpret_cast<const mem_tally_t*>(mem_tallies); tally; tally = tally->next) {
+		stats.allocs += tally->allocs;
+		stats.frees  += tally->frees;
+		for (auto i : create_range(sizeof(stats.classes) / sizeof(*stats.classes))) {
+			stats.classes[i] += tally->classes[i];
+		}
+	}
+	#endif
+	return stats;
+}
+
+#ifdef TRACK_ALLOC
+str_t describe_mem_frame (nat8_t frame)
+{
+	char buf[512] = {};
+	#ifdef __unix__
+	if (Dl_info info = {}; dladdr(reinterpret_cast<void_t*>(frame), &info) && info.dli_sname) {
+		snprintf(buf, sizeof(buf), "0x%llx %s+0x%llx", static_cast<unsigned long long>(frame), info.dli_sname,
+		         static_cast<unsigned long long>(frame - reinterpret_cast<nat8_t>(info.dli_saddr)));
+		return buf;
+	}
+	#endif
+	snprintf(buf, sizeof(buf), "0x%llx", static_cast<unsigned long long>(frame));
+	return buf;
+}
+
+str_t describe_mem_site (const mem_site_t& site)
+{
+	auto text = as_text(site.bytes - site.freed) + " bytes live in " + as_text(site.allocs - site.frees) +
+	            " of " + as_text(site.allocs) + " allocations (" + as_text(site.bytes) + " bytes) from";
+	for (auto frame : site.frames) {
+		if (!frame) { break; }
+		text = text + get_line_sep() + "    " + describe_mem_frame(frame);
+	}
+	return text;
+}
+
+seq_t<mem_site_t> merge_mem_sites ()
+{
+	seq_t<mem_site_t> sites;
+	for (auto tally = reinterpret_cast<const mem_tally_t*>(mem_tallies); tally; tally = tally->next) {
+		for (const auto& site : tally->sites) {
+			if (!site.allocs) { continue; }
+
+			auto merged = false;
+			for (auto& prev : sites) {
+				if (is_mem_eq(prev.frames, sizeof(prev.frames), site.frames, sizeof(site.frames))) {
+					prev.allocs += site.allocs;
+					prev.bytes  += site.bytes;
+					prev.frees  += site.frees;
+					prev.freed  += site.freed;
+					merged = true;
+					break;
+				}
+			}
+			if (!merged) {
+				grow(sites, sites.len, 1);
+				sites[sites.len - 1] = site;
+			}
+		}
+	}
+	return sites;
+}
+
+nat8_t rank_mem_site (const mem_site_t& site, bool_t by_live)
+{
+	return by_live ? site.bytes - site.freed : site.allocs;
+}
+
+str_t report_mem_sites (const seq_t<mem_site_t>& sites, nat8_t sites_len, bool_t by_live)
+{
+	auto ranked = create_seq<const mem_site_t*>(sites.len);
+	for (auto i : create_range(sites.len)) {
+		auto j = i;
+		for (; j > 0 && rank_mem_site(*ranked[j - 1], by_live) < rank_mem_site(sites[i], by_live); --j) {
+			ranked[j] = ranked[j - 1];
+		}
+		ranked[j] = &sites[i];
+	}
+
+	str_t text;
+	for (auto i : create_range(clamp(sites_len, 0, ranked.len))) {
+		if (!rank_mem_site(*ranked[i], by_live)) { break; }
+		text = text + "  " + describe_mem_site(*ranked[i]) + get_line_sep();
+	}
+	return text;
+}
+#endif
+
+str_t report_mem (nat8_t sites_len)
+{
+	#ifdef TRACK_ALLOC
+	const auto stats = get_mem_stats();
+	auto text = "Memory: " + as_text(stats.live) + " bytes live, " + as_text(stats.peak) + " bytes at peak, " +
+	            as_text(stats.allocs) + " allocations, " + as_text(stats.frees) + " frees" + get_line_sep();
+	for (auto i : create_range(sizeof(stats.classes) / sizeof(*stats.classes))) {
+		if (stats.classes[i]) {
+			text = text + "  Up to " + as_text(1ULL << i) + " bytes: " + as_text(stats.classes[i]) +
+			       " allocations" + get_line_sep();
+		}
+	}
+	const auto sites = merge_mem_sites();
+	text = text + "Live sites:" + get_line_sep() + report_mem_sites(sites, sites_len, true);
+	text = text + "Hot sites:"  + get_line_sep() + report_mem_sites(sites, sites_len, false);
+	return text;
+	#else
+	unused(sites_len);
+	return "Memory: not tracked, build with TRACK_ALLOC" + get_line_sep();
+	#endif
+}
+
+void_t report_mem (pipe_t& pipe, err_t& err)
+{
+	send(pipe, report_mem(16), err);
+}
+
+void_t report_mem (file_t& file, err_t& err)
+{
+	write(file, report_mem(16), err);
+}
+
+define_test(raw, "text")
+{
+	const auto before = get_mem_stats();
+	auto ptr = alloc_mem(100);
+	free_mem(ptr, 100);
+	const auto after = get_mem_stats();
+
+	#ifdef TRACK_ALLOC
+	prove_eq(after.allocs - before.allocs, 1);
+	prove_eq(after.frees  - before.frees,  1);
+	prove_eq(after.classes[7] - before.classes[7], 1);
+	prove_eq(after.live, before.live);
+	prove_gteq(after.peak, 100);
+	#else
+	prove_eq(after.allocs, before.allocs);
+	prove_eq(after.peak, 0);
+	#endif
+
+	prove_true(report_mem(4));
+
+	#ifdef TRACK_ALLOC
+	// two allocations made here through the same helper are still two sites
+	{ const auto has = [] (const str_t& text, const char* part) {
+			const auto part_len = strlen(part);
+			for (nat8_t i = 0; i + part_len <= text.len; ++i) {
+				if (is_mem_eq(text.ptr + i, part_len, part, part_len)) { return true; }
+			}
+			return false;
+		};
+		const auto first  = create_seq<nat1_t>(12345);
+		const auto second = create_seq<nat1_t>(23456);
+		const auto report = report_mem(max<nat8_t>());
+		prove_true(has(report, " of 1 allocations (12,345 bytes)"));
+		prove_true(has(report, " of 1 allocations (23,456 bytes)"));
+	}
+	#endif
+
+	{ auto big = create_str(map_min_len + 1);
+		big[0] = 'a';
+		big[big.len - 1] = 'z';
+		grow(big, big.len, huge_page_len);
+		prove_eq(big[0], 'a');
+		prove_eq(big[map_min_len], 'z');
+		prove_eq(big[map_min_len + 1], 0);
+		prove_eq(big[big.len - 1], 0);
+		shrink(big, 1, big.len - 1);
+		prove_eq(big.len, 1);
+		prove_eq(big[0], 'a');
+		grow(big, big.len, 1);
+		prove_eq(big[1], 0);
+	}
+
+	{ const auto tuning = get_copy_tuning();
+		set_copy_tuning({1, 1, 3});
+		auto src = create_str(1024 * 1024 + 7);
+		for (auto i : create_range(src.len)) {
+			src[i] = static_cast<nat1_t>(i * 7);
+		}
+		auto dst = clone(src);
+		prove_true(dst == src);
+		copy_mem(&dst[1], &dst[3], 100);
+		prove_eq(dst[1], src[3]);
+
+		// a length that doesn't split evenly still gets its tail copied
+		set_copy_tuning({1, 1, 4});
+		auto uneven = create_str(4 * 4096 + 3);
+		copy_mem(uneven.ptr, src.ptr, uneven.len);
+		auto want = create_str(src.ptr, uneven.len);
+		prove_true(uneven == want);
+		set_copy_tuning(tuning);
+
+		// each crossover is either never, or one of the lengths tried, halving from max_len down to 256 KiB
+		const nat8_t max_len = 1024 * 1024 * 2;
+		const auto is_tried = [&] (nat8_t len) {
+			if (len == max<nat8_t>()) { return true; }
+			for (auto tried = max_len; tried >= 1024 * 256; tried /= 2) {
+				if (len == tried) { return true; }
+			}
+			return false;
+		};
+		const auto tuned = tune_copy_mem(max_len, 2);
+		prove_eq(tuned.split_n, 2);
+		prove_true(is_tried(tuned.stream_min_len));
+		prove_true(is_tried(tuned.split_min_len));
+		prove_eq(tune_copy_mem(max_len, 1).split_min_len, max<nat8_t>());
+		prove_eq(get_copy_tuning().stream_min_len, tuning.stream_min_len);
+
+		// so a copy of max_len takes whichever path won, and that path copies exactly
+		set_copy_tuning(tuned);
+		auto big_src = create_str(max_len);
+		for (auto i : create_range(big_src.len)) {
+			big_src[i] = static_cast<nat1_t>(i * 13 + i / 4096);
+		}
+		auto big_dst = create_str(max_len);
+		copy_mem(big_dst.ptr, big_src.ptr, big_dst.len);
+		prove_true(big_dst == big_src);
+		set_copy_tuning(tuning);
+	}
+
+	for (nat8_t align = 8; align <= 1024 * 64; align *= 8) {
+		auto buf = create_aligned_buf(align * 3 + 1, align);
+		prove_eq(reinterpret_cast<nat8_t>(buf.ptr) % align, 0);
+		buf.ptr[0] = 1;
+		buf.ptr[buf.len - 1] = 2;
+		auto moved = move(buf);
+		prove_false(buf.ptr);
+		prove_eq(create_view(moved).len, align * 3 + 1);
+	}
+	prove_eq(reinterpret_cast<nat8_t>(create_aligned_buf(10, 0).ptr) % 4096, 0);
+
+	return {};
+}
@@ -4,17 +4,70 @@
 
 void_t* alloc_mem (nat8_t len);
 void_t free_mem (void_t* ptr, nat8_t len);
+void_t* resize_mem (void_t* ptr, nat8_t old_len, nat8_t new_len);
 
 void_t copy_mem (void_t* dst, const void_t* src, nat8_t len);
 
+// For direct i/o, which wants buffers lined up with the device's blocks. Tracked like alloc_mem.
+void_t* alloc_aligned_mem (nat8_t len, nat8_t align);
+void_t free_aligned_mem (void_t* ptr, nat8_t len, nat8_t align);
+
+struct aligned_buf_t
+{
+	nat1_t* ptr   {};
+	nat8_t  len   {};
+	nat8_t  align {};
+
+	aligned_buf_t ();
+	~aligned_buf_t ();
+	aligned_buf_t (const aligned_buf_t& ori) = delete;
+	aligned_buf_t& operator = (const aligned_buf_t& ori) = delete;
+	aligned_buf_t (aligned_buf_t&& ori);
+	aligned_buf_t& operator = (aligned_buf_t&& ori);
+};
+
+aligned_buf_t create_aligned_buf (nat8_t len, nat8_t align); // an align of zero picks 4096, the usual page
+view_t<nat1_t> create_view (aligned_buf_t& buf);
+
 template<typename T> seq_t<T> clone_mem (const seq_t<T>& src)
 {
 	auto prod = create_seq<T>(src.len);
-	copy_mem(prod.ptr, src.ptr, src.len);
+	copy_mem(prod.ptr, src.ptr, src.len * sizeof(T));
 	return prod;
 }
 
+struct copy_tuning_t
+{
+	nat8_t stream_min_len {}; // copies this long bypass the cache
+	nat8_t split_min_len  {}; // copies this long are split between threads
+	nat8_t split_n        {};
+};
+
+copy_tuning_t get_copy_tuning ();
+void_t set_copy_tuning (const copy_tuning_t& tuning);
+copy_tuning_t tune_copy_mem (nat8_t max_len, nat8_t split_n);
+
 bool_t is_mem_eq (const void_t* left_ptr, nat8_t left_len, const void_t* right_ptr, nat8_t right_len);
 
-#endif
+// Only gathered when built with TRACK_ALLOC (and TRACK_ALLOC_STACKS for whole call stacks). Without stacks, a site
+// is the function that called the allocator, seeing through the seq and box templates, but allocations made
+// through other helpers (create_str, say) are all credited to the helper.
+struct mem_stats_t
+{
+	nat8_t live        {};
+	nat8_t peak        {};
+	nat8_t allocs      {};
+	nat8_t frees       {};
+	nat8_t classes[64] {}; // allocations of up to 2^i bytes
+};
 
+mem_stats_t get_mem_stats ();
+str_t report_mem (nat8_t sites_len);
+
+struct err_t;
+struct pipe_t;
+struct file_t;
+void_t report_mem (pipe_t& pipe, err_t& err);
+void_t report_mem (file_t& file, err_t& err);
+
+#endif
@@ -0,0 +1,57 @@
+#include "simd.hpp"
+
+define_test(simd, "")
+{
+	alignas(16) nat1_t bytes[16] {};
+	for (auto i : create_range(16)) { bytes[i] = static_cast<nat1_t>(i * 3); }
+
+	const auto a = load<16>(bytes);
+	const auto b = load_unaligned<16>(bytes + 0);
+	const auto sum = a + b;
+	prove_eq(sum[5], 30);
+	prove_eq(reduce_sum(a), 360);
+	prove_eq(reduce_min(a), 0);
+	prove_eq(reduce_max(a), 45);
+
+	const auto ten = splat<nat1_t, 16>(10);
+	prove_eq(movemask(cmp_lt(a, ten)), 0xF);
+	prove_eq(movemask(cmp_gt(a, ten)), 0xFFF0);
+	prove_eq(popcount(cmp_eq(a, a)), 16);
+	prove_eq(popcount(cmp_eq(a, ten)), 0);
+
+	const auto low = select(cmp_lt(a, ten), a, ten);
+	prove_eq(low[2], 6);
+	prove_eq(low[9], 10);
+
+	simd_t<nat1_t, 16> rev;
+	for (auto i : create_range(16)) { rev[i] = static_cast<nat1_t>(15 - i); }
+	const auto backward = shuffle(a, rev);
+	prove_eq(backward[0], 45);
+	prove_eq(backward[15], 0);
+
+	// indices wrap, except ones with the top bit set, which give zero
+	rev[0] = 0x80;
+	rev[1] = 17;
+	const auto odd = shuffle(a, rev);
+	prove_eq(odd[0], 0);
+	prove_eq(odd[1], 3);
+	prove_eq(odd[2], 39);
+
+	alignas(16) nat1_t out[16] {};
+	store(out, a ^ ten);
+	prove_eq(out[1], 3 ^ 10);
+
+	simd_t<rat8_t, 4> rats;
+	for (auto i : create_range(4)) { rats[i] = static_cast<rat8_t>(i) + 0.5; }
+	const auto halves = rats * splat<rat8_t, 4>(2);
+	prove_eq(static_cast<nat8_t>(reduce_sum(halves)), 16);
+	prove_eq(movemask(cmp_lt(halves, splat<rat8_t, 4>(4))), 0x3);
+
+	simd_t<nat4_t, 2> narrow;
+	narrow[0] = 7;
+	narrow[1] = 0x80000000;
+	prove_eq(movemask(cmp_gt(narrow, splat<nat4_t, 2>(8))), 0x2);
+	prove_eq(reduce_sum(narrow), 0x80000007ULL);
+
+	return {};
+}
@@ -0,0 +1,428 @@
+#ifndef libcx3_simd_hpp
+#define libcx3_simd_hpp
+#include "prelude.hpp"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+// Lanes are nat1_t to nat8_t or rat4_t/rat8_t. 16-byte vectors map onto SSE2 registers when the target has them,
+// and every other shape (or target) falls back to per-lane loops. Wider registers are left to kernels dispatched by
+// platform.hpp, which use their own intrinsics, since the build never assumes more than SSE2.
+
+template<typename el_t, nat8_t n> struct simd_t
+{
+	static_assert(n > 0 && (n & (n - 1)) == 0);
+
+	alignas(sizeof(el_t) * n) el_t lanes[n] {};
+
+	el_t& operator [] (nat8_t i)
+	{
+		assert_lt(i, n);
+		return lanes[i];
+	}
+
+	const el_t& operator [] (nat8_t i) const
+	{
+		assert_lt(i, n);
+		return lanes[i];
+	}
+};
+
+template<typename el_t> using simd_nat_t = decltype(nat_wrap_t<sizeof(el_t)>::u);
+template<typename el_t, nat8_t n> using simd_mask_t = simd_t<simd_nat_t<el_t>, n>;
+
+template<typename el_t> constexpr bool_t is_simd_rat = static_cast<el_t>(1) / 2 > 0;
+template<typename el_t, nat8_t n> constexpr bool_t is_simd_xmm = sizeof(el_t) * n == 16;
+template<typename el_t, nat8_t n> constexpr bool_t is_simd_ymm = sizeof(el_t) * n == 32;
+
+template<typename el_t> struct simd_wide_t         { typedef nat8_t type; };
+template<>              struct simd_wide_t<rat4_t> { typedef rat8_t type; };
+template<>              struct simd_wide_t<rat8_t> { typedef rat8_t type; };
+
+template<typename vec_t, typename el_t, nat8_t n> vec_t as_vec (const simd_t<el_t, n>& v)
+{
+	static_assert(sizeof(vec_t) == sizeof(v));
+	vec_t vec;
+	__builtin_memcpy(&vec, v.lanes, sizeof(vec));
+	return vec;
+}
+
+template<typename el_t, nat8_t n, typename vec_t> simd_t<el_t, n> create_simd (const vec_t& vec)
+{
+	static_assert(sizeof(vec) == sizeof(simd_t<el_t, n>));
+	simd_t<el_t, n> v;
+	__builtin_memcpy(v.lanes, &vec, sizeof(vec));
+	return v;
+}
+
+template<typename el_t, nat8_t n> simd_t<el_t, n> splat (el_t val)
+{
+	simd_t<el_t, n> v;
+	for (auto i : create_range(n)) { v.lanes[i] = val; }
+	return v;
+}
+
+template<nat8_t n, typename el_t> simd_t<el_t, n> load (const el_t* ptr)
+{
+	assert_eq(reinterpret_cast<nat8_t>(ptr) % alignof(simd_t<el_t, n>), 0);
+
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		return create_simd<el_t, n>(_mm_load_si128(static_cast<const __m128i*>(static_cast<const void_t*>(ptr))));
+	}
+	#endif
+	simd_t<el_t, n> v;
+	for (auto i : create_range(n)) { v.lanes[i] = ptr[i]; }
+	return v;
+}
+
+template<nat8_t n, typename el_t> simd_t<el_t, n> load_unaligned (const el_t* ptr)
+{
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		return create_simd<el_t, n>(_mm_loadu_si128(static_cast<const __m128i*>(static_cast<const void_t*>(ptr))));
+	}
+	#endif
+	simd_t<el_t, n> v;
+	__builtin_memcpy(v.lanes, ptr, sizeof(v.lanes));
+	return v;
+}
+
+template<typename el_t, nat8_t n> void_t store (el_t* ptr, const simd_t<el_t, n>& v)
+{
+	assert_eq(reinterpret_cast<nat8_t>(ptr) % alignof(simd_t<el_t, n>), 0);
+
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		_mm_store_si128(static_cast<__m128i*>(static_cast<void_t*>(ptr)), as_vec<__m128i>(v));
+		return;
+	}
+	#endif
+	for (auto i : create_range(n)) { ptr[i] = v.lanes[i]; }
+}
+
+template<typename el_t, nat8_t n> void_t store_unaligned (el_t* ptr, const simd_t<el_t, n>& v)
+{
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		_mm_storeu_si128(static_cast<__m128i*>(static_cast<void_t*>(ptr)), as_vec<__m128i>(v));
+		return;
+	}
+	#endif
+	__builtin_memcpy(ptr, v.lanes, sizeof(v.lanes));
+}
+
+template<typename el_t, nat8_t n> simd_t<el_t, n> operator + (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		if constexpr (is_simd_rat<el_t> && sizeof(el_t) == 4) {
+			return create_simd<el_t, n>(_mm_add_ps(as_vec<__m128>(left), as_vec<__m128>(right)));
+		} else if constexpr (is_simd_rat<el_t>) {
+			return create_simd<el_t, n>(_mm_add_pd(as_vec<__m128d>(left), as_vec<__m128d>(right)));
+		} else if constexpr (sizeof(el_t) == 1) {
+			return create_simd<el_t, n>(_mm_add_epi8(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		} else if constexpr (sizeof(el_t) == 2) {
+			return create_simd<el_t, n>(_mm_add_epi16(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		} else if constexpr (sizeof(el_t) == 4) {
+			return create_simd<el_t, n>(_mm_add_epi32(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		} else {
+			return create_simd<el_t, n>(_mm_add_epi64(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		}
+	}
+	#endif
+	simd_t<el_t, n> prod;
+	for (auto i : create_range(n)) { prod.lanes[i] = static_cast<el_t>(left.lanes[i] + right.lanes[i]); }
+	return prod;
+}
+
+template<typename el_t, nat8_t n> simd_t<el_t, n> operator - (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		if constexpr (is_simd_rat<el_t> && sizeof(el_t) == 4) {
+			return create_simd<el_t, n>(_mm_sub_ps(as_vec<__m128>(left), as_vec<__m128>(right)));
+		} else if constexpr (is_simd_rat<el_t>) {
+			return create_simd<el_t, n>(_mm_sub_pd(as_vec<__m128d>(left), as_vec<__m128d>(right)));
+		} else if constexpr (sizeof(el_t) == 1) {
+			return create_simd<el_t, n>(_mm_sub_epi8(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		} else if constexpr (sizeof(el_t) == 2) {
+			return create_simd<el_t, n>(_mm_sub_epi16(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		} else if constexpr (sizeof(el_t) == 4) {
+			return create_simd<el_t, n>(_mm_sub_epi32(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		} else {
+			return create_simd<el_t, n>(_mm_sub_epi64(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		}
+	}
+	#endif
+	simd_t<el_t, n> prod;
+	for (auto i : create_range(n)) { prod.lanes[i] = static_cast<el_t>(left.lanes[i] - right.lanes[i]); }
+	return prod;
+}
+
+template<typename el_t, nat8_t n> simd_t<el_t, n> operator * (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		if constexpr (is_simd_rat<el_t> && sizeof(el_t) == 4) {
+			return create_simd<el_t, n>(_mm_mul_ps(as_vec<__m128>(left), as_vec<__m128>(right)));
+		} else if constexpr (is_simd_rat<el_t>) {
+			return create_simd<el_t, n>(_mm_mul_pd(as_vec<__m128d>(left), as_vec<__m128d>(right)));
+		} else if constexpr (sizeof(el_t) == 2) {
+			return create_simd<el_t, n>(_mm_mullo_epi16(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		}
+	}
+	#endif
+	simd_t<el_t, n> prod;
+	for (auto i : create_range(n)) { prod.lanes[i] = static_cast<el_t>(left.lanes[i] * right.lanes[i]); }
+	return prod;
+}
+
+template<typename el_t, nat8_t n> simd_t<el_t, n> operator / (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	static_assert(is_simd_rat<el_t>);
+
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		if constexpr (sizeof(el_t) == 4) {
+			return create_simd<el_t, n>(_mm_div_ps(as_vec<__m128>(left), as_vec<__m128>(right)));
+		} else {
+			return create_simd<el_t, n>(_mm_div_pd(as_vec<__m128d>(left), as_vec<__m128d>(right)));
+		}
+	}
+	#endif
+	simd_t<el_t, n> prod;
+	for (auto i : create_range(n)) { prod.lanes[i] = left.lanes[i] / right.lanes[i]; }
+	return prod;
+}
+
+template<typename el_t, nat8_t n> simd_t<el_t, n> operator & (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	static_assert(!is_simd_rat<el_t>);
+
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		return create_simd<el_t, n>(_mm_and_si128(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+	}
+	#endif
+	simd_t<el_t, n> prod;
+	for (auto i : create_range(n)) { prod.lanes[i] = static_cast<el_t>(left.lanes[i] & right.lanes[i]); }
+	return prod;
+}
+
+template<typename el_t, nat8_t n> simd_t<el_t, n> operator | (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	static_assert(!is_simd_rat<el_t>);
+
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		return create_simd<el_t, n>(_mm_or_si128(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+	}
+	#endif
+	simd_t<el_t, n> prod;
+	for (auto i : create_range(n)) { prod.lanes[i] = static_cast<el_t>(left.lanes[i] | right.lanes[i]); }
+	return prod;
+}
+
+template<typename el_t, nat8_t n> simd_t<el_t, n> operator ^ (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	static_assert(!is_simd_rat<el_t>);
+
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		return create_simd<el_t, n>(_mm_xor_si128(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+	}
+	#endif
+	simd_t<el_t, n> prod;
+	for (auto i : create_range(n)) { prod.lanes[i] = static_cast<el_t>(left.lanes[i] ^ right.lanes[i]); }
+	return prod;
+}
+
+template<typename el_t, nat8_t n> simd_t<el_t, n> min (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		if constexpr (is_simd_rat<el_t> && sizeof(el_t) == 4) {
+			return create_simd<el_t, n>(_mm_min_ps(as_vec<__m128>(left), as_vec<__m128>(right)));
+		} else if constexpr (is_simd_rat<el_t>) {
+			return create_simd<el_t, n>(_mm_min_pd(as_vec<__m128d>(left), as_vec<__m128d>(right)));
+		} else if constexpr (sizeof(el_t) == 1) {
+			return create_simd<el_t, n>(_mm_min_epu8(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		}
+	}
+	#endif
+	simd_t<el_t, n> prod;
+	for (auto i : create_range(n)) { prod.lanes[i] = right.lanes[i] < left.lanes[i] ? right.lanes[i] : left.lanes[i]; }
+	return prod;
+}
+
+template<typename el_t, nat8_t n> simd_t<el_t, n> max (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		if constexpr (is_simd_rat<el_t> && sizeof(el_t) == 4) {
+			return create_simd<el_t, n>(_mm_max_ps(as_vec<__m128>(left), as_vec<__m128>(right)));
+		} else if constexpr (is_simd_rat<el_t>) {
+			return create_simd<el_t, n>(_mm_max_pd(as_vec<__m128d>(left), as_vec<__m128d>(right)));
+		} else if constexpr (sizeof(el_t) == 1) {
+			return create_simd<el_t, n>(_mm_max_epu8(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		}
+	}
+	#endif
+	simd_t<el_t, n> prod;
+	for (auto i : create_range(n)) { prod.lanes[i] = left.lanes[i] < right.lanes[i] ? right.lanes[i] : left.lanes[i]; }
+	return prod;
+}
+
+template<typename el_t, nat8_t n> simd_mask_t<el_t, n> cmp_eq (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		if constexpr (is_simd_rat<el_t> && sizeof(el_t) == 4) {
+			return create_simd<simd_nat_t<el_t>, n>(_mm_cmpeq_ps(as_vec<__m128>(left), as_vec<__m128>(right)));
+		} else if constexpr (is_simd_rat<el_t>) {
+			return create_simd<simd_nat_t<el_t>, n>(_mm_cmpeq_pd(as_vec<__m128d>(left), as_vec<__m128d>(right)));
+		} else if constexpr (sizeof(el_t) == 1) {
+			return create_simd<el_t, n>(_mm_cmpeq_epi8(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		} else if constexpr (sizeof(el_t) == 2) {
+			return create_simd<el_t, n>(_mm_cmpeq_epi16(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		} else if constexpr (sizeof(el_t) == 4) {
+			return create_simd<el_t, n>(_mm_cmpeq_epi32(as_vec<__m128i>(left), as_vec<__m128i>(right)));
+		}
+	}
+	#endif
+	simd_mask_t<el_t, n> prod;
+	for (auto i : create_range(n)) {
+		// written without == so that rat lanes don't trip -Wfloat-equal, NaNs still compare unequal
+		const auto eq = left.lanes[i] <= right.lanes[i] && left.lanes[i] >= right.lanes[i];
+		prod.lanes[i] = eq ? static_cast<simd_nat_t<el_t>>(max<simd_nat_t<el_t>>()) : 0;
+	}
+	return prod;
+}
+
+template<typename el_t, nat8_t n> simd_mask_t<el_t, n> cmp_lt (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		if constexpr (is_simd_rat<el_t> && sizeof(el_t) == 4) {
+			return create_simd<simd_nat_t<el_t>, n>(_mm_cmplt_ps(as_vec<__m128>(left), as_vec<__m128>(right)));
+		} else if constexpr (is_simd_rat<el_t>) {
+			return create_simd<simd_nat_t<el_t>, n>(_mm_cmplt_pd(as_vec<__m128d>(left), as_vec<__m128d>(right)));
+		} else if constexpr (sizeof(el_t) <= 4) {
+			// SSE2 only compares signed lanes, so flip the sign bits of both sides first
+			const auto bias = splat<el_t, n>(static_cast<el_t>(1ULL << (sizeof(el_t) * 8 - 1)));
+			const auto l = as_vec<__m128i>(left ^ bias);
+			const auto r = as_vec<__m128i>(right ^ bias);
+			if constexpr (sizeof(el_t) == 1) {
+				return create_simd<el_t, n>(_mm_cmplt_epi8(l, r));
+			} else if constexpr (sizeof(el_t) == 2) {
+				return create_simd<el_t, n>(_mm_cmplt_epi16(l, r));
+			} else {
+				return create_simd<el_t, n>(_mm_cmplt_epi32(l, r));
+			}
+		}
+	}
+	#endif
+	simd_mask_t<el_t, n> prod;
+	for (auto i : create_range(n)) {
+		prod.lanes[i] = left.lanes[i] < right.lanes[i] ? static_cast<simd_nat_t<el_t>>(max<simd_nat_t<el_t>>()) : 0;
+	}
+	return prod;
+}
+
+template<typename el_t, nat8_t n> simd_mask_t<el_t, n> cmp_gt (const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	return cmp_lt(right, left);
+}
+
+template<typename el_t, nat8_t n> simd_t<el_t, n> select (const simd_mask_t<el_t, n>& mask,
+                                                          const simd_t<el_t, n>& left, const simd_t<el_t, n>& right)
+{
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		const auto m = as_vec<__m128i>(mask);
+		return create_simd<el_t, n>(_mm_or_si128(_mm_and_si128(m, as_vec<__m128i>(left)),
+		                                         _mm_andnot_si128(m, as_vec<__m128i>(right))));
+	}
+	#endif
+	simd_t<el_t, n> prod;
+	for (auto i : create_range(n)) { prod.lanes[i] = mask.lanes[i] ? left.lanes[i] : right.lanes[i]; }
+	return prod;
+}
+
+// Lane i takes lane ixs[i] % n of v, or zero when the index has its top bit set, as pshufb does
+template<typename el_t, nat8_t n> simd_t<el_t, n> shuffle (const simd_t<el_t, n>& v, const simd_mask_t<el_t, n>& ixs)
+{
+	#ifdef __SSSE3__
+	if constexpr (is_simd_xmm<el_t, n> && sizeof(el_t) == 1) {
+		return create_simd<el_t, n>(_mm_shuffle_epi8(as_vec<__m128i>(v), as_vec<__m128i>(ixs)));
+	}
+	#endif
+	simd_t<el_t, n> prod;
+	for (auto i : create_range(n)) {
+		const auto ix = ixs.lanes[i];
+		prod.lanes[i] = ix >> (sizeof(ix) * 8 - 1) ? el_t{} : v.lanes[ix % n];
+	}
+	return prod;
+}
+
+template<typename el_t, nat8_t n> nat8_t movemask (const simd_t<el_t, n>& mask)
+{
+	static_assert(!is_simd_rat<el_t>);
+	static_assert(n <= 64);
+
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n>) {
+		if constexpr (sizeof(el_t) == 1) {
+			return static_cast<nat8_t>(_mm_movemask_epi8(as_vec<__m128i>(mask)));
+		} else if constexpr (sizeof(el_t) == 4) {
+			return static_cast<nat8_t>(_mm_movemask_ps(as_vec<__m128>(mask)));
+		} else if constexpr (sizeof(el_t) == 8) {
+			return static_cast<nat8_t>(_mm_movemask_pd(as_vec<__m128d>(mask)));
+		}
+	}
+	#endif
+	nat8_t bits = 0;
+	for (auto i : create_range(n)) {
+		bits |= static_cast<nat8_t>(mask.lanes[i] >> (sizeof(el_t) * 8 - 1)) << i;
+	}
+	return bits;
+}
+
+template<typename el_t, nat8_t n> nat8_t popcount (const simd_t<el_t, n>& mask)
+{
+	return static_cast<nat8_t>(__builtin_popcountll(movemask(mask)));
+}
+
+template<typename el_t, nat8_t n> typename simd_wide_t<el_t>::type reduce_sum (const simd_t<el_t, n>& v)
+{
+	#ifdef __SSE2__
+	if constexpr (is_simd_xmm<el_t, n> && sizeof(el_t) == 1) {
+		const auto sums = _mm_sad_epu8(as_vec<__m128i>(v), _mm_setzero_si128());
+		return static_cast<nat8_t>(_mm_cvtsi128_si64(sums)) +
+		       static_cast<nat8_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums)));
+	}
+	#endif
+	typename simd_wide_t<el_t>::type sum = 0;
+	for (auto lane : v.lanes) { sum += lane; }
+	return sum;
+}
+
+template<typename el_t, nat8_t n> el_t reduce_min (const simd_t<el_t, n>& v)
+{
+	auto least = v.lanes[0];
+	for (auto lane : v.lanes) { least = lane < least ? lane : least; }
+	return least;
+}
+
+template<typename el_t, nat8_t n> el_t reduce_max (const simd_t<el_t, n>& v)
+{
+	auto most = v.lanes[0];
+	for (auto lane : v.lanes) { most = most < lane ? lane : most; }
+	return most;
+}
+
+#endif
@@ -0,0 +1,278 @@
+#include "stream.hpp"
+#include "file.hpp"
+#include "pipe.hpp"
+#include "error.hpp"
+#include "text.hpp"
+#include "raw.hpp"
+#ifdef __unix__
+#include <poll.h>
+#include <errno.h>
+#endif
+
+#ifdef __unix__
+void_t wait_for_fd (opaque_t opaq, short events, err_t& err);
+#endif
+
+const nat8_t default_buf_len = 64 * 1024;
+
+nat8_t recv_some (pipe_t& pipe, nat1_t* ptr, nat8_t len, err_t& err)
+{
+	#ifdef __unix__
+	// readable with nothing to read means the other end has gone
+	wait_for_fd(pipe.h_in, POLLIN, err);
+	#endif
+	return recv(pipe, ptr, len, err);
+}
+
+buf_writer_t::buf_writer_t () { }
+buf_writer_t::~buf_writer_t ()
+{
+	err_t err;
+	flush(*this, err);
+}
+
+buf_writer_t::buf_writer_t (buf_writer_t&& ori) { *this = move(ori); }
+buf_writer_t& buf_writer_t::operator = (buf_writer_t&& ori)
+{
+	if (&ori != this) {
+		this->~buf_writer_t();
+		file = ori.file;
+		pipe = ori.pipe;
+		buf  = move(ori.buf);
+		len  = ori.len;
+		ori.file = {};
+		ori.pipe = {};
+		ori.len  = {};
+	}
+	return *this;
+}
+
+buf_writer_t create_buf_writer (file_t& file, nat8_t buf_len)
+{
+	buf_writer_t writer;
+	writer.file = &file;
+	writer.buf = create_str(buf_len ? buf_len : default_buf_len);
+	return writer;
+}
+
+buf_writer_t create_buf_writer (pipe_t& pipe, nat8_t buf_len)
+{
+	buf_writer_t writer;
+	writer.pipe = &pipe;
+	writer.buf = create_str(buf_len ? buf_len : default_buf_len);
+	return writer;
+}
+
+void_t write_through (buf_writer_t& writer, const nat1_t* ptr, nat8_t len, err_t& err)
+{
+	if (writer.file) {
+		write(*writer.file, ptr, len, err);
+	} else {
+		assert_true(writer.pipe);
+		send_all(*writer.pipe, ptr, len, err);
+	}
+}
+
+void_t flush (buf_writer_t& writer, err_t& err)
+{
+	if (err || !writer.len) { return; }
+
+	const auto len = writer.len;
+	writer.len = 0;
+	write_through(writer, writer.buf.ptr, len, err);
+}
+
+void_t write (buf_writer_t& writer, const void_t* ptr, nat8_t len, err_t& err)
+{
+	if (err) { return; }
+
+	if (writer.len + len > writer.buf.len) {
+		flush(writer, err);
+		if (err) { return; }
+	}
+	if (len >= writer.buf.len) {
+		write_through(writer, static_cast<const nat1_t*>(ptr), len, err);
+		return;
+	}
+	copy_mem(&writer.buf[writer.len], ptr, len);
+	writer.len += len;
+}
+
+void_t write (buf_writer_t& writer, const str_t& data, err_t& err)
+{
+	write(writer, data.ptr, data.len, err);
+}
+
+buf_reader_t create_buf_reader (file_t& file, nat8_t buf_len)
+{
+	buf_reader_t reader;
+	reader.file = &file;
+	reader.buf = create_str(buf_len ? buf_len : default_buf_len);
+	return reader;
+}
+
+buf_reader_t create_buf_reader (pipe_t& pipe, nat8_t buf_len)
+{
+	buf_reader_t reader;
+	reader.pipe = &pipe;
+	reader.buf = create_str(buf_len ? buf_len : default_buf_len);
+	return reader;
+}
+
+nat8_t read_through (buf_reader_t& reader, nat1_t* ptr, nat8_t len, err_t& err)
+{
+	if (reader.file) { return read_some(*reader.file, ptr, len, err); }
+	assert_true(reader.pipe);
+	return recv_some(*reader.pipe, ptr, len, err);
+}
+
+// Tops up the buffer after the unread bytes, moving them to the front first if that makes room
+bool_t fill (buf_reader_t& reader, err_t& err)
+{
+	if (err || reader.ended) { return false; }
+
+	if (reader.at + reader.len == reader.buf.len) {
+		if (reader.at == 0) {
+			grow(reader.buf, reader.buf.len, reader.buf.len);
+		} else {
+			__builtin_memmove(reader.buf.ptr, reader.buf.ptr + reader.at, reader.len);
+			reader.at = 0;
+		}
+	}
+
+	const auto end = reader.at + reader.len;
+	const auto red = read_through(reader, reader.buf.ptr + end, reader.buf.len - end, err);
+	if (err) { return false; }
+	if (red == 0) {
+		reader.ended = true;
+		return false;
+	}
+	reader.len += red;
+	return true;
+}
+
+nat8_t read (buf_reader_t& reader, void_t* ptr, nat8_t len, err_t& err)
+{
+	if (err) { return {}; }
+
+	const auto dst = static_cast<nat1_t*>(ptr);
+	nat8_t i = 0;
+	while (i < len) {
+		if (reader.len) {
+			const auto n = reader.len < len - i ? reader.len : len - i;
+			copy_mem(&dst[i], reader.buf.ptr + reader.at, n);
+			reader.at  += n;
+			reader.len -= n;
+			i += n;
+		} else if (len - i >= reader.buf.len) {
+			reader.at = 0;
+			if (reader.ended) { break; }
+			const auto red = read_through(reader, &dst[i], len - i, err);
+			if (err) { return {}; }
+			if (red == 0) { reader.ended = true; }
+			i += red;
+		} else {
+			reader.at = 0;
+			if (!fill(reader, err)) { break; }
+		}
+	}
+	if (err) { return {}; }
+	return i;
+}
+
+view_t<const nat1_t> next_record (buf_reader_t& reader, nat1_t delim, err_t& err)
+{
+	if (err) { return {}; }
+
+	nat8_t searched = 0;
+	while (true) {
+		const auto start = reader.buf.ptr + reader.at;
+		if (const auto hit = __builtin_memchr(start + searched, delim, reader.len - searched)) {
+			const auto rec_len = static_cast<nat8_t>(static_cast<const nat1_t*>(hit) - start);
+			reader.at  += rec_len + 1;
+			reader.len -= rec_len + 1;
+			return create_view(static_cast<const nat1_t*>(start), rec_len);
+		}
+		searched = reader.len;
+		if (!fill(reader, err)) { break; }
+	}
+	if (err) { return {}; }
+
+	// the last record needn't end with a delim
+	if (!reader.len) { return {}; }
+	const auto rec = create_view(static_cast<const nat1_t*>(reader.buf.ptr + reader.at), reader.len);
+	reader.at += reader.len;
+	reader.len = 0;
+	return rec;
+}
+
+view_t<const nat1_t> next_line (buf_reader_t& reader, err_t& err)
+{
+	auto line = next_record(reader, '\n', err);
+	if (line && line[line.len - 1] == '\r') { --line.len; }
+	return line;
+}
+
+define_test(stream, "path,error")
+{
+	err_t err;
+	const auto path = create_temp_path(err);
+	{
+		auto file = open_file(path, true, err);
+		auto writer = create_buf_writer(file, 16);
+		write(writer, "first line\r\n", err);
+		write(writer, "", err);
+		write(writer, "\n", err);
+		write(writer, "a line longer than the whole buffer\n", err);
+		for (auto i : create_range(1000)) {
+			write(writer, as_text(i) + "\n", err);
+		}
+		write(writer, "no newline", err);
+		flush(writer, err);
+		prove_same(as_text(err), "");
+	}
+	{
+		auto file = open_file(path, false, err);
+		auto reader = create_buf_reader(file, 8);
+		prove_same(create_str(next_line(reader, err)), "first line");
+		const auto empty = next_line(reader, err);
+		prove_true(empty.ptr);
+		prove_eq(empty.len, 0);
+		prove_eq(next_line(reader, err).len, 35);
+		for (auto i : create_range(1000)) {
+			prove_same(create_str(next_line(reader, err)), as_text(i));
+		}
+		prove_same(create_str(next_line(reader, err)), "no newline");
+		prove_false(next_line(reader, err).ptr);
+		prove_false(next_line(reader, err).ptr);
+		prove_same(as_text(err), "");
+	}
+	{
+		auto file = open_file(path, false, err);
+		auto reader = create_buf_reader(file, 8);
+		auto head = create_str(5);
+		prove_eq(read(reader, head.ptr, head.len, err), 5);
+		prove_same(head, "first");
+		auto rest = create_str(64 * 1024);
+		const auto rest_len = read(reader, rest.ptr, rest.len, err);
+		auto whole = open_file(path, false, err);
+		prove_eq(rest_len + 5, read_all(whole, err).len);
+		prove_same(create_str(rest.ptr, 7), " line\r\n");
+		prove_eq(read(reader, rest.ptr, rest.len, err), 0);
+		prove_same(as_text(err), "");
+	}
+
+	auto pipes = pipe_create(err);
+	{
+		auto writer = create_buf_writer(pipes.left, 0);
+		auto reader = create_buf_reader(pipes.right, 0);
+		write(writer, "over\nthe pipe\n", err);
+		flush(writer, err);
+		prove_same(create_str(next_line(reader, err)), "over");
+		prove_same(create_str(next_line(reader, err)), "the pipe");
+		prove_same(as_text(err), "");
+	}
+
+	remove_file(path, err);
+	return {};
+}
@@ -0,0 +1,54 @@
+#ifndef libcx3_stream_hpp
+#define libcx3_stream_hpp
+#include "prelude.hpp"
+
+struct file_t;
+struct pipe_t;
+struct err_t;
+
+// Each side borrows its file or pipe, which must outlive it. Pipes are waited on when they're not ready, so the
+// std streams from begin_main and the non-blocking ends from pipe_create both work.
+
+struct buf_writer_t
+{
+	file_t* file {};
+	pipe_t* pipe {};
+	str_t   buf  {};
+	nat8_t  len  {}; // bytes of buf waiting to go out
+
+	buf_writer_t ();
+	~buf_writer_t (); // flushes, but any error is lost, so flush first when it matters
+	buf_writer_t (const buf_writer_t& ori) = delete;
+	buf_writer_t& operator = (const buf_writer_t& ori) = delete;
+	buf_writer_t (buf_writer_t&& ori);
+	buf_writer_t& operator = (buf_writer_t&& ori);
+};
+
+// A buf_len of zero picks 64 KiB. Writes at least that long skip the buffer.
+buf_writer_t create_buf_writer (file_t& file, nat8_t buf_len);
+buf_writer_t create_buf_writer (pipe_t& pipe, nat8_t buf_len);
+void_t write (buf_writer_t& writer, const void_t* ptr, nat8_t len, err_t& err);
+void_t write (buf_writer_t& writer, const str_t& data, err_t& err);
+void_t flush (buf_writer_t& writer, err_t& err);
+
+struct buf_reader_t
+{
+	file_t*  file    {};
+	pipe_t*  pipe    {};
+	str_t    buf     {};
+	nat8_t   at      {}; // where the unread bytes of buf start
+	nat8_t   len     {}; // and how many there are
+	bool_t   ended   {};
+	pad_t<7> padding {};
+};
+
+buf_reader_t create_buf_reader (file_t& file, nat8_t buf_len);
+buf_reader_t create_buf_reader (pipe_t& pipe, nat8_t buf_len);
+nat8_t read (buf_reader_t& reader, void_t* ptr, nat8_t len, err_t& err); // short only at the end
+
+// Views point into the reader's buffer and last until its next call. The buffer grows for records longer than it.
+// Once the input runs out, the view's ptr is null (an empty record or line has a ptr but no len).
+view_t<const nat1_t> next_record (buf_reader_t& reader, nat1_t delim, err_t& err); // without the delim
+view_t<const nat1_t> next_line (buf_reader_t& reader, err_t& err); // without the \n or \r\n
+
+#endif
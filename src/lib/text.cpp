@@ -24,6 +24,11 @@ str_t create_str (const void_t* ptr, nat8_t len)
 	return create_seq<nat1_t>(static_cast<const nat1_t*>(ptr), len);
 }
 
+str_t create_str (const view_t<const nat1_t>& view)
+{
+	return create_str(view.ptr, view.len);
+}
+
 str_t clone (const str_t& text)
 {
 	auto neo = create_seq<nat1_t>(text.len);
@@ -4,6 +4,7 @@
 
 str_t create_str (nat8_t len);
 str_t create_str (const void_t* ptr, nat8_t len);
+str_t create_str (const view_t<const nat1_t>& view);
 
 str_t clone (const str_t& text);
 
@@ -27,6 +27,28 @@ bool_t set_atomic_cmp (nat8_t& datum, nat8_t cond, nat8_t val)
 	#endif
 }
 
+nat8_t add_atomic (nat8_t& datum, nat8_t val)
+{
+	#ifdef __unix__
+	return __sync_add_and_fetch(&datum, val);
+	#endif
+	#ifdef _WIN32
+	auto ptr = const_cast<volatile LONG64*>(reinterpret_cast<LONG64*>(&datum));
+	return static_cast<nat8_t>(InterlockedExchangeAdd64(ptr, static_cast<LONG64>(val))) + val;
+	#endif
+}
+
+nat8_t sub_atomic (nat8_t& datum, nat8_t val)
+{
+	#ifdef __unix__
+	return __sync_sub_and_fetch(&datum, val);
+	#endif
+	#ifdef _WIN32
+	auto ptr = const_cast<volatile LONG64*>(reinterpret_cast<LONG64*>(&datum));
+	return static_cast<nat8_t>(InterlockedExchangeAdd64(ptr, -static_cast<LONG64>(val))) - val;
+	#endif
+}
+
 #ifdef __unix__
 int get_fd (opaque_t opaq);
 opaque_t create_opaque_fd (int fd);
@@ -347,7 +347,7 @@ metronome_t::operator bool_t () const
 	return bool_t(opaq);
 }
 
-metronome_t metronome_create (err_t& err)
+metronome_t create_metronome (err_t& err)
 {
 	if (err) { return {}; }
 
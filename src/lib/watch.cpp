@@ -0,0 +1,546 @@
+#include "watch.hpp"
+#include "dir.hpp"
+#include "error.hpp"
+#include "text.hpp"
+#include "raw.hpp"
+#include "box.hpp"
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#ifdef __unix__
+int get_fd (opaque_t opaq);
+opaque_t create_opaque_fd (int fd);
+#endif
+#ifdef _WIN32
+HANDLE get_handle (opaque_t opaq);
+opaque_t create_opaque_handle (HANDLE h);
+#endif
+void_t* get_ptr (opaque_t opaq);
+opaque_t create_opaque_ptr (void_t* ptr);
+
+#ifdef __linux__
+const nat4_t watch_mask = IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                          IN_DELETE_SELF | IN_MOVE_SELF;
+#endif
+#ifdef _WIN32
+const DWORD watch_filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE |
+                           FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_ATTRIBUTES;
+const nat8_t notify_buf_len = 64 * 1024;
+#endif
+
+struct watch_entry_t
+{
+	path_t   path      {};
+	#ifdef __linux__
+	int      wd        {};
+	#endif
+	#ifdef _WIN32
+	opaque_t dir       {};
+	str_t    io        {}; // an OVERLAPPED, then the buffer it fills, somewhere that won't move while it's pending
+	str_t    only_name {}; // windows watches directories, so a file is watched through its parent
+	#endif
+	bool_t   recursive {};
+	#ifdef __linux__
+	pad_t<3> padding   {};
+	#endif
+	#ifdef _WIN32
+	pad_t<7> padding   {};
+	#endif
+};
+
+struct watcher_state_t
+{
+	#ifdef __linux__
+	opaque_t             notify  {};
+	opaque_t             timer   {};
+	opaque_t             epoll   {};
+	str_t                buf     {};
+	#endif
+	#ifdef _WIN32
+	opaque_t             event   {}; // set by every watch's read as it completes
+	#endif
+	inter_t              window  {};
+	seq_t<watch_entry_t> watches {}; // by wd on linux
+	seq_t<change_t>      pending {};
+	bool_t               armed   {}; // the window's open
+	pad_t<7>             padding {};
+};
+
+watcher_state_t& get_state (const watcher_t& watcher)
+{
+	assert_true(watcher.opaq);
+	return *static_cast<watcher_state_t*>(get_ptr(watcher.opaq));
+}
+
+// Merges with the path's last change, so a burst of writes is one modification and a file made and removed
+// within the window never shows up at all
+void_t note_change (watcher_state_t& st, path_t&& path, change_kind_t kind)
+{
+	for (auto i : create_range(st.pending.len)) {
+		const auto at = st.pending.len - 1 - i;
+		auto& change = st.pending[at];
+		if (change.path != path) { continue; }
+		if (change.kind == change_kind_t::created && kind == change_kind_t::removed) {
+			shrink(st.pending, at, 1);
+		} else if (change.kind == change_kind_t::removed && kind == change_kind_t::created) {
+			change.kind = change_kind_t::modified;
+		} else if (change.kind != change_kind_t::created || kind != change_kind_t::modified) {
+			change.kind = kind;
+		}
+		return;
+	}
+	grow(st.pending, st.pending.len, 1);
+	st.pending[st.pending.len - 1].path = move(path);
+	st.pending[st.pending.len - 1].kind = kind;
+}
+
+#ifdef __linux__
+nat8_t find_watch (const watcher_state_t& st, int wd)
+{
+	nat8_t lo = 0;
+	nat8_t hi = st.watches.len;
+	while (lo < hi) {
+		const auto mid = (lo + hi) / 2;
+		if (st.watches[mid].wd < wd) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// With report set, what's already inside counts as created, since it may have arrived before the watch did
+void_t add_watch (watcher_state_t& st, const path_t& path, bool_t recursive, bool_t report, err_t& err)
+{
+	if (err) { return; }
+
+	const auto wd = inotify_add_watch(get_fd(st.notify), as_strz(as_text(path)).ptr, watch_mask);
+	if (wd < 0) {
+		err = decode_os_err(errno);
+		return;
+	}
+	const auto at = find_watch(st, wd);
+	if (at == st.watches.len || st.watches[at].wd != wd) {
+		grow(st.watches, at, 1);
+		st.watches[at].wd = wd;
+	}
+	st.watches[at].path = clone(path);
+	st.watches[at].recursive = recursive;
+	if (!recursive) { return; }
+
+	err_t dir_err;
+	auto dir = open_dir(path, dir_err);
+	while (!dir_err) {
+		const auto entry = read_dir(dir, dir_err);
+		if (!entry.name.ptr) { break; }
+		const auto kind = stat_kind(dir, entry, dir_err);
+		if (dir_err) { break; }
+		auto entry_path = path + create_str(entry.name);
+		if (kind == entry_kind_t::dir) { add_watch(st, entry_path, true, report, err); }
+		if (report) { note_change(st, move(entry_path), change_kind_t::created); }
+	}
+	// files have nothing inside, and whatever vanished mid-scan will turn up as removed anyway
+}
+
+void_t drain_events (watcher_state_t& st, err_t& err)
+{
+	while (!err) {
+		const auto stat = read(get_fd(st.notify), st.buf.ptr, st.buf.len);
+		if (stat < 0) {
+			static_assert(EAGAIN == EWOULDBLOCK);
+			if (errno != EAGAIN) { err = decode_os_err(errno); }
+			return;
+		}
+
+		for (nat8_t at = 0; at < static_cast<nat8_t>(stat); ) {
+			inotify_event event;
+			copy_mem(&event, &st.buf[at], sizeof(event));
+			const auto name = reinterpret_cast<const char*>(&st.buf[at + sizeof(event)]);
+			at += sizeof(event) + event.len;
+
+			if (event.mask & IN_Q_OVERFLOW) {
+				note_change(st, {}, change_kind_t::overflow);
+				continue;
+			}
+			const auto watch_i = find_watch(st, event.wd);
+			if (watch_i == st.watches.len || st.watches[watch_i].wd != event.wd) { continue; }
+			if (event.mask & IN_IGNORED) {
+				shrink(st.watches, watch_i, 1);
+				continue;
+			}
+
+			const auto& entry = st.watches[watch_i];
+			auto path = event.len ? entry.path + create_str(name) : clone(entry.path);
+			auto kind = change_kind_t::modified;
+			if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+				kind = change_kind_t::created;
+			} else if (event.mask & (IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF)) {
+				kind = change_kind_t::removed;
+			}
+			if ((event.mask & IN_ISDIR) && kind == change_kind_t::created && entry.recursive) {
+				// gone again already is fine
+				err_t add_err;
+				add_watch(st, path, true, true, add_err);
+			}
+			note_change(st, move(path), kind);
+		}
+	}
+}
+#endif
+
+#ifdef _WIN32
+OVERLAPPED& get_overlapped (watch_entry_t& entry)
+{
+	return *static_cast<OVERLAPPED*>(static_cast<void_t*>(entry.io.ptr));
+}
+
+void_t issue_read (watcher_state_t& st, watch_entry_t& entry, err_t& err)
+{
+	auto& ov = get_overlapped(entry);
+	ov = {};
+	ov.hEvent = get_handle(st.event);
+	if (!ReadDirectoryChangesW(get_handle(entry.dir), entry.io.ptr + sizeof(OVERLAPPED), notify_buf_len,
+	                           entry.recursive, watch_filter, NULL, &ov, NULL)) {
+		err = decode_os_err(GetLastError());
+	}
+}
+
+void_t drain_events (watcher_state_t& st, err_t& err)
+{
+	ResetEvent(get_handle(st.event));
+	for (auto& entry : st.watches) {
+		DWORD len = 0;
+		if (!GetOverlappedResult(get_handle(entry.dir), &get_overlapped(entry), &len, FALSE)) {
+			if (GetLastError() != ERROR_IO_INCOMPLETE) { err = decode_os_err(GetLastError()); }
+			continue;
+		}
+		if (len == 0) { note_change(st, {}, change_kind_t::overflow); }
+
+		for (nat8_t at = 0; at < len; ) {
+			FILE_NOTIFY_INFORMATION info;
+			const auto rec = entry.io.ptr + sizeof(OVERLAPPED) + at;
+			copy_mem(&info, rec, sizeof(info));
+			auto wname = create_seq<wchar_t>(info.FileNameLength / sizeof(wchar_t) + 1);
+			copy_mem(wname.ptr, rec + offsetof(FILE_NOTIFY_INFORMATION, FileName), info.FileNameLength);
+			const auto name = create_str(wname.ptr);
+			at = info.NextEntryOffset ? at + info.NextEntryOffset : len;
+
+			if (entry.only_name && name != entry.only_name) { continue; }
+			auto kind = change_kind_t::modified;
+			if (info.Action == FILE_ACTION_ADDED || info.Action == FILE_ACTION_RENAMED_NEW_NAME) {
+				kind = change_kind_t::created;
+			} else if (info.Action == FILE_ACTION_REMOVED || info.Action == FILE_ACTION_RENAMED_OLD_NAME) {
+				kind = change_kind_t::removed;
+			}
+			note_change(st, create_path(as_text(entry.path) + "\\" + name), kind);
+		}
+		issue_read(st, entry, err);
+	}
+}
+#endif
+
+watcher_t::watcher_t () { }
+watcher_t::~watcher_t ()
+{
+	if (!opaq) { return; }
+
+	box_t<watcher_state_t> box;
+	acquire(box, &get_state(*this));
+	opaq = {};
+
+	auto& st = **box;
+	#ifdef __linux__
+	close(get_fd(st.epoll));
+	close(get_fd(st.timer));
+	close(get_fd(st.notify));
+	#endif
+	#ifdef _WIN32
+	for (auto& entry : st.watches) {
+		// the buffer has to stay put until the kernel's let go of it
+		DWORD len = 0;
+		CancelIo(get_handle(entry.dir));
+		GetOverlappedResult(get_handle(entry.dir), &get_overlapped(entry), &len, TRUE);
+		CloseHandle(get_handle(entry.dir));
+	}
+	CloseHandle(get_handle(st.event));
+	#endif
+}
+
+watcher_t::watcher_t (watcher_t&& ori) { *this = move(ori); }
+watcher_t& watcher_t::operator = (watcher_t&& ori)
+{
+	if (&ori != this) {
+		this->~watcher_t();
+		opaq = ori.opaq;
+		ori.opaq = {};
+	}
+	return *this;
+}
+
+watcher_t::operator bool_t () const
+{
+	return bool_t(opaq);
+}
+
+watcher_t create_watcher (inter_t window, err_t& err)
+{
+	if (err) { return {}; }
+
+	box_t<watcher_state_t> box;
+	auto& st = **box;
+	st.window = window;
+
+	#ifdef __linux__
+	const auto notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	const auto timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	const auto epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (notify_fd < 0 || timer_fd < 0 || epoll_fd < 0) {
+		err = decode_os_err(errno);
+		if (notify_fd >= 0) { close(notify_fd); }
+		if (timer_fd >= 0) { close(timer_fd); }
+		if (epoll_fd >= 0) { close(epoll_fd); }
+		return {};
+	}
+	st.notify = create_opaque_fd(notify_fd);
+	st.timer  = create_opaque_fd(timer_fd);
+	st.epoll  = create_opaque_fd(epoll_fd);
+	st.buf    = create_str(64 * 1024);
+
+	// the epoll is the ready handle, readable when there are events to take in or the window has closed
+	const int fds[] = { notify_fd, timer_fd };
+	for (auto fd : fds) {
+		epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+	}
+	#endif
+
+	#ifdef _WIN32
+	const auto event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!event) {
+		err = decode_os_err(GetLastError());
+		return {};
+	}
+	st.event = create_opaque_handle(event);
+	#endif
+
+	watcher_t watcher;
+	watcher.opaq = create_opaque_ptr(release(box));
+	return watcher;
+}
+
+void_t watch (watcher_t& watcher, const path_t& path, bool_t recursive, err_t& err)
+{
+	if (err) { return; }
+
+	auto& st = get_state(watcher);
+
+	#ifdef __linux__
+	add_watch(st, path, recursive, false, err);
+	#endif
+
+	#ifdef _WIN32
+	watch_entry_t entry;
+	entry.path = clone(path);
+	entry.recursive = recursive;
+	const auto attrs = GetFileAttributes(as_wstr(as_text(path)).ptr);
+	if (attrs == INVALID_FILE_ATTRIBUTES) {
+		err = decode_os_err(GetLastError());
+		return;
+	}
+	if (!(attrs & FILE_ATTRIBUTE_DIRECTORY)) {
+		entry.only_name = create_str(get_leaf(path));
+		entry.path = get_dir(path);
+		entry.recursive = false;
+	}
+	const auto dir = CreateFile(as_wstr(as_text(entry.path)).ptr, FILE_LIST_DIRECTORY,
+	                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+	                            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (dir == INVALID_HANDLE_VALUE) {
+		err = decode_os_err(GetLastError());
+		return;
+	}
+	entry.dir = create_opaque_handle(dir);
+	entry.io = create_str(sizeof(OVERLAPPED) + notify_buf_len);
+	grow(st.watches, st.watches.len, 1);
+	st.watches[st.watches.len - 1] = move(entry);
+	issue_read(st, st.watches[st.watches.len - 1], err);
+	#endif
+}
+
+seq_t<change_t> recv (watcher_t& watcher, err_t& err)
+{
+	if (err) { return {}; }
+
+	auto& st = get_state(watcher);
+	drain_events(st, err);
+	if (err) { return {}; }
+
+	#ifdef __linux__
+	// a burst that cancelled itself out leaves the window open with nothing in it, and its expiry would then keep the
+	// ready handle readable for good, so it's shut here
+	if (!st.pending && st.armed) {
+		nat8_t expiries = 0;
+		const auto red = read(get_fd(st.timer), &expiries, sizeof(expiries));
+		unused(red);
+		const itimerspec its = {};
+		timerfd_settime(get_fd(st.timer), 0, &its, nullptr);
+		st.armed = false;
+	}
+	#endif
+	if (!st.pending) { return {}; }
+
+	#ifdef __linux__
+	if (!st.armed && st.window > inter_t()) {
+		itimerspec its = {};
+		its.it_value.tv_sec  = static_cast<time_t>(get_secs(st.window));
+		its.it_value.tv_nsec = static_cast<long>(get_sec_nanosecs(st.window));
+		if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) { its.it_value.tv_nsec = 1; }
+		if (timerfd_settime(get_fd(st.timer), 0, &its, nullptr) != 0) {
+			err = decode_os_err(errno);
+			return {};
+		}
+		st.armed = true;
+		return {};
+	}
+	if (st.armed) {
+		nat8_t expiries = 0;
+		if (read(get_fd(st.timer), &expiries, sizeof(expiries)) < 0) { return {}; }
+		st.armed = false;
+	}
+	#endif
+
+	#ifdef _WIN32
+	if (st.window > inter_t()) {
+		Sleep(static_cast<DWORD>(clamp(get_millisecs(st.window), 1, max<DWORD>())));
+		drain_events(st, err);
+	}
+	#endif
+
+	return move(st.pending);
+}
+
+seq_t<change_t> recv_waited (watcher_t& watcher, inter_t timeout, err_t& err)
+{
+	if (err) { return {}; }
+
+	auto& st = get_state(watcher);
+	const auto deadline = get_current_inter() + timeout;
+	while (true) {
+		auto changes = recv(watcher, err);
+		if (err || changes) { return changes; }
+
+		const auto now = get_current_inter();
+		if (now >= deadline) { return {}; }
+		const auto wait_ms = get_millisecs(deadline - now) + 1;
+
+		#ifdef __linux__
+		epoll_event event = {};
+		const auto stat = epoll_wait(get_fd(st.epoll), &event, 1, static_cast<int>(clamp(wait_ms, 0, max<int>())));
+		if (stat < 0 && errno != EINTR) {
+			err = decode_os_err(errno);
+			return {};
+		}
+		#endif
+
+		#ifdef _WIN32
+		WaitForSingleObject(get_handle(st.event), static_cast<DWORD>(clamp(wait_ms, 0, max<DWORD>() - 1)));
+		#endif
+	}
+}
+
+opaque_t get_ready_handle (const watcher_t& watcher)
+{
+	const auto& st = get_state(watcher);
+	#ifdef __linux__
+	return st.epoll;
+	#endif
+	#ifdef _WIN32
+	return st.event;
+	#endif
+}
+
+const change_t* find_change (const seq_t<change_t>& changes, const path_t& path)
+{
+	for (const auto& change : changes) {
+		if (change.path == path) { return &change; }
+	}
+	return nullptr;
+}
+
+define_test(watch, "path,dir,time")
+{
+	err_t err;
+	auto root = create_temp_path(err);
+	remove_file(root, err);
+	create_dir(root, err);
+
+	auto watcher = create_watcher(create_inter_of_millisecs(20), err);
+	watch(watcher, root, true, err);
+	prove_same(as_text(err), "");
+	prove_false(recv(watcher, err));
+
+	// a burst of writes and a file that comes and goes, all inside one window
+	{ auto file = open_file(root + "a", true, err);
+		for (auto i : create_range(10)) { write(file, as_text(i), err); }
+	}
+	{ auto file = open_file(root + "temp", true, err); }
+	remove_file(root + "temp", err);
+	create_dir(root + "sub", err);
+	{ auto file = open_file(root + "sub" + "b", true, err); }
+
+	seq_t<change_t> changes;
+	for (auto i : create_range(100)) {
+		unused(i);
+		auto batch = recv_waited(watcher, create_inter_of_millisecs(50), err);
+		for (auto& change : batch) {
+			if (!find_change(changes, change.path)) {
+				grow(changes, changes.len, 1);
+				changes[changes.len - 1] = move(change);
+			}
+		}
+		if (find_change(changes, root + "a") && find_change(changes, root + "sub" + "b")) { break; }
+	}
+	prove_same(as_text(err), "");
+	prove_true(find_change(changes, root + "a"));
+	prove_eq(find_change(changes, root + "a")->kind, change_kind_t::created);
+	prove_true(find_change(changes, root + "sub"));
+	prove_true(find_change(changes, root + "sub" + "b"));
+	prove_false(find_change(changes, root + "temp"));
+
+	// the subdirectory's watched now, not just scanned
+	{ auto file = open_file(root + "sub" + "b", true, err);
+		write(file, "later", err);
+	}
+	const auto later = recv_waited(watcher, create_inter_of_secs(2), err);
+	prove_true(find_change(later, root + "sub" + "b"));
+	prove_eq(find_change(later, root + "sub" + "b")->kind, change_kind_t::modified);
+
+	// a file that's removed after its window opened leaves nothing to report, and the handle doesn't stay ready
+	{ auto file = open_file(root + "brief", true, err); }
+	prove_false(recv_waited(watcher, create_inter_of_millisecs(5), err));
+	remove_file(root + "brief", err);
+	prove_false(recv_waited(watcher, create_inter_of_millisecs(100), err));
+	#ifdef __linux__
+	epoll_event event = {};
+	prove_eq(epoll_wait(get_fd(get_ready_handle(watcher)), &event, 1, 0), 0);
+	#endif
+
+	remove_file(root + "sub" + "b", err);
+	remove_dir(root + "sub", err);
+	remove_file(root + "a", err);
+	remove_dir(root, err);
+	prove_same(as_text(err), "");
+	return {};
+}
@@ -0,0 +1,48 @@
+#ifndef libcx3_watch_hpp
+#define libcx3_watch_hpp
+#include "prelude.hpp"
+#include "file.hpp"
+#include "time.hpp"
+
+enum class change_kind_t : nat1_t
+{
+	modified = 0, // contents or attributes
+	created  = 1, // or moved in
+	removed  = 2, // or moved out
+	overflow = 3, // the kernel dropped events, so anything might have changed and it's time to rescan
+};
+
+struct change_t
+{
+	path_t        path    {};
+	change_kind_t kind    {};
+	pad_t<7>      padding {};
+};
+
+struct watcher_t
+{
+	opaque_t opaq {};
+
+	watcher_t ();
+	~watcher_t ();
+	watcher_t (const watcher_t& ori) = delete;
+	watcher_t& operator = (const watcher_t& ori) = delete;
+	watcher_t (watcher_t&& ori);
+	watcher_t& operator = (watcher_t&& ori);
+
+	explicit operator bool_t () const;
+};
+
+// Changes are held for the window after the first one in a burst, merged per path, and handed out together
+watcher_t create_watcher (inter_t window, err_t& err);
+
+// Recursive watches follow directories created under them later. Changes come with the full path.
+void_t watch (watcher_t& watcher, const path_t& path, bool_t recursive, err_t& err);
+
+// Doesn't block, giving back nothing until a batch is ready, which is when the ready handle polls readable.
+// Windows has no way to wake a poller when the window closes, so recv there sleeps out the rest of it instead.
+seq_t<change_t> recv (watcher_t& watcher, err_t& err);
+seq_t<change_t> recv_waited (watcher_t& watcher, inter_t timeout, err_t& err); // nothing after the timeout
+opaque_t get_ready_handle (const watcher_t& watcher);
+
+#endif
@@ -11,6 +11,7 @@ int main (int args_len, const char** args_ptr)
 
 	err_t err;
 	send(std_out, "Running on " + as_text(get_plat()) + get_line_sep(), err);
+	send(std_out, "Using " + as_text(get_isa(get_cpu())) + " kernels (" + as_text(get_cpu()) + ")" + get_line_sep(), err);
 
 	end_main();
 }